@@ -14,7 +14,14 @@
 * limitations under the License.
 */
 
-var lowLatencyAudio;
+var lowLatencyAudio,
+	pendingPreloads = {};
+
+// Preloads answer with the asset's integer handle, which play, stop and loop
+// accept in place of the id; anything else is an error message.
+function toHandle(response) {
+	return /^[0-9]+$/.test(response) ? parseInt(response, 10) : response;
+}
 
 module.exports = {
 
@@ -23,7 +30,7 @@ module.exports = {
 		    id = JSON.parse(unescape(args[0])),
 		    assetPath = JSON.parse(unescape(args[1])),
 		    response = lowLatencyAudio.getInstance().preloadFX(id, assetPath);
-		result.ok(response, false);
+		result.ok(toHandle(response), false);
 	},
 
 	preloadAudio: function (success, fail, args, env) {
@@ -32,10 +39,84 @@ module.exports = {
 		    assetPath = JSON.parse(unescape(args[1])),
 		    volume = args[2],
 		    voices = args[3],
-		    response = lowLatencyAudio.getInstance().preloadAudio(id, assetPath, volume, voices);
+		    priority = args[4] || 0,
+		    response = lowLatencyAudio.getInstance().preloadAudio(id, assetPath, volume, voices, priority);
+		result.ok(toHandle(response), false);
+	},
+
+	preloadFXAsync: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    id = JSON.parse(unescape(args[0])),
+		    assetPath = JSON.parse(unescape(args[1])),
+		    ticket = lowLatencyAudio.getInstance().preloadFXAsync(id, assetPath);
+		if (isNaN(parseInt(ticket, 10))) {
+			result.error(ticket, false);
+			return;
+		}
+		pendingPreloads[ticket] = result;
+		result.noResult(true);
+	},
+
+	preloadAudioAsync: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    id = JSON.parse(unescape(args[0])),
+		    assetPath = JSON.parse(unescape(args[1])),
+		    volume = args[2],
+		    voices = args[3],
+		    priority = args[4] || 0,
+		    ticket = lowLatencyAudio.getInstance().preloadAudioAsync(id, assetPath, volume, voices, priority);
+		if (isNaN(parseInt(ticket, 10))) {
+			result.error(ticket, false);
+			return;
+		}
+		pendingPreloads[ticket] = result;
+		result.noResult(true);
+	},
+
+	preloadManifest: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    manifest = JSON.parse(unescape(args[0])),
+		    ticket;
+
+		if (typeof manifest !== "string") {
+			manifest = JSON.stringify(manifest);
+		}
+
+		ticket = lowLatencyAudio.getInstance().preloadManifest(manifest);
+		if (isNaN(parseInt(ticket, 10))) {
+			result.error(ticket, false);
+			return;
+		}
+		pendingPreloads[ticket] = result;
+		result.noResult(true);
+	},
+
+	preloadStream: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    id = JSON.parse(unescape(args[0])),
+		    assetPath = JSON.parse(unescape(args[1])),
+		    volume = args[2],
+		    response = lowLatencyAudio.getInstance().preloadStream(id, assetPath, volume);
 		result.ok(response, false);
 	},
 
+	preloadSprite: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    id = JSON.parse(unescape(args[0])),
+		    assetPath = JSON.parse(unescape(args[1])),
+		    volume = args[2] || 1.0,
+		    voices = args[3] || 1,
+		    regionsPath = args[4] ? JSON.parse(unescape(args[4])) : "",
+		    response = lowLatencyAudio.getInstance().preloadSprite(id, assetPath, volume, voices, regionsPath);
+
+		// Success is a map of region names to handles.
+		if (response.charAt(0) === "{") {
+			result.ok(JSON.parse(response), false);
+		} else {
+			result.error(response, false);
+		}
+	},
+
 	play: function (success, fail, args, env) {
 		var result = new PluginResult(args, env),
 		    id = JSON.parse(unescape(args[0])),
@@ -43,6 +124,41 @@ module.exports = {
 		result.ok(response, false);
 	},
 
+	batch: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    operations = JSON.parse(unescape(args[0])),
+		    response = lowLatencyAudio.getInstance().batch(operations);
+		result.ok(response, false);
+	},
+
+	playAt: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    id = JSON.parse(unescape(args[0])),
+		    time = args[1],
+		    response = lowLatencyAudio.getInstance().playAt(id, time);
+		result.ok(response, false);
+	},
+
+	stopAt: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    id = JSON.parse(unescape(args[0])),
+		    time = args[1],
+		    response = lowLatencyAudio.getInstance().stopAt(id, time);
+		result.ok(response, false);
+	},
+
+	now: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    response = lowLatencyAudio.getInstance().now();
+		result.ok(parseFloat(response), false);
+	},
+
+	getScheduleStats: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    response = lowLatencyAudio.getInstance().getScheduleStats();
+		result.ok(response, false);
+	},
+
 	stop: function (success, fail, args, env) {
 		var result = new PluginResult(args, env),
 		    id = JSON.parse(unescape(args[0])),
@@ -62,6 +178,149 @@ module.exports = {
 		    id = JSON.parse(unescape(args[0])),
 		    response = lowLatencyAudio.getInstance().unload(id);
 		result.ok(response, false);
+	},
+
+	getLoadStats: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    id = JSON.parse(unescape(args[0])),
+		    response = lowLatencyAudio.getInstance().getLoadStats(id);
+		result.ok(response, false);
+	},
+
+	setPcmCache: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    limit = args[0],
+		    directory = args[1] ? JSON.parse(unescape(args[1])) : "",
+		    response = lowLatencyAudio.getInstance().setPcmCache(limit, directory);
+		result.ok(response, false);
+	},
+
+	getPcmCacheStats: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    response = lowLatencyAudio.getInstance().getPcmCacheStats();
+		result.ok(response, false);
+	},
+
+	getCommandStats: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    response = lowLatencyAudio.getInstance().getCommandStats();
+		result.ok(response, false);
+	},
+
+	getDeviceStats: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    response = lowLatencyAudio.getInstance().getDeviceStats();
+		result.ok(response, false);
+	},
+
+	shutdown: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    response = lowLatencyAudio.getInstance().shutdown();
+		result.ok(response, false);
+	},
+
+	getIdleStats: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    response = lowLatencyAudio.getInstance().getIdleStats();
+		result.ok(response, false);
+	},
+
+	getVoiceStats: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    response = lowLatencyAudio.getInstance().getVoiceStats();
+		result.ok(response, false);
+	},
+
+	setOfflineMode: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    rate = JSON.parse(unescape(args[0])),
+		    response = lowLatencyAudio.getInstance().setOfflineMode(rate);
+		result.ok(response, false);
+	},
+
+	renderOffline: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    seconds = JSON.parse(unescape(args[0])),
+		    path = JSON.parse(unescape(args[1])),
+		    response = lowLatencyAudio.getInstance().renderOffline(seconds, path);
+		result.ok(response, false);
+	},
+
+	setEngineMode: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    mode = JSON.parse(unescape(args[0])),
+		    response = lowLatencyAudio.getInstance().setEngineMode(mode);
+		result.ok(response, false);
+	},
+
+	setResampling: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    quality = JSON.parse(unescape(args[0])),
+		    response = lowLatencyAudio.getInstance().setResampling(quality);
+		result.ok(response, false);
+	},
+
+	setSampleStorage: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    storage = JSON.parse(unescape(args[0])),
+		    response = lowLatencyAudio.getInstance().setSampleStorage(storage);
+		result.ok(response, false);
+	},
+
+	setSilenceTrim: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    threshold = JSON.parse(unescape(args[0])),
+		    response = lowLatencyAudio.getInstance().setSilenceTrim(threshold);
+		result.ok(response, false);
+	},
+
+	setLoudnessTarget: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    target = JSON.parse(unescape(args[0])),
+		    response = lowLatencyAudio.getInstance().setLoudnessTarget(target);
+		result.ok(response, false);
+	},
+
+	getLoudness: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    id = JSON.parse(unescape(args[0])),
+		    response = lowLatencyAudio.getInstance().getLoudness(id);
+		result.ok(response, false);
+	},
+
+	setMemoryBudget: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    bytes = JSON.parse(unescape(args[0])),
+		    response = lowLatencyAudio.getInstance().setMemoryBudget(bytes);
+		result.ok(response, false);
+	},
+
+	pin: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    id = JSON.parse(unescape(args[0])),
+		    response = lowLatencyAudio.getInstance().pin(id);
+		result.ok(response, false);
+	},
+
+	unpin: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    id = JSON.parse(unescape(args[0])),
+		    response = lowLatencyAudio.getInstance().unpin(id);
+		result.ok(response, false);
+	},
+
+	getMemoryStats: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    response = lowLatencyAudio.getInstance().getMemoryStats();
+		result.ok(response, false);
+	},
+
+	benchmark: function (success, fail, args, env) {
+		var result = new PluginResult(args, env),
+		    name = JSON.parse(unescape(args[0])),
+		    parameters = args[1] ? JSON.parse(unescape(args[1])) : "",
+		    response = lowLatencyAudio.getInstance().benchmark(name, parameters);
+		result.ok(response, false);
 	}
 
 };
@@ -95,21 +354,155 @@ JNEXT.LowLatencyAudio = function () {
 	self.preloadFX = function (id, assetPath) {
 		return JNEXT.invoke(self.m_id, "preloadFX " + id + " " + assetPath);
 	};
-	self.preloadAudio = function (id, assetPath, volume, voices) {
-		return JNEXT.invoke(self.m_id, "preloadAudio " + id + " " + assetPath + " " + volume + " " + voices);
+	self.preloadAudio = function (id, assetPath, volume, voices, priority) {
+		return JNEXT.invoke(self.m_id, "preloadAudio " + id + " " + assetPath + " " + volume + " " + voices + " " + priority);
+	};
+	self.preloadFXAsync = function (id, assetPath) {
+		return JNEXT.invoke(self.m_id, "preloadFXAsync " + id + " " + assetPath);
+	};
+	self.preloadAudioAsync = function (id, assetPath, volume, voices, priority) {
+		return JNEXT.invoke(self.m_id, "preloadAudioAsync " + id + " " + assetPath + " " + volume + " " + voices + " " + priority);
+	};
+	self.preloadManifest = function (manifest) {
+		return JNEXT.invoke(self.m_id, "preloadManifest " + manifest);
+	};
+	self.preloadSprite = function (id, assetPath, volume, voices, regionsPath) {
+		return JNEXT.invoke(self.m_id, "preloadSprite " + id + " " + assetPath + " " + volume + " " + voices + (regionsPath ? " " + regionsPath : ""));
+	};
+	self.preloadStream = function (id, assetPath, volume) {
+		return JNEXT.invoke(self.m_id, "preloadStream " + id + " " + assetPath + " " + volume);
 	};
 	self.play = function (id) {
+		if (typeof id === "number") {
+			return JNEXT.invoke(self.m_id, "playHandle " + id);
+		}
 		return JNEXT.invoke(self.m_id, "play " + id);
 	};
+	// operations: [["play", handleOrId], ["volume", handleOrId, 0.5], ...]
+	self.batch = function (operations) {
+		var encoded = operations.map(function (operation) {
+			var target = typeof operation[1] === "number" ? "#" + operation[1] : operation[1];
+			return [operation[0], target].concat(operation.slice(2)).join(" ");
+		});
+		return JNEXT.invoke(self.m_id, "batch " + encoded.join(";"));
+	};
+	// time is in seconds on the device clock returned by now().
+	self.playAt = function (id, time) {
+		var target = typeof id === "number" ? "#" + id : id;
+		return JNEXT.invoke(self.m_id, "playAt " + target + " " + time);
+	};
+	self.stopAt = function (id, time) {
+		var target = typeof id === "number" ? "#" + id : id;
+		return JNEXT.invoke(self.m_id, "stopAt " + target + " " + time);
+	};
+	self.now = function () {
+		return JNEXT.invoke(self.m_id, "now");
+	};
+	self.getScheduleStats = function () {
+		return JNEXT.invoke(self.m_id, "getScheduleStats");
+	};
 	self.stop = function (id) {
+		if (typeof id === "number") {
+			return JNEXT.invoke(self.m_id, "stopHandle " + id);
+		}
 		return JNEXT.invoke(self.m_id, "stop " + id);
 	};
 	self.loop = function (id) {
+		if (typeof id === "number") {
+			return JNEXT.invoke(self.m_id, "loopHandle " + id);
+		}
 		return JNEXT.invoke(self.m_id, "loop " + id);
 	};
 	self.unload = function (id) {
 		return JNEXT.invoke(self.m_id, "unload " + id);
 	};
+	self.getLoadStats = function (id) {
+		return JNEXT.invoke(self.m_id, "getLoadStats " + id);
+	};
+	self.setPcmCache = function (limit, directory) {
+		return JNEXT.invoke(self.m_id, "setPcmCache " + limit + (directory ? " " + directory : ""));
+	};
+	self.getPcmCacheStats = function () {
+		return JNEXT.invoke(self.m_id, "getPcmCacheStats");
+	};
+	self.getCommandStats = function () {
+		return JNEXT.invoke(self.m_id, "getCommandStats");
+	};
+	self.getDeviceStats = function () {
+		return JNEXT.invoke(self.m_id, "getDeviceStats");
+	};
+	self.shutdown = function () {
+		return JNEXT.invoke(self.m_id, "shutdown");
+	};
+	self.getIdleStats = function () {
+		return JNEXT.invoke(self.m_id, "getIdleStats");
+	};
+	self.getVoiceStats = function () {
+		return JNEXT.invoke(self.m_id, "getVoiceStats");
+	};
+	self.setOfflineMode = function (rate) {
+		return JNEXT.invoke(self.m_id, "setOfflineMode " + rate);
+	};
+	self.renderOffline = function (seconds, path) {
+		return JNEXT.invoke(self.m_id, "renderOffline " + seconds + " " + path);
+	};
+	self.setEngineMode = function (mode) {
+		return JNEXT.invoke(self.m_id, "setEngineMode " + mode);
+	};
+	self.setResampling = function (quality) {
+		return JNEXT.invoke(self.m_id, "setResampling " + quality);
+	};
+	self.setSampleStorage = function (storage) {
+		return JNEXT.invoke(self.m_id, "setSampleStorage " + storage);
+	};
+	self.setSilenceTrim = function (threshold) {
+		return JNEXT.invoke(self.m_id, "setSilenceTrim " + threshold);
+	};
+	self.setLoudnessTarget = function (target) {
+		return JNEXT.invoke(self.m_id, "setLoudnessTarget " + target);
+	};
+	self.getLoudness = function (id) {
+		return JNEXT.invoke(self.m_id, "getLoudness " + id);
+	};
+	self.setMemoryBudget = function (bytes) {
+		return JNEXT.invoke(self.m_id, "setMemoryBudget " + bytes);
+	};
+	self.pin = function (id) {
+		return JNEXT.invoke(self.m_id, "pin " + id);
+	};
+	self.unpin = function (id) {
+		return JNEXT.invoke(self.m_id, "unpin " + id);
+	};
+	self.getMemoryStats = function () {
+		return JNEXT.invoke(self.m_id, "getMemoryStats");
+	};
+	self.benchmark = function (name, parameters) {
+		return JNEXT.invoke(self.m_id, "benchmark " + name + (parameters ? " " + parameters : ""));
+	};
+
+	// Completion of asynchronous preloads: "preloaded <ticket> <handle> <id>",
+	// "preloadFailed <ticket> <id>", or "manifestLoaded <ticket> <json timings>"
+	// for a whole manifest.
+	self.onEvent = function (strData) {
+		var arData = strData.split(" "),
+		    strEventDesc = arData[0],
+		    ticket = arData[1],
+		    id = arData.slice(2).join(" "),
+		    result = pendingPreloads[ticket];
+
+		if (!result) {
+			return;
+		}
+		delete pendingPreloads[ticket];
+
+		if (strEventDesc === "manifestLoaded") {
+			result.callbackOk(JSON.parse(id), false);
+		} else if (strEventDesc === "preloaded") {
+			result.callbackOk(parseInt(arData[2], 10), false);
+		} else {
+			result.callbackError("preload failed: " + id, false);
+		}
+	};
 
 	self.m_id = "";
 
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2013 BlackBerry Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <qdebug.h>
+#include <pthread.h>
+#include <time.h>
+#include <sstream>
+#include "audio_device.hpp"
+
+// From ALC_SOFT_loopback, which the platform headers do not declare.
+#ifndef ALC_SOFT_loopback
+#define ALC_FORMAT_CHANNELS_SOFT 0x1990
+#define ALC_FORMAT_TYPE_SOFT 0x1991
+#define ALC_STEREO_SOFT 0x1501
+#define ALC_SHORT_SOFT 0x1402
+#endif
+
+typedef ALCdevice* (*LoopbackOpen)(const ALCchar* name);
+typedef ALCboolean (*LoopbackFormatSupported)(ALCdevice* device, ALCsizei rate, ALCenum channels, ALCenum type);
+typedef void (*LoopbackRender)(ALCdevice* device, ALCvoid* buffer, ALCsizei frames);
+typedef ALCboolean (*SetThreadContext)(ALCcontext* context);
+
+static pthread_mutex_t deviceLock = PTHREAD_MUTEX_INITIALIZER;
+static ALCdevice* openDevice = 0;
+static ALCcontext* openContext = 0;
+static int references = 0;
+static unsigned int opens = 0;
+static double lastOpenMs = 0;
+static int loopback = 0;
+static LoopbackRender renderSamples = 0;
+
+// The scratch context belongs to the one thread that began it.
+static ALCdevice* scratchDevice = 0;
+static ALCcontext* scratchContext = 0;
+static LoopbackRender scratchRender = 0;
+static SetThreadContext setThreadContext = 0;
+
+static double deviceClock()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+bool AudioDevice::retain() {
+    pthread_mutex_lock(&deviceLock);
+
+    if (references > 0) {
+        references++;
+        pthread_mutex_unlock(&deviceLock);
+        return true;
+    }
+
+    double startTime = deviceClock();
+
+    // Grab the native device as default and create the context on it, or
+    // a loopback device that only mixes when asked to.
+    const ALCint* attributes = NULL;
+    ALCint loopbackAttributes[] = {
+        ALC_FORMAT_CHANNELS_SOFT, ALC_STEREO_SOFT,
+        ALC_FORMAT_TYPE_SOFT, ALC_SHORT_SOFT,
+        ALC_FREQUENCY, loopback,
+        0
+    };
+
+    if (loopback) {
+        LoopbackOpen openLoopback = 0;
+        LoopbackFormatSupported formatSupported = 0;
+        if (alcIsExtensionPresent(NULL, "ALC_SOFT_loopback")) {
+            openLoopback = (LoopbackOpen)alcGetProcAddress(NULL, "alcLoopbackOpenDeviceSOFT");
+            formatSupported = (LoopbackFormatSupported)alcGetProcAddress(NULL, "alcIsRenderFormatSupportedSOFT");
+            renderSamples = (LoopbackRender)alcGetProcAddress(NULL, "alcRenderSamplesSOFT");
+        }
+        if (!openLoopback || !formatSupported || !renderSamples) {
+            qDebug() << "ALC_SOFT_loopback is not available";
+            pthread_mutex_unlock(&deviceLock);
+            return false;
+        }
+
+        openDevice = openLoopback(NULL);
+        if (openDevice && !formatSupported(openDevice, loopback, ALC_STEREO_SOFT, ALC_SHORT_SOFT)) {
+            qDebug() << "Loopback device cannot render 16 bit stereo at " << loopback << " Hz";
+            alcCloseDevice(openDevice);
+            openDevice = 0;
+        }
+        attributes = loopbackAttributes;
+    } else {
+        openDevice = alcOpenDevice(NULL);
+    }
+
+    if (!openDevice) {
+        qDebug() << "Could not open the default audio device";
+        pthread_mutex_unlock(&deviceLock);
+        return false;
+    }
+
+    openContext = alcCreateContext(openDevice, attributes);
+    if (!openContext || !alcMakeContextCurrent(openContext)) {
+        qDebug() << "Could not create an OpenAL context: " << alcGetError(openDevice);
+        if (openContext)
+            alcDestroyContext(openContext);
+        alcCloseDevice(openDevice);
+        openContext = 0;
+        openDevice = 0;
+        pthread_mutex_unlock(&deviceLock);
+        return false;
+    }
+
+    references = 1;
+    opens++;
+    lastOpenMs = deviceClock() - startTime;
+    qDebug() << "Opened audio device in " << lastOpenMs << " ms";
+
+    pthread_mutex_unlock(&deviceLock);
+    return true;
+}
+
+void AudioDevice::release() {
+    pthread_mutex_lock(&deviceLock);
+
+    if (references > 0 && --references == 0) {
+        alcMakeContextCurrent(NULL);
+        alcDestroyContext(openContext);
+        alcCloseDevice(openDevice);
+        openContext = 0;
+        openDevice = 0;
+        qDebug() << "Closed audio device";
+    }
+
+    pthread_mutex_unlock(&deviceLock);
+}
+
+bool AudioDevice::isOpen() {
+    pthread_mutex_lock(&deviceLock);
+    bool open = references > 0;
+    pthread_mutex_unlock(&deviceLock);
+    return open;
+}
+
+ALCdevice* AudioDevice::device() {
+    return openDevice;
+}
+
+ALCcontext* AudioDevice::context() {
+    return openContext;
+}
+
+bool AudioDevice::setLoopback(int rate) {
+    pthread_mutex_lock(&deviceLock);
+    bool closed = references == 0;
+    if (closed)
+        loopback = rate > 0 ? rate : 0;
+    pthread_mutex_unlock(&deviceLock);
+    return closed;
+}
+
+int AudioDevice::loopbackRate() {
+    return loopback;
+}
+
+bool AudioDevice::render(short* samples, int frames) {
+    if (!loopback || !openDevice)
+        return false;
+    renderSamples(openDevice, samples, frames);
+    return true;
+}
+
+bool AudioDevice::beginScratch(int rate, int sources) {
+    if (scratchDevice || !alcIsExtensionPresent(NULL, "ALC_SOFT_loopback")
+            || !alcIsExtensionPresent(NULL, "ALC_EXT_thread_local_context"))
+        return false;
+
+    LoopbackOpen openLoopback = (LoopbackOpen)alcGetProcAddress(NULL, "alcLoopbackOpenDeviceSOFT");
+    scratchRender = (LoopbackRender)alcGetProcAddress(NULL, "alcRenderSamplesSOFT");
+    setThreadContext = (SetThreadContext)alcGetProcAddress(NULL, "alcSetThreadContext");
+    if (!openLoopback || !scratchRender || !setThreadContext)
+        return false;
+
+    scratchDevice = openLoopback(NULL);
+    if (!scratchDevice)
+        return false;
+
+    ALCint attributes[] = {
+        ALC_FORMAT_CHANNELS_SOFT, ALC_STEREO_SOFT,
+        ALC_FORMAT_TYPE_SOFT, ALC_SHORT_SOFT,
+        ALC_FREQUENCY, rate,
+        ALC_MONO_SOURCES, sources,
+        0
+    };
+    scratchContext = alcCreateContext(scratchDevice, attributes);
+    if (!scratchContext || !setThreadContext(scratchContext)) {
+        endScratch();
+        return false;
+    }
+    return true;
+}
+
+void AudioDevice::renderScratch(short* samples, int frames) {
+    if (scratchDevice)
+        scratchRender(scratchDevice, samples, frames);
+}
+
+void AudioDevice::endScratch() {
+    if (setThreadContext)
+        setThreadContext(NULL);
+    if (scratchContext)
+        alcDestroyContext(scratchContext);
+    if (scratchDevice)
+        alcCloseDevice(scratchDevice);
+    scratchContext = 0;
+    scratchDevice = 0;
+}
+
+std::string AudioDevice::stats() {
+    pthread_mutex_lock(&deviceLock);
+    std::ostringstream result;
+    result << (references > 0 ? "open" : "closed") << (loopback ? " (loopback)" : "") << ", references " << references
+           << ", opened " << opens << " times, last open " << lastOpenMs << " ms";
+    pthread_mutex_unlock(&deviceLock);
+    return result.str();
+}
@@ -0,0 +1,62 @@
+/*
+* Copyright (c) 2013 BlackBerry Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+
+#ifndef AudioDevice_HPP_
+#define AudioDevice_HPP_
+
+#include <string>
+#include <AL/alc.h>
+
+// The OpenAL device and context, shared by every plugin object. The first
+// retain opens them and the last release closes them, so unloading assets
+// never tears down the device and the next trigger does not pay for
+// reopening it.
+class AudioDevice {
+
+public:
+    // Open the default device on first use and make its context current.
+    static bool retain();
+    static void release();
+
+    static bool isOpen();
+    static ALCdevice* device();
+    static ALCcontext* context();
+
+    // Open a loopback device rendering 16 bit stereo at rate instead of the
+    // default device from the next retain on, or go back to it with 0. Only
+    // possible while the device is closed.
+    static bool setLoopback(int rate);
+    static int loopbackRate();
+    // Mix the next frames of a loopback device into samples.
+    static bool render(short* samples, int frames);
+
+    // A private loopback device and context with room for sources, current
+    // on the calling thread only, so OpenAL's own mixing can be timed
+    // without a sound or disturbing the shared context. Needs
+    // ALC_SOFT_loopback and ALC_EXT_thread_local_context.
+    static bool beginScratch(int rate, int sources);
+    static void renderScratch(short* samples, int frames);
+    static void endScratch();
+
+    // How long opening took, and how many times it has been opened.
+    static std::string stats();
+
+private:
+    AudioDevice();
+};
+
+#endif /* AudioDevice_HPP_ */
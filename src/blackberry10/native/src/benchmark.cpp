@@ -0,0 +1,530 @@
+/*
+ * Copyright (c) 2013 BlackBerry Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// On-device microbenchmarks, run through the "benchmark" command so the
+// numbers come from the hardware the plugin ships on. None of them make a
+// sound; they time the engine's own work with the device idle.
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sstream>
+#include "lowlatencyaudio_js.hpp"
+
+using namespace std;
+
+static double benchmarkClock()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+string LowLatencyAudio_JS::benchmark(const string& arguments) {
+    istringstream input(arguments);
+    string name;
+    input >> name;
+
+    if (name == "trigger") {
+        string id;
+        int iterations = 10000;
+        input >> id >> iterations;
+        return benchmarkTrigger(QString::fromStdString(id), iterations);
+    }
+
+    if (name == "mixer") {
+        int voices = 64;
+        double seconds = 2;
+        input >> voices >> seconds;
+        return benchmarkMixer(voices, seconds);
+    }
+
+    if (name == "decode") {
+        // Asset paths, optionally followed by a run count.
+        vector<string> paths;
+        int runs = 5;
+        string token;
+        while (input >> token) {
+            if (token.find_first_not_of("0123456789") == string::npos)
+                runs = atoi(token.c_str());
+            else
+                paths.push_back(token);
+        }
+        return benchmarkDecode(paths, runs);
+    }
+
+    if (name == "adpcm") {
+        int voices = 64;
+        double seconds = 2;
+        input >> voices >> seconds;
+        return benchmarkAdpcm(voices, seconds);
+    }
+
+    if (name == "resample") {
+        int rate = 22050;
+        string quality = "medium";
+        int voices = 64;
+        input >> rate >> quality >> voices;
+        ResampleQuality parsed;
+        if (!Resampler::parseQuality(quality.c_str(), parsed) || parsed == RESAMPLE_OFF)
+            return "Usage: benchmark resample <asset rate> <fast|medium|best> <voices>";
+        return benchmarkResample(rate, parsed, voices);
+    }
+
+    if (name == "convert") {
+        double seconds = 10;
+        input >> seconds;
+        return benchmarkConvert(seconds);
+    }
+
+    if (name == "silence") {
+        double seconds = 10;
+        input >> seconds;
+        return benchmarkSilence(seconds);
+    }
+
+    if (name == "loudness") {
+        double seconds = 10;
+        input >> seconds;
+        return benchmarkLoudness(seconds);
+    }
+
+    return "Unknown benchmark: " + name + ". Available: trigger, mixer, decode, resample, adpcm, convert, silence, "
+           "loudness";
+}
+
+// Compare picking a voice by polling every source, as play used to, with
+// the engine side voice pool. Only the choice is timed; nothing is started.
+string LowLatencyAudio_JS::benchmarkTrigger(QString id, int iterations) {
+    int slot = m_assetSlots.value(id, -1);
+    if (slot < 0 || m_voicePool.count() == 0 || iterations <= 0)
+        return "Could not find the file " + id.toStdString() + " . Maybe it hasn't been loaded.";
+
+    const AudioAsset* asset = m_assets[slot];
+    int voices = asset->voices < m_voicePool.count() ? asset->voices : m_voicePool.count();
+
+    // Polling: two AL queries per source until an idle one turns up.
+    unsigned int queries = 0;
+    double start = benchmarkClock();
+    for (int n = 0; n < iterations; n++) {
+        float currentTime = 0, furthestTime = 0;
+        ALuint replayingSource = 0;
+        for (int i = 0; i < voices; ++i) {
+            ALenum state;
+            ALuint source = m_voicePool.voice(i).source;
+            alGetSourcef(source, AL_SEC_OFFSET, &currentTime);
+            alGetSourcei(source, AL_SOURCE_STATE, &state);
+            queries += 2;
+            if (state != AL_PLAYING) {
+                replayingSource = source;
+                break;
+            }
+            if (currentTime > furthestTime) {
+                furthestTime = currentTime;
+                replayingSource = source;
+            }
+        }
+        (void)replayingSource;
+    }
+    double polling = benchmarkClock() - start;
+
+    // Pool: work on a copy so the live voice state is left alone, with
+    // triggers spaced closely enough that the asset's voices end up busy.
+    VoicePool pool = m_voicePool;
+    double now = benchmarkClock();
+    start = benchmarkClock();
+    for (int n = 0; n < iterations; n++)
+        pool.acquire(slot, asset->priority, asset->voices, asset->duration, now + n * 0.001);
+    double allocated = benchmarkClock() - start;
+
+    ostringstream result;
+    result << "trigger " << id.toStdString() << ", " << voices << " voices, "
+           << iterations << " iterations: polling " << polling * 1e9 / iterations << " ns ("
+           << (double)queries / iterations << " AL queries) per trigger, pool "
+           << allocated * 1e9 / iterations << " ns (0 AL queries) per trigger";
+    return result.str();
+}
+
+// Time the software mixer on looping noise, once at the output rate (the
+// vector kernels) and once at half of it (the resampling path). The mixer is
+// never opened: it has no source or feeding thread, so nothing reaches the
+// device and nothing else takes its lock while it is timed.
+static double mixerThroughput(int rate, int clipRate, int voices, double seconds, bool adpcm = false)
+{
+    vector<short> noise(clipRate);
+    srand(1);
+    for (size_t i = 0; i < noise.size(); i++)
+        noise[i] = (short)(rand() % 65536 - 32768);
+
+    MixerClip clip;
+    clip.setAdpcmStorage(adpcm);
+    clip.assign(&noise[0], noise.size() * sizeof(short), 1, 16, clipRate);
+
+    SoftwareMixer mixer;
+    mixer.setRate(rate);
+    bool stolen;
+    for (int i = 0; i < voices; i++)
+        mixer.play(0, &clip, 1.0f / voices, true, 0, i * 97 % clip.frames(), stolen);
+
+    int frames = (int)(seconds * rate);
+    vector<short> output(SOFTWARE_MIXER_BLOCK_FRAMES * 2);
+    double start = benchmarkClock();
+    for (int done = 0; done < frames; done += SOFTWARE_MIXER_BLOCK_FRAMES)
+        mixer.render(&output[0], SOFTWARE_MIXER_BLOCK_FRAMES);
+    return seconds / (benchmarkClock() - start);
+}
+
+// The same noise on one OpenAL source per voice, mixed by OpenAL itself on
+// a private loopback context. Returns 0 where that cannot be set up, and
+// the number of sources the context gave in voices.
+static double sourceThroughput(int rate, int& voices, double seconds)
+{
+    if (!AudioDevice::beginScratch(rate, voices))
+        return 0;
+
+    vector<short> noise(rate);
+    srand(1);
+    for (size_t i = 0; i < noise.size(); i++)
+        noise[i] = (short)(rand() % 65536 - 32768);
+
+    ALuint buffer;
+    alGenBuffers(1, &buffer);
+    alBufferData(buffer, AL_FORMAT_MONO16, &noise[0], noise.size() * sizeof(short), rate);
+
+    vector<ALuint> sources;
+    for (int i = 0; i < voices; i++) {
+        ALuint source;
+        alGenSources(1, &source);
+        if (alGetError() != AL_NO_ERROR)
+            break;
+        alSourcei(source, AL_BUFFER, buffer);
+        alSourcei(source, AL_LOOPING, AL_TRUE);
+        alSourcef(source, AL_GAIN, 1.0f / voices);
+        alSourcei(source, AL_SAMPLE_OFFSET, i * 97 % rate);
+        alSourcePlay(source);
+        sources.push_back(source);
+    }
+    voices = sources.size();
+
+    int frames = (int)(seconds * rate);
+    vector<short> output(SOFTWARE_MIXER_BLOCK_FRAMES * 2);
+    double start = benchmarkClock();
+    for (int done = 0; done < frames; done += SOFTWARE_MIXER_BLOCK_FRAMES)
+        AudioDevice::renderScratch(&output[0], SOFTWARE_MIXER_BLOCK_FRAMES);
+    double elapsed = benchmarkClock() - start;
+
+    if (!sources.empty())
+        alDeleteSources(sources.size(), &sources[0]);
+    alDeleteBuffers(1, &buffer);
+    AudioDevice::endScratch();
+    return voices ? seconds / elapsed : 0;
+}
+
+string LowLatencyAudio_JS::benchmarkMixer(int voices, double seconds) {
+    if (voices <= 0 || voices > SOFTWARE_MIXER_MAX_VOICES || seconds <= 0)
+        return "Usage: benchmark mixer <voices 1-512> <seconds>";
+
+    int rate = m_mixer ? m_mixer->rate() : SOFTWARE_MIXER_DEFAULT_RATE;
+    double native = mixerThroughput(rate, rate, voices, seconds);
+    double resampled = mixerThroughput(rate, rate / 2, voices, seconds);
+
+    ostringstream result;
+    result << "mixer " << SoftwareMixer::kernelName() << ", " << voices << " voices at "
+           << rate << " Hz: " << native << "x realtime, "
+           << 1e9 / (native * rate * voices) << " ns per voice frame, ~"
+           << (int)(native * voices) << " voices per core; resampled "
+           << resampled << "x realtime, ~" << (int)(resampled * voices)
+           << " voices per core; ";
+
+    int sources = voices;
+    double perSource = sourceThroughput(rate, sources, seconds);
+    if (perSource > 0)
+        result << "OpenAL per source, " << sources << " sources: " << perSource << "x realtime, "
+               << 1e9 / (perSource * rate * sources) << " ns per voice frame, ~"
+               << (int)(perSource * sources) << " voices per core";
+    else
+        result << "OpenAL per source: not measurable here (needs ALC_SOFT_loopback and "
+               << "ALC_EXT_thread_local_context)";
+    result << "; OpenAL sources available " << m_voicePool.capacity();
+    return result.str();
+}
+
+// Per voice mixing cost of an asset left at its own rate, which every voice
+// resamples as it plays, against the same asset converted once at load time,
+// plus what that conversion costs. The software mixer stands in for the
+// driver here, since OpenAL's own per voice cost cannot be timed from outside.
+string LowLatencyAudio_JS::benchmarkResample(int rate, ResampleQuality quality, int voices) {
+    if (rate < 8000 || rate > 192000 || voices <= 0 || voices > SOFTWARE_MIXER_MAX_VOICES)
+        return "Usage: benchmark resample <asset rate 8000-192000> <fast|medium|best> <voices 1-512>";
+
+    int output = m_mixer ? m_mixer->rate() : m_outputRate ? m_outputRate : SOFTWARE_MIXER_DEFAULT_RATE;
+    Resampler resampler;
+    if (rate == output || !resampler.configure(rate, output, quality))
+        return "benchmark resample: the asset rate must differ from the output rate";
+
+    // Two seconds of stereo noise through the load-time converter.
+    long frames = 2 * rate;
+    vector<short> noise(frames * 2);
+    srand(1);
+    for (size_t i = 0; i < noise.size(); i++)
+        noise[i] = (short)(rand() % 65536 - 32768);
+    vector<short> converted(resampler.outputFrames(frames) * 2);
+    double start = benchmarkClock();
+    resampler.process(&noise[0], frames, 2, &converted[0]);
+    double convertSeconds = benchmarkClock() - start;
+
+    double before = mixerThroughput(output, rate, voices, 2);
+    double after = mixerThroughput(output, output, voices, 2);
+    double beforeNs = 1e9 / (before * output * voices);
+    double afterNs = 1e9 / (after * output * voices);
+
+    ostringstream result;
+    result << "resample " << Resampler::qualityName(quality) << " " << Resampler::kernelName() << ", "
+           << resampler.taps() << " taps, " << rate << " to " << output << " Hz: load time "
+           << convertSeconds * 1000 / 2 << " ms per second of stereo audio ("
+           << 2 / convertSeconds << "x realtime); per voice at " << voices << " voices, resampled while mixing "
+           << beforeNs << " ns per frame, resampled at load " << afterNs << " ns per frame ("
+           << beforeNs / afterNs << "x)";
+    return result.str();
+}
+
+// Per voice cost of mixing IMA ADPCM clips, which every voice expands as it
+// plays, against the same clips kept as 16 bit PCM, and the memory each
+// takes per second of mono audio.
+string LowLatencyAudio_JS::benchmarkAdpcm(int voices, double seconds) {
+    if (voices <= 0 || voices > SOFTWARE_MIXER_MAX_VOICES || seconds <= 0)
+        return "Usage: benchmark adpcm <voices 1-512> <seconds>";
+
+    int rate = m_mixer ? m_mixer->rate() : m_outputRate ? m_outputRate : SOFTWARE_MIXER_DEFAULT_RATE;
+    double pcm = mixerThroughput(rate, rate, voices, seconds);
+    double adpcm = mixerThroughput(rate, rate, voices, seconds, true);
+    double pcmNs = 1e9 / (pcm * rate * voices);
+    double adpcmNs = 1e9 / (adpcm * rate * voices);
+
+    // Load-time encoding of one second of noise.
+    vector<short> noise(rate);
+    for (size_t i = 0; i < noise.size(); i++)
+        noise[i] = (short)(rand() % 65536 - 32768);
+    vector<unsigned char> encoded(ImaAdpcm::encodedSize(rate, 1));
+    double start = benchmarkClock();
+    ImaAdpcm::encode(&noise[0], rate, 1, &encoded[0]);
+    double encodeMs = (benchmarkClock() - start) * 1000;
+
+    ostringstream result;
+    result << "adpcm " << SoftwareMixer::kernelName() << " mix, " << voices << " voices at " << rate
+           << " Hz: pcm " << pcmNs << " ns per voice frame, adpcm " << adpcmNs
+           << " ns per voice frame, decode " << adpcmNs - pcmNs << " ns per voice frame ("
+           << (adpcmNs - pcmNs) * rate / 1e6 << " ms of CPU per voice second), ~"
+           << (int)(adpcm * voices) << " adpcm voices per core; memory per second "
+           << rate * sizeof(short) << " bytes pcm, " << encoded.size() << " bytes adpcm ("
+           << (double)rate * sizeof(short) / encoded.size() << "x); encode " << encodeMs
+           << " ms per second of audio";
+    return result.str();
+}
+
+// Load-time cost of reducing 24 bit, 32 bit and float wave data to 16 bits,
+// over seconds of stereo audio at the output rate.
+string LowLatencyAudio_JS::benchmarkConvert(double seconds) {
+    if (seconds <= 0 || seconds > 600)
+        return "Usage: benchmark convert <seconds 1-600>";
+
+    int rate = m_outputRate ? m_outputRate : SOFTWARE_MIXER_DEFAULT_RATE;
+    long count = (long)(seconds * rate) * 2;
+    vector<int> wide(count);
+    vector<float> floats(count);
+    vector<unsigned char> packed(count * 3);
+    srand(1);
+    for (long i = 0; i < count; i++) {
+        int sample = (rand() % 65536 - 32768) * 256 + rand() % 256;
+        wide[i] = sample * 256;
+        floats[i] = sample / 8388608.0f;
+        packed[i * 3] = sample & 0xff;
+        packed[i * 3 + 1] = (sample >> 8) & 0xff;
+        packed[i * 3 + 2] = (sample >> 16) & 0xff;
+    }
+
+    vector<short> out(count);
+    DitherState dither;
+    SampleConverter::seed(dither);
+    double times[3];
+    double start = benchmarkClock();
+    SampleConverter::fromInt24(&packed[0], count, &out[0], dither);
+    times[0] = benchmarkClock() - start;
+    start = benchmarkClock();
+    SampleConverter::fromInt32(&wide[0], count, &out[0], dither);
+    times[1] = benchmarkClock() - start;
+    start = benchmarkClock();
+    SampleConverter::fromFloat32(&floats[0], count, &out[0], dither);
+    times[2] = benchmarkClock() - start;
+
+    const char* names[3] = { "int24", "int32", "float32" };
+    ostringstream result;
+    result << "convert " << SampleConverter::kernelName() << ", " << seconds << " s of stereo at "
+           << rate << " Hz:";
+    for (int i = 0; i < 3; i++)
+        result << " " << names[i] << " " << times[i] * 1e9 / count << " ns per sample, "
+               << count / times[i] / 1e6 << " Msamples/s, " << times[i] * 1000 / seconds
+               << " ms per second of audio;";
+    result << " float32 passthrough " << (alIsExtensionPresent("AL_EXT_FLOAT32") ? "available" : "unavailable");
+    return result.str();
+}
+
+// Load-time cost of finding the silence to trim, on the worst case: a
+// stereo asset silent throughout, which both scans cover in full.
+string LowLatencyAudio_JS::benchmarkSilence(double seconds) {
+    if (seconds <= 0 || seconds > 600)
+        return "Usage: benchmark silence <seconds 1-600>";
+
+    int rate = m_outputRate ? m_outputRate : SOFTWARE_MIXER_DEFAULT_RATE;
+    long count = (long)(seconds * rate) * 2;
+    vector<short> quiet(count);
+    srand(1);
+    for (long i = 0; i < count; i++)
+        quiet[i] = (short)(rand() % 65 - 32);
+
+    short threshold = SampleAnalysis::thresholdFromDb(-60);
+    double start = benchmarkClock();
+    long leading = SampleAnalysis::leadingSilence(&quiet[0], count, threshold);
+    long trailing = SampleAnalysis::trailingSilence(&quiet[0], count, threshold);
+    double elapsed = benchmarkClock() - start;
+
+    ostringstream result;
+    result << "silence " << SampleAnalysis::kernelName() << ", " << seconds << " s of stereo at " << rate
+           << " Hz, -60 dBFS: " << elapsed * 1e9 / (2 * count) << " ns per sample scanned, "
+           << elapsed * 1000 / seconds << " ms per second of audio"
+           << (leading == count && trailing == count ? "" : " (noise above threshold)");
+    return result.str();
+}
+
+// What measuring loudness adds to decoding a stereo asset, fed to the
+// meter in the blocks the loaders use.
+string LowLatencyAudio_JS::benchmarkLoudness(double seconds) {
+    if (seconds <= 0 || seconds > 600)
+        return "Usage: benchmark loudness <seconds 1-600>";
+
+    int rate = m_outputRate ? m_outputRate : SOFTWARE_MIXER_DEFAULT_RATE;
+    long frames = (long)(seconds * rate);
+    vector<short> noise(frames * 2);
+    srand(1);
+    for (size_t i = 0; i < noise.size(); i++)
+        noise[i] = (short)(rand() % 16384 - 8192);
+
+    LoudnessMeter meter(rate, 2);
+    double start = benchmarkClock();
+    for (long done = 0; done < frames; done += SAMPLE_ANALYSIS_BLOCK_FRAMES) {
+        long count = frames - done < SAMPLE_ANALYSIS_BLOCK_FRAMES ? frames - done : SAMPLE_ANALYSIS_BLOCK_FRAMES;
+        meter.add(&noise[done * 2], count);
+    }
+    Loudness loudness = meter.result();
+    double elapsed = benchmarkClock() - start;
+
+    ostringstream result;
+    result << "loudness " << SampleAnalysis::kernelName() << " reductions, " << seconds << " s of stereo at "
+           << rate << " Hz: " << elapsed * 1e9 / frames << " ns per frame, " << elapsed * 1000 / seconds
+           << " ms per second of audio; noise measured " << loudness.integrated << " LUFS, peak "
+           << loudness.peak << " dBFS";
+    return result.str();
+}
+
+// Fully decode a compressed file into a scratch block, as the loaders do
+// minus the copy into OpenAL. Returns the seconds of audio decoded, or a
+// negative value if the file is neither MP3 nor Ogg Vorbis.
+static double decodeOnce(const MappedFile& file, string& codec)
+{
+    vector<char> scratch(MP3_MAX_FRAME_SAMPLES * 2 * sizeof(short) * 4);
+
+    if (isMp3(file.data(), file.size())) {
+        codec = "mp3";
+        Mp3Decoder* decoder = new Mp3Decoder();
+        double seconds = -1;
+        if (decoder->open(file.data(), file.size())) {
+            const Mp3Info& info = decoder->info();
+            int capacity = scratch.size() / (info.channels * sizeof(short));
+            long frames = 0;
+            int decoded;
+            while ((decoded = decoder->read((short*)&scratch[0], capacity)) > 0)
+                frames += decoded;
+            seconds = (double)frames / info.rate;
+        }
+        delete decoder;
+        return seconds;
+    }
+
+    if (file.size() >= 4 && memcmp(file.data(), "OggS", 4) == 0) {
+        codec = "ogg";
+        OggMemorySource source = { &file, 0 };
+        OggVorbis_File ogg;
+        if (ov_open_callbacks(&source, &ogg, NULL, 0, oggMemoryCallbacks()) < 0)
+            return -1;
+
+        vorbis_info* info = ov_info(&ogg, -1);
+        long bytes = 0;
+        long result;
+        int section;
+        while ((result = ov_read(&ogg, &scratch[0], scratch.size(), 0, 2, 1, &section)) != 0) {
+            if (result > 0)
+                bytes += result;
+            else if (result != OV_HOLE)
+                break;
+        }
+        double seconds = bytes / (2.0 * info->channels * info->rate);
+        ov_clear(&ogg);
+        return seconds;
+    }
+
+    return -1;
+}
+
+// Time the built-in MP3 decoder against Vorbis, typically on an MP3 and the
+// Ogg it was transcoded from. The PCM cache is bypassed; this is the cost of
+// a first launch.
+string LowLatencyAudio_JS::benchmarkDecode(const vector<string>& paths, int runs) {
+    if (paths.empty() || runs <= 0)
+        return "Usage: benchmark decode <path> [<path> ...] [runs]";
+
+    ostringstream result;
+    double costs[2] = { 0, 0 };
+    string codecs[2];
+    for (size_t i = 0; i < paths.size(); i++) {
+        QByteArray pathBytes = resolveAssetPath(QString::fromStdString(paths[i])).toLocal8Bit();
+        MappedFile file;
+        if (!file.open(pathBytes.constData()))
+            return "Could not map audio file " + paths[i];
+
+        string codec;
+        double seconds = 0;
+        double start = benchmarkClock();
+        for (int run = 0; run < runs; run++)
+            seconds = decodeOnce(file, codec);
+        double elapsed = (benchmarkClock() - start) / runs;
+        if (seconds <= 0)
+            return "Not an mp3 or ogg file: " + paths[i];
+
+        if (i < 2) {
+            costs[i] = elapsed / seconds;
+            codecs[i] = codec;
+        }
+        result << (i ? "; " : "") << "decode " << paths[i] << ": " << codec << ", "
+               << seconds << " s of audio in " << elapsed * 1000 << " ms, "
+               << seconds / elapsed << "x realtime, "
+               << file.size() / elapsed / 1000000 << " MB/s of input";
+    }
+
+    if (paths.size() >= 2 && costs[1] > 0)
+        result << "; " << codecs[0] << " costs " << costs[0] / costs[1] << "x "
+               << codecs[1] << " per second of audio";
+    return result.str();
+}
@@ -0,0 +1,69 @@
+/*
+* Copyright (c) 2013 BlackBerry Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+
+#ifndef CommandRing_HPP_
+#define CommandRing_HPP_
+
+// Fixed size single-producer/single-consumer queue. One thread pushes and
+// one thread pops, neither ever blocks or takes a lock; each side only
+// writes its own index and publishes it after a full barrier. Size must be
+// a power of two, and one slot is always left empty.
+template<class T, unsigned int Size>
+class CommandRing {
+
+public:
+    CommandRing() :
+            m_head(0), m_tail(0) {
+    }
+
+    // Producer side; returns false if the ring is full.
+    bool push(const T& item) {
+        unsigned int tail = m_tail;
+        unsigned int next = (tail + 1) & (Size - 1);
+        if (next == m_head)
+            return false;
+
+        m_items[tail] = item;
+        // The item must be visible before the consumer can see the new tail.
+        __sync_synchronize();
+        m_tail = next;
+        return true;
+    }
+
+    // Consumer side; returns false if the ring is empty.
+    bool pop(T& item) {
+        unsigned int head = m_head;
+        if (head == m_tail)
+            return false;
+
+        __sync_synchronize();
+        item = m_items[head];
+        // Finish reading the item before the producer may reuse its slot.
+        __sync_synchronize();
+        m_head = (head + 1) & (Size - 1);
+        return true;
+    }
+
+private:
+    T m_items[Size];
+    // Each index on its own cache line so the two threads do not contend.
+    volatile unsigned int m_head;
+    char m_padding[64 - sizeof(unsigned int)];
+    volatile unsigned int m_tail;
+};
+
+#endif /* CommandRing_HPP_ */
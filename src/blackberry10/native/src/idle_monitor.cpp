@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2013 BlackBerry Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <qdebug.h>
+#include <time.h>
+#include <sstream>
+#include "idle_monitor.hpp"
+
+static double monitorClock()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+IdleMonitor::IdleMonitor() :
+        m_check(0), m_owner(0), m_threadStarted(false), m_quit(false),
+        m_lastActivity(0), m_suspended(false), m_suspendedAt(0),
+        m_context(0), m_device(0), m_pauseDevice(0), m_resumeDevice(0),
+        m_suspends(0), m_resumes(0), m_suspendedMs(0), m_resumeMs(0),
+        m_lastResumeMs(0), m_maxResumeMs(0) {
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_wake, NULL);
+}
+
+IdleMonitor::~IdleMonitor() {
+    stop();
+    pthread_cond_destroy(&m_wake);
+    pthread_mutex_destroy(&m_lock);
+}
+
+bool IdleMonitor::start(ActivityCheck check, void* owner) {
+    if (m_threadStarted)
+        return true;
+
+    m_check = check;
+    m_owner = owner;
+    m_quit = false;
+    m_lastActivity = monitorClock();
+
+    if (pthread_create(&m_thread, NULL, monitorThread, this)) {
+        qDebug() << "Error creating idle monitor thread";
+        return false;
+    }
+    m_threadStarted = true;
+    return true;
+}
+
+void IdleMonitor::stop() {
+    if (!m_threadStarted)
+        return;
+
+    pthread_mutex_lock(&m_lock);
+    m_quit = true;
+    pthread_cond_signal(&m_wake);
+    pthread_mutex_unlock(&m_lock);
+    pthread_join(m_thread, NULL);
+    m_threadStarted = false;
+
+    pthread_mutex_lock(&m_lock);
+    if (m_suspended)
+        resume();
+    pthread_mutex_unlock(&m_lock);
+}
+
+void IdleMonitor::touch() {
+    pthread_mutex_lock(&m_lock);
+    m_lastActivity = monitorClock();
+    if (m_suspended) {
+        resume();
+        // Start timing the next idle period.
+        pthread_cond_signal(&m_wake);
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+std::string IdleMonitor::stats() {
+    pthread_mutex_lock(&m_lock);
+    double suspendedMs = m_suspendedMs;
+    if (m_suspended)
+        suspendedMs += monitorClock() - m_suspendedAt;
+
+    std::ostringstream result;
+    result << (m_suspended ? "suspended" : "running") << ", suspends " << m_suspends
+           << ", suspended " << suspendedMs << " ms, resumes " << m_resumes
+           << ", resume latency last " << m_lastResumeMs << " ms, mean "
+           << (m_resumes ? m_resumeMs / m_resumes : 0) << " ms, max " << m_maxResumeMs << " ms";
+    pthread_mutex_unlock(&m_lock);
+    return result.str();
+}
+
+void* IdleMonitor::monitorThread(void* monitor) {
+    static_cast<IdleMonitor*>(monitor)->run();
+    return NULL;
+}
+
+void IdleMonitor::run() {
+    pthread_mutex_lock(&m_lock);
+
+    while (!m_quit) {
+        // Nothing to watch until a trigger resumes the device.
+        if (m_suspended) {
+            pthread_cond_wait(&m_wake, &m_lock);
+            continue;
+        }
+
+        double now = monitorClock();
+        double idleAt = m_lastActivity + IDLE_SUSPEND_MS;
+        if (now < idleAt) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            long long wait = (long long)((idleAt - now) * 1000000.0);
+            deadline.tv_sec += wait / 1000000000LL;
+            deadline.tv_nsec += wait % 1000000000LL;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&m_wake, &m_lock, &deadline);
+            continue;
+        }
+
+        // The owner takes its own lock, which may be held by a trigger that
+        // is waiting for ours; ask without holding it.
+        double seen = m_lastActivity;
+        pthread_mutex_unlock(&m_lock);
+        bool active = m_check(m_owner);
+        pthread_mutex_lock(&m_lock);
+
+        if (m_quit)
+            break;
+
+        // A sound still playing counts as activity.
+        if (active)
+            m_lastActivity = now;
+        else if (m_lastActivity == seen)
+            suspend();
+    }
+
+    pthread_mutex_unlock(&m_lock);
+}
+
+void IdleMonitor::suspend() {
+    m_context = alcGetCurrentContext();
+    m_device = m_context ? alcGetContextsDevice(m_context) : 0;
+    if (!m_device)
+        return;
+
+    m_pauseDevice = 0;
+    m_resumeDevice = 0;
+    if (alcIsExtensionPresent(m_device, "ALC_SOFT_pause_device")) {
+        m_pauseDevice = (DeviceControl)alcGetProcAddress(m_device, "alcDevicePauseSOFT");
+        m_resumeDevice = (DeviceControl)alcGetProcAddress(m_device, "alcDeviceResumeSOFT");
+    }
+
+    alcSuspendContext(m_context);
+    if (m_pauseDevice && m_resumeDevice)
+        m_pauseDevice(m_device);
+
+    m_suspended = true;
+    m_suspendedAt = monitorClock();
+    m_suspends++;
+    qDebug() << "Audio device idle, suspended";
+}
+
+void IdleMonitor::resume() {
+    double startTime = monitorClock();
+    m_suspended = false;
+    m_suspendedMs += startTime - m_suspendedAt;
+
+    // The context may have been torn down while suspended; nothing to resume.
+    if (alcGetCurrentContext() != m_context)
+        return;
+
+    if (m_pauseDevice && m_resumeDevice)
+        m_resumeDevice(m_device);
+    alcProcessContext(m_context);
+
+    double latency = monitorClock() - startTime;
+    m_resumes++;
+    m_resumeMs += latency;
+    m_lastResumeMs = latency;
+    if (latency > m_maxResumeMs)
+        m_maxResumeMs = latency;
+}
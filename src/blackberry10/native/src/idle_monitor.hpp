@@ -0,0 +1,91 @@
+/*
+* Copyright (c) 2013 BlackBerry Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+
+#ifndef IdleMonitor_HPP_
+#define IdleMonitor_HPP_
+
+#include <string>
+#include <pthread.h>
+#include <AL/alc.h>
+
+// How long the engine must be silent and untouched before it is suspended.
+#define IDLE_SUSPEND_MS 3000
+
+// Asks the owner whether anything is still audible; called without the
+// monitor's lock held.
+typedef bool (*ActivityCheck)(void* owner);
+
+// Single long-lived thread that suspends the audio device once nothing has
+// been triggered or heard for IDLE_SUSPEND_MS. The device and context are
+// paused rather than destroyed, so the next trigger only has to resume them.
+class IdleMonitor {
+
+public:
+    IdleMonitor();
+    ~IdleMonitor();
+
+    bool start(ActivityCheck check, void* owner);
+    // Join the thread, leaving the device resumed.
+    void stop();
+
+    // Record activity; resumes the device first if it was suspended.
+    void touch();
+
+    std::string stats();
+
+private:
+    IdleMonitor(const IdleMonitor&);
+    IdleMonitor& operator=(const IdleMonitor&);
+
+    typedef void (*DeviceControl)(ALCdevice* device);
+
+    static void* monitorThread(void* monitor);
+    void run();
+
+    // Both expect m_lock to be held.
+    void suspend();
+    void resume();
+
+    ActivityCheck m_check;
+    void* m_owner;
+
+    pthread_t m_thread;
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_wake;
+    bool m_threadStarted;
+    bool m_quit;
+
+    double m_lastActivity;
+    bool m_suspended;
+    double m_suspendedAt;
+
+    // What was suspended, and how: ALC_SOFT_pause_device stops the mixer
+    // thread outright; otherwise only the context is suspended.
+    ALCcontext* m_context;
+    ALCdevice* m_device;
+    DeviceControl m_pauseDevice;
+    DeviceControl m_resumeDevice;
+
+    unsigned int m_suspends;
+    unsigned int m_resumes;
+    double m_suspendedMs;
+    double m_resumeMs;
+    double m_lastResumeMs;
+    double m_maxResumeMs;
+};
+
+#endif /* IdleMonitor_HPP_ */
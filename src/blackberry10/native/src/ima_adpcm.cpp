@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2013 BlackBerry Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "ima_adpcm.hpp"
+
+static const int imaStepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+
+static const int imaIndexTable[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+// Branch free clamps; noisy input would mispredict compare and branch.
+static inline int clampBelow(int value, int limit)
+{
+    int over = value - limit;
+    return limit + (over & (over >> 31));
+}
+
+static inline int clampAbove(int value, int limit)
+{
+    int under = value - limit;
+    return limit + (under & ~(under >> 31));
+}
+
+// One step of the reference decoder, without branches: the shifted step
+// sizes are masked in by the nibble's bits and the sign applied by xor.
+static inline void decodeNibble(int nibble, int& predictor, int& index)
+{
+    int step = imaStepTable[index];
+    int diff = step >> 3;
+    diff += step & -((nibble >> 2) & 1);
+    diff += (step >> 1) & -((nibble >> 1) & 1);
+    diff += (step >> 2) & -(nibble & 1);
+    int sign = -((nibble >> 3) & 1);
+    predictor = clampAbove(clampBelow(predictor + ((diff ^ sign) - sign), 32767), -32768);
+    index = clampAbove(clampBelow(index + imaIndexTable[nibble], 88), 0);
+}
+
+// Byte holding data sample s (the block's frame s + 1) of channel c.
+static inline int nibbleOffset(int channels, int c, int s)
+{
+    return 4 * channels + ((s >> 3) * channels + c) * 4 + ((s & 7) >> 1);
+}
+
+bool ImaAdpcm::validBlock(int blockAlign, int channels) {
+    return (channels == 1 || channels == 2) && blockAlign > 4 * channels && blockAlign % (4 * channels) == 0;
+}
+
+int ImaAdpcm::blockFrames(int blockAlign, int channels) {
+    return (blockAlign - 4 * channels) * 2 / channels + 1;
+}
+
+long ImaAdpcm::frames(size_t size, int blockAlign, int channels) {
+    long frames = (long)(size / blockAlign) * blockFrames(blockAlign, channels);
+    int rest = size % blockAlign;
+    if (rest >= 4 * channels)
+        frames += 1 + (rest - 4 * channels) / (4 * channels) * 8;
+    return frames;
+}
+
+size_t ImaAdpcm::encodedSize(long frames, int channels) {
+    int blockAlign = IMA_ADPCM_CHANNEL_BLOCK * channels;
+    int perBlock = blockFrames(blockAlign, channels);
+    return (size_t)((frames + perBlock - 1) / perBlock) * blockAlign;
+}
+
+void ImaAdpcm::encode(const short* in, long frames, int channels, unsigned char* out) {
+    int blockAlign = IMA_ADPCM_CHANNEL_BLOCK * channels;
+    int perBlock = blockFrames(blockAlign, channels);
+    memset(out, 0, encodedSize(frames, channels));
+
+    // The step index carries over from block to block, as other encoders do.
+    int index[2] = { 0, 0 };
+    for (long start = 0; start < frames; start += perBlock, out += blockAlign) {
+        for (int c = 0; c < channels; c++) {
+            int predictor = in[start * channels + c];
+            out[4 * c] = predictor & 0xff;
+            out[4 * c + 1] = (predictor >> 8) & 0xff;
+            out[4 * c + 2] = index[c];
+
+            // Frames past the end encode silence.
+            for (int s = 0; s < perBlock - 1; s++) {
+                long frame = start + 1 + s;
+                int delta = (frame < frames ? in[frame * channels + c] : 0) - predictor;
+                int step = imaStepTable[index[c]];
+                int nibble = 0;
+                if (delta < 0) {
+                    nibble = 8;
+                    delta = -delta;
+                }
+                if (delta >= step) {
+                    nibble |= 4;
+                    delta -= step;
+                }
+                if (delta >= step >> 1) {
+                    nibble |= 2;
+                    delta -= step >> 1;
+                }
+                if (delta >= step >> 2)
+                    nibble |= 1;
+
+                // Track what the decoder will reconstruct, not the input.
+                decodeNibble(nibble, predictor, index[c]);
+                out[nibbleOffset(channels, c, s)] |= (s & 1) ? nibble << 4 : nibble;
+            }
+        }
+    }
+}
+
+// Decode frames [from, to) of a block into out, discarding the first skip
+// of them. The channels are independent dependency chains; stepping them
+// together lets a stereo decode overlap the two.
+static void decodeBlock(const unsigned char* block, int channels, int from, int to, int skip,
+                        short* out, AdpcmCursor& cursor)
+{
+    int predictor[2] = { cursor.predictor[0], cursor.predictor[1] };
+    int index[2] = { cursor.index[0], cursor.index[1] };
+    int previous[2] = { cursor.previous[0], cursor.previous[1] };
+
+    int f = from;
+    if (f == 0 && f < to) {
+        for (int c = 0; c < channels; c++) {
+            previous[c] = predictor[c];
+            predictor[c] = (short)(block[4 * c] | (block[4 * c + 1] << 8));
+            index[c] = block[4 * c + 2] > 88 ? 88 : block[4 * c + 2];
+        }
+        if (skip > 0) {
+            skip--;
+        } else {
+            for (int c = 0; c < channels; c++)
+                out[c] = predictor[c];
+            out += channels;
+        }
+        f = 1;
+    }
+
+    // Data samples come in runs of 8 per channel, low nibble first.
+    for (int s = f - 1; s < to - 1;) {
+        const unsigned char* run = block + 4 * channels * (1 + (s >> 3));
+        int k = s & 7;
+        int end = k + (to - 1 - s) < 8 ? k + (to - 1 - s) : 8;
+        s += end - k;
+        for (; k < end; k++) {
+            int shift = (k & 1) << 2;
+            for (int c = 0; c < channels; c++) {
+                previous[c] = predictor[c];
+                decodeNibble((run[4 * c + (k >> 1)] >> shift) & 15, predictor[c], index[c]);
+            }
+            if (skip > 0) {
+                skip--;
+            } else {
+                for (int c = 0; c < channels; c++)
+                    out[c] = predictor[c];
+                out += channels;
+            }
+        }
+    }
+
+    for (int c = 0; c < channels; c++) {
+        cursor.predictor[c] = predictor[c];
+        cursor.index[c] = index[c];
+        cursor.previous[c] = previous[c];
+    }
+}
+
+void ImaAdpcm::decode(const unsigned char* data, int blockAlign, int channels,
+                      long first, int count, short* out, AdpcmCursor& cursor) {
+    int perBlock = blockFrames(blockAlign, channels);
+
+    // The two frames before the cursor are still held.
+    long behind = cursor.frame - first;
+    if (count > 0 && (behind == 1 || behind == 2) && first >= cursor.start) {
+        for (long frame = first; frame < cursor.frame && count > 0; frame++, first++, count--) {
+            for (int c = 0; c < channels; c++)
+                out[c] = frame == cursor.frame - 1 ? cursor.predictor[c] : cursor.previous[c];
+            out += channels;
+        }
+    }
+    if (count <= 0)
+        return;
+
+    // Anywhere else is reached from the start of its block.
+    if (first != cursor.frame) {
+        cursor.frame = first - first % perBlock;
+        cursor.start = cursor.frame;
+    }
+
+    long end = first + count;
+    while (cursor.frame < end) {
+        const unsigned char* block = data + (cursor.frame / perBlock) * blockAlign;
+        int from = cursor.frame % perBlock;
+        int to = end - (cursor.frame - from) < perBlock ? end - (cursor.frame - from) : perBlock;
+        // Frames before first are decoded for their state only.
+        int skip = first > cursor.frame ? first - cursor.frame : 0;
+        if (skip > to - from)
+            skip = to - from;
+
+        if (channels == 1)
+            decodeBlock(block, 1, from, to, skip, out, cursor);
+        else
+            decodeBlock(block, 2, from, to, skip, out, cursor);
+
+        out += (to - from - skip) * channels;
+        cursor.frame += to - from;
+    }
+}
@@ -0,0 +1,63 @@
+/*
+* Copyright (c) 2013 BlackBerry Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+
+#ifndef ImaAdpcm_HPP_
+#define ImaAdpcm_HPP_
+
+#include <stddef.h>
+
+// Wave format tag of IMA (DVI) ADPCM.
+#define WAVE_FORMAT_IMA_ADPCM 0x11
+// Bytes per channel in each block the encoder writes, 505 frames.
+#define IMA_ADPCM_CHANNEL_BLOCK 256
+
+// Where a streaming decode left off. The predictor is the sample of the
+// frame just before frame, and previous the one before that.
+struct AdpcmCursor {
+    long frame;             // next frame to decode; -1 before the first
+    long start;             // first frame decoded since the last seek
+    int predictor[2];
+    int index[2];
+    int previous[2];
+};
+
+// 4 bit IMA ADPCM in the block layout of wave files: per block a header of
+// one 16 bit sample and step index per channel, then the channels' nibbles
+// interleaved in runs of 8. Each block decodes on its own, so any frame can
+// be reached by decoding from the start of its block.
+class ImaAdpcm {
+
+public:
+    static bool validBlock(int blockAlign, int channels);
+    static int blockFrames(int blockAlign, int channels);
+    // Whole frames held in size bytes of blocks.
+    static long frames(size_t size, int blockAlign, int channels);
+
+    // Encode 16 bit PCM into IMA_ADPCM_CHANNEL_BLOCK sized blocks; out must
+    // hold encodedSize(frames, channels) bytes.
+    static size_t encodedSize(long frames, int channels);
+    static void encode(const short* in, long frames, int channels, unsigned char* out);
+
+    // Decode count frames from first into interleaved 16 bit samples. The
+    // cursor carries the decoder state between calls, so reading on from
+    // where the last call ended, or from up to two frames before, as an
+    // interpolating reader does, costs no seek.
+    static void decode(const unsigned char* data, int blockAlign, int channels,
+                       long first, int count, short* out, AdpcmCursor& cursor);
+};
+
+#endif /* ImaAdpcm_HPP_ */
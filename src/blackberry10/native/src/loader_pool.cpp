@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2013 BlackBerry Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <qdebug.h>
+#include <unistd.h>
+#include "loader_pool.hpp"
+
+LoaderPool::LoaderPool(int threads) :
+        m_quit(false) {
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_wake, NULL);
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0)
+        threads = 1;
+
+    for (int i = 0; i < threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, workerThread, this)) {
+            qDebug() << "Error creating loader thread";
+            break;
+        }
+        m_threads.push_back(thread);
+    }
+}
+
+LoaderPool::~LoaderPool() {
+    std::deque<QueuedJob> discarded;
+
+    pthread_mutex_lock(&m_lock);
+    m_quit = true;
+    discarded.swap(m_jobs);
+    pthread_cond_broadcast(&m_wake);
+    pthread_mutex_unlock(&m_lock);
+
+    for (size_t i = 0; i < m_threads.size(); i++)
+        pthread_join(m_threads[i], NULL);
+
+    // Jobs that never started still get to report, outside the pool's lock.
+    for (size_t i = 0; i < discarded.size(); i++) {
+        discarded[i].job->cancel();
+        delete discarded[i].job;
+    }
+
+    pthread_cond_destroy(&m_wake);
+    pthread_mutex_destroy(&m_lock);
+}
+
+void LoaderPool::submit(LoaderJob* job, int priority) {
+    QueuedJob queued = { job, priority };
+
+    pthread_mutex_lock(&m_lock);
+    std::deque<QueuedJob>::iterator position = m_jobs.end();
+    while (position != m_jobs.begin() && (position - 1)->priority < priority)
+        --position;
+    m_jobs.insert(position, queued);
+    pthread_cond_signal(&m_wake);
+    pthread_mutex_unlock(&m_lock);
+}
+
+void* LoaderPool::workerThread(void* pool) {
+    static_cast<LoaderPool*>(pool)->work();
+    return NULL;
+}
+
+void LoaderPool::work() {
+    pthread_mutex_lock(&m_lock);
+
+    while (true) {
+        while (!m_quit && m_jobs.empty())
+            pthread_cond_wait(&m_wake, &m_lock);
+        if (m_quit)
+            break;
+
+        LoaderJob* job = m_jobs.front().job;
+        m_jobs.pop_front();
+
+        pthread_mutex_unlock(&m_lock);
+        job->run();
+        delete job;
+        pthread_mutex_lock(&m_lock);
+    }
+
+    pthread_mutex_unlock(&m_lock);
+}
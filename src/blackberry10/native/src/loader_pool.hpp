@@ -0,0 +1,71 @@
+/*
+* Copyright (c) 2013 BlackBerry Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+
+#ifndef LoaderPool_HPP_
+#define LoaderPool_HPP_
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+
+// A unit of work run by the loader pool; deleted once it has run.
+class LoaderJob {
+
+public:
+    virtual ~LoaderJob() {}
+    virtual void run() = 0;
+    // Called instead of run for a job still queued when the pool shuts down.
+    virtual void cancel() {}
+};
+
+// Fixed set of worker threads that decode assets off the JNEXT thread, so a
+// slow file only occupies one worker instead of blocking every other load.
+class LoaderPool {
+
+public:
+    // A thread count of 0 starts one worker per online CPU.
+    explicit LoaderPool(int threads = 0);
+    // Waits for running jobs, then cancels those that have not started.
+    ~LoaderPool();
+
+    // Queue a job; the pool takes ownership of it. Jobs with a higher
+    // priority start first, equal priorities run in submission order.
+    void submit(LoaderJob* job, int priority = 0);
+    // 0 only if no worker could be started. Such a pool never runs a job,
+    // so check before submitting.
+    int threadCount() const { return m_threads.size(); }
+
+private:
+    LoaderPool(const LoaderPool&);
+    LoaderPool& operator=(const LoaderPool&);
+
+    static void* workerThread(void* pool);
+    void work();
+
+    struct QueuedJob {
+        LoaderJob* job;
+        int priority;
+    };
+
+    std::deque<QueuedJob> m_jobs;
+    std::vector<pthread_t> m_threads;
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_wake;
+    bool m_quit;
+};
+
+#endif /* LoaderPool_HPP_ */
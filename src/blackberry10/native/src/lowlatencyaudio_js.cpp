@@ -19,27 +19,21 @@
 #include <qdebug.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <unistd.h>
 #include <sstream>
 #include <iostream>
+#include <vector>
 #include <pthread.h>
+#include <sched.h>
+#include <errno.h>
 #include <time.h>
+#include <json/reader.h>
+#include <json/writer.h>
 #include "lowlatencyaudio_js.hpp"
 
 using namespace std;
 
-bool isUsed = false;
-
-void *useCheck(void *x_void_ptr) {
-    int *x_ptr = (int *)x_void_ptr;
-    usleep(*x_ptr * 1000000);
-
-    if (isUsed == false)
-        alutExit();
-
-    return NULL;
-}
-
 // Error message function for ALUT.
 static void reportALUTError(ALenum error)
 {
@@ -54,68 +48,358 @@ static void reportOpenALError(ALenum error)
         qDebug() << "OpenAL reported the following error: \n" << alutGetErrorString(error);
 }
 
-bool LowLatencyAudio_JS::loadWav(FILE* file, ALuint buffer)
+// One line of JSON, for events and command results. FastWriter ends the
+// document with a newline, which is dropped.
+static string toJson(const Json::Value& value)
+{
+    Json::FastWriter writer;
+    string json = writer.write(value);
+    if (!json.empty() && json[json.size() - 1] == '\n')
+        json.erase(json.size() - 1);
+    return json;
+}
+
+// Little-endian field readers for headers parsed in place from a mapped file.
+static inline unsigned int readLE16(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline unsigned int readLE32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static inline void writeLE16(unsigned char* p, unsigned int value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+}
+
+static inline void writeLE32(unsigned char* p, unsigned int value)
+{
+    writeLE16(p, value & 0xffff);
+    writeLE16(p + 2, value >> 16);
+}
+
+// Header of a 16 bit stereo PCM wave file holding frames frames.
+static void writeWavHeader(unsigned char* header, int rate, unsigned int frames)
+{
+    unsigned int dataSize = frames * 4;
+    memcpy(header, "RIFF", 4);
+    writeLE32(header + 4, 36 + dataSize);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    writeLE32(header + 16, 16);
+    writeLE16(header + 20, 1);
+    writeLE16(header + 22, 2);
+    writeLE32(header + 24, rate);
+    writeLE32(header + 28, rate * 4);
+    writeLE16(header + 32, 4);
+    writeLE16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    writeLE32(header + 40, dataSize);
+}
+
+// Monotonic wall clock in milliseconds, used for load timing.
+static double monotonicMs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+// From AL_SOFT_loop_points, which the platform headers do not declare.
+#ifndef AL_LOOP_POINTS_SOFT
+#define AL_LOOP_POINTS_SOFT 0x2015
+#endif
+
+// From AL_EXT_FLOAT32, likewise.
+#ifndef AL_FORMAT_MONO_FLOAT32
+#define AL_FORMAT_MONO_FLOAT32 0x10010
+#define AL_FORMAT_STEREO_FLOAT32 0x10011
+#endif
+
+// The sub-format GUID of WAVE_FORMAT_EXTENSIBLE after its leading format tag.
+static const unsigned char waveSubFormatTail[14] = {
+    0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+};
+
+// Copy frames [start, end) of pcm into a new buffer.
+static ALuint regionBuffer(ALenum format, const unsigned char* pcm, int frameSize,
+                           int start, int end, ALuint frequency)
+{
+    ALuint buffer;
+    alGenBuffers(1, &buffer);
+    alBufferData(buffer, format, pcm + start * frameSize, (end - start) * frameSize, frequency);
+    return buffer;
+}
+
+// Turn the labelled cue points of a wave file into regions. Each one runs
+// for its ltxt length if it has one, or else up to the next cue point.
+static void readCueRegions(const unsigned char* cue, unsigned int cueSize,
+                           const unsigned char* adtl, unsigned int adtlSize,
+                           int frames, vector<SpriteRegion>& regions)
+{
+    unsigned int count = readLE32(cue);
+    if (count > (cueSize - 4) / 24)
+        count = (cueSize - 4) / 24;
+
+    // Labels and lengths from the associated data list, by cue point id.
+    QHash<unsigned int, string> labels;
+    QHash<unsigned int, unsigned int> lengths;
+    size_t offset = 0;
+    while (adtl && offset + 12 <= adtlSize) {
+        const unsigned char* entry = adtl + offset;
+        unsigned int entrySize = readLE32(entry + 4);
+        if (entrySize < 4 || entrySize > adtlSize - offset - 8)
+            break;
+
+        unsigned int id = readLE32(entry + 8);
+        if (memcmp(entry, "labl", 4) == 0) {
+            const char* text = (const char*)entry + 12;
+            const void* terminator = memchr(text, 0, entrySize - 4);
+            labels[id] = string(text, terminator ? (const char*)terminator - text : entrySize - 4);
+        }
+        else if (memcmp(entry, "ltxt", 4) == 0 && entrySize >= 8) {
+            lengths[id] = readLE32(entry + 12);
+        }
+        offset += 8 + entrySize + (entrySize & 1);
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int id = readLE32(cue + 4 + 24 * i);
+        if (!labels.contains(id) || labels[id].empty())
+            continue;
+
+        SpriteRegion region;
+        region.name = labels[id];
+        region.start = readLE32(cue + 4 + 24 * i + 20);
+        region.end = frames;
+        if (lengths.contains(id)) {
+            region.end = region.start + lengths[id];
+        } else {
+            for (unsigned int j = 0; j < count; j++) {
+                int next = readLE32(cue + 4 + 24 * j + 20);
+                if (next > region.start && next < region.end)
+                    region.end = next;
+            }
+        }
+
+        if (region.start >= 0 && region.start < region.end && region.end <= frames)
+            regions.push_back(region);
+    }
+}
+
+bool LowLatencyAudio_JS::loadWav(const MappedFile& file, ALuint buffer, MixerClip* clip, SampleLoop& loop,
+                                 vector<SpriteRegion>* cues, AssetLoadStats* analysis)
 {
-    unsigned char stream[12];
+    const unsigned char* bytes = file.data();
+    size_t size = file.size();
 
-    // Verify the wave fmt magic value meaning format.
-    if (fread(stream, 1, 8, file) != 8 || memcmp(stream, "fmt ", 4) != 0 )  {
+    // Verify the WAVE form type following the RIFF header.
+    if (size < 12 || memcmp(bytes + 8, "WAVE", 4) != 0) {
         qDebug() << "Failed to verify the magic value for the wave file format.";
         return false;
     }
 
-    unsigned int section_size;
-    section_size  = stream[7]<<24;
-    section_size |= stream[6]<<16;
-    section_size |= stream[5]<<8;
-    section_size |= stream[4];
+    const unsigned char* fmt = 0;
+    const unsigned char* pcm = 0;
+    const unsigned char* smpl = 0;
+    const unsigned char* fact = 0;
+    const unsigned char* cue = 0;
+    const unsigned char* adtl = 0;
+    unsigned int pcmSize = 0;
+    unsigned int fmtSize = 0;
+    unsigned int cueSize = 0;
+    unsigned int adtlSize = 0;
+
+    // Walk the chunk table in place; nothing is copied out of the mapping.
+    // The sampler chunk often follows the data.
+    size_t offset = 12;
+    while (offset + 8 <= size) {
+        const unsigned char* chunk = bytes + offset;
+        unsigned int section_size = readLE32(chunk + 4);
+        size_t available = size - offset - 8;
 
-    // Check for a valid pcm format.
-    if (fread(stream, 1, 2, file) != 2 || stream[1] != 0 || stream[0] != 1) {
-        qDebug() << "Unsupported audio file format (must be a valid PCM format).";
-        return false;
+        // Data chunk.
+        if (memcmp(chunk, "data", 4) == 0) {
+            if (section_size > available) {
+                qDebug() << "Failed to load wave file; file is missing data.";
+                return false;
+            }
+            pcm = chunk + 8;
+            pcmSize = section_size;
+        }
+        // Format chunk.
+        else if (memcmp(chunk, "fmt ", 4) == 0) {
+            if (section_size < 16 || section_size > available) {
+                qDebug() << "Failed to read the wave file's format chunk.";
+                return false;
+            }
+            fmt = chunk + 8;
+            fmtSize = section_size;
+        }
+        // Frame count of compressed data.
+        else if (memcmp(chunk, "fact", 4) == 0 && section_size >= 4 && section_size <= available) {
+            fact = chunk + 8;
+        }
+        // Sampler chunk, with at least one loop.
+        else if (memcmp(chunk, "smpl", 4) == 0 && section_size >= 60 && section_size <= available) {
+            smpl = chunk + 8;
+        }
+        // Cue points, and the list naming them, which mark sprite regions.
+        else if (memcmp(chunk, "cue ", 4) == 0 && section_size >= 4 && section_size <= available) {
+            cue = chunk + 8;
+            cueSize = section_size;
+        }
+        else if (memcmp(chunk, "LIST", 4) == 0 && section_size >= 4 && section_size <= available
+                 && memcmp(chunk + 8, "adtl", 4) == 0) {
+            adtl = chunk + 12;
+            adtlSize = section_size - 4;
+        }
+        // Other chunk - could be any of the following:
+        // - Wave List ("wavl")
+        // - Silent ("slnt")
+        // - Playlist ("plst")
+        // - Other lists ("LIST")
+        // - Note ("note")
+        // - Instrument ("inst")
+        else if (section_size > available) {
+            // Junk after the data does not matter.
+            if (pcm)
+                break;
+            char name[5] = { 0 };
+            memcpy(name, chunk, 4);
+            qDebug() << "Failed to seek past " << name << "in wave file.";
+            return false;
+        }
+
+        // Chunks are padded to an even number of bytes.
+        offset += 8 + section_size + (section_size & 1);
     }
 
-    // Get the channel count (16-bit little-endian).
-    int channels;
-    if (fread(stream, 1, 2, file) != 2) {
-        qDebug() << "Failed to read the wave file's channel count.";
+    if (!fmt) {
+        qDebug() << "Failed to verify the magic value for the wave file format.";
         return false;
     }
-    channels  = stream[1]<<8;
-    channels |= stream[0];
 
-    // Get the sample frequency (32-bit little-endian).
-    ALuint frequency;
-    if (fread(stream, 1, 4, file) != 4) {
-        qDebug() << "Failed to read the wave file's sample frequency.";
+    if (!pcm) {
+        qDebug() << "Failed to load wave file; file appears to have no data.";
         return false;
     }
 
-    frequency  = stream[3]<<24;
-    frequency |= stream[2]<<16;
-    frequency |= stream[1]<<8;
-    frequency |= stream[0];
-
-    // The next 6 bytes hold the block size and bytes-per-second.
-    // We don't need that info, so just read and ignore it.
-    // We could use this later if we need to know the duration.
-    if (fread(stream, 1, 6, file) != 6) {
-        qDebug() << "Failed to read past the wave file's block size and bytes-per-second.";
+    // Check for a valid pcm format, float or IMA ADPCM. The extensible
+    // format carries the real tag at the head of its sub-format GUID.
+    int tag = readLE16(fmt);
+    if (tag == WAVE_FORMAT_EXTENSIBLE) {
+        if (fmtSize < 40 || memcmp(fmt + 26, waveSubFormatTail, sizeof(waveSubFormatTail)) != 0) {
+            qDebug() << "Unsupported extensible wave file sub-format.";
+            return false;
+        }
+        tag = readLE16(fmt + 24);
+    }
+    if (tag != WAVE_FORMAT_PCM && tag != WAVE_FORMAT_IEEE_FLOAT && tag != WAVE_FORMAT_IMA_ADPCM) {
+        qDebug() << "Unsupported audio file format (must be a valid PCM, float or IMA ADPCM format).";
         return false;
     }
 
-    // Get the bit depth (16-bit little-endian).
-    int bits;
-    if (fread(stream, 1, 2, file) != 2) {
-        qDebug() << "Failed to read the wave file's bit depth.";
+    // The bytes-per-second field (fmt + 8) is not needed.
+    int channels = readLE16(fmt + 2);
+    ALuint frequency = readLE32(fmt + 4);
+    int blockAlign = readLE16(fmt + 12);
+    int bits = readLE16(fmt + 14);
+
+    // Loudness is measured as samples become 16 bit PCM, a block at a time,
+    // or in place for a file that is 16 bit PCM already.
+    LoudnessMeter meter(frequency, channels);
+    bool metered = false;
+
+    // IMA ADPCM stays compressed for a clip that stores ADPCM, unless it has
+    // to be resampled; anything else expands it to 16 bit PCM here.
+    bool keepAdpcm = false;
+    int adpcmFrames = 0;
+    vector<short> expanded;
+    if (tag == WAVE_FORMAT_IMA_ADPCM) {
+        if (bits != 4 || !ImaAdpcm::validBlock(blockAlign, channels)) {
+            qDebug() << "Incompatible IMA ADPCM wave file: ( " << channels << ", " << blockAlign << ")";
+            return false;
+        }
+        adpcmFrames = ImaAdpcm::frames(pcmSize, blockAlign, channels);
+        if (fact && readLE32(fact) < (unsigned int)adpcmFrames)
+            adpcmFrames = readLE32(fact);
+
+        // Data kept compressed is still decoded once, through a scratch
+        // block, to be measured.
+        keepAdpcm = clip && clip->adpcmStorage() && !resamplesFrom(frequency);
+        metered = analysis != 0;
+        if (!keepAdpcm || metered) {
+            expanded.resize((keepAdpcm ? SAMPLE_ANALYSIS_BLOCK_FRAMES : adpcmFrames) * channels);
+            AdpcmCursor cursor = { -1, 0, { 0, 0 }, { 0, 0 }, { 0, 0 } };
+            for (long done = 0; done < adpcmFrames; done += SAMPLE_ANALYSIS_BLOCK_FRAMES) {
+                long count = adpcmFrames - done < SAMPLE_ANALYSIS_BLOCK_FRAMES ? adpcmFrames - done
+                                                                               : SAMPLE_ANALYSIS_BLOCK_FRAMES;
+                short* out = &expanded[keepAdpcm ? 0 : done * channels];
+                ImaAdpcm::decode(pcm, blockAlign, channels, done, count, out, cursor);
+                if (metered)
+                    meter.add(out, count);
+            }
+        }
+        if (!keepAdpcm) {
+            pcm = (const unsigned char*)(expanded.empty() ? 0 : &expanded[0]);
+            pcmSize = expanded.size() * sizeof(short);
+            bits = 16;
+        }
+    }
+
+    // 24 and 32 bit integers and 32 bit floats are dithered down to 16 bits.
+    // Floats go to OpenAL as they are where it takes them and nothing else
+    // here needs 16 bit samples.
+    ALuint format = 0;
+    vector<short> converted;
+    bool wide = tag == WAVE_FORMAT_PCM && (bits == 24 || bits == 32);
+    bool floats = tag == WAVE_FORMAT_IEEE_FLOAT && bits == 32;
+    if ((wide || floats) && (channels == 1 || channels == 2)) {
+        long samples = pcmSize / (bits / 8);
+        samples -= samples % channels;
+        if (floats && !clip && !resamplesFrom(frequency) && alIsExtensionPresent("AL_EXT_FLOAT32")) {
+            format = channels == 1 ? AL_FORMAT_MONO_FLOAT32 : AL_FORMAT_STEREO_FLOAT32;
+        } else {
+            // Chunks are only two byte aligned; word samples may need a copy.
+            vector<int> aligned;
+            const void* samplesIn = pcm;
+            if (bits == 32 && ((size_t)pcm & 3)) {
+                aligned.resize(samples);
+                memcpy(&aligned[0], pcm, samples * 4);
+                samplesIn = &aligned[0];
+            }
+
+            converted.resize(samples);
+            DitherState dither;
+            SampleConverter::seed(dither);
+            long block = SAMPLE_ANALYSIS_BLOCK_FRAMES * channels;
+            for (long done = 0; done < samples; done += block) {
+                long count = samples - done < block ? samples - done : block;
+                if (floats)
+                    SampleConverter::fromFloat32((const float*)samplesIn + done, count, &converted[done], dither);
+                else if (bits == 24)
+                    SampleConverter::fromInt24(pcm + done * 3, count, &converted[done], dither);
+                else
+                    SampleConverter::fromInt32((const int*)samplesIn + done, count, &converted[done], dither);
+                if (analysis)
+                    meter.add(&converted[done], count / channels);
+            }
+            metered = analysis != 0;
+            pcm = (const unsigned char*)(converted.empty() ? 0 : &converted[0]);
+            pcmSize = samples * sizeof(short);
+            bits = 16;
+        }
+    }
+    else if (tag == WAVE_FORMAT_IEEE_FLOAT) {
+        qDebug() << "Incompatible float wave file format: ( " << channels << ", " << bits << ")";
         return false;
     }
-    bits  = stream[1]<<8;
-    bits |= stream[0];
 
     // Now convert the given channel count and bit depth into an OpenAL format.
-    ALuint format = 0;
     if (bits == 8) {
         if (channels == 1)
             format = AL_FORMAT_MONO8;
@@ -128,102 +412,121 @@ bool LowLatencyAudio_JS::loadWav(FILE* file, ALuint buffer)
         else if (channels == 2)
             format = AL_FORMAT_STEREO16;
     }
-    else {
+
+    if (!format && !keepAdpcm) {
         qDebug() << "Incompatible wave file format: ( " << channels << ", " << bits << ")";
         return false;
     }
 
-    // Check against the size of the format header as there may be more data that we need to read.
-    if (section_size > 16) {
-        unsigned int length = section_size - 16;
-
-        // Extension size is 2 bytes.
-        if (fread(stream, 1, length, file) != length) {
-            qDebug() << "Failed to read extension size from wave file.";
-            return false;
+    // Drop any trailing partial frame so OpenAL accepts the size.
+    unsigned int frameSize = channels * bits / 8;
+    if (!keepAdpcm)
+        pcmSize -= pcmSize % frameSize;
+
+    // 8 bit data and floats passed straight to OpenAL are left unmeasured.
+    // Resampling leaves loudness as it is, and what trimming cuts is no
+    // louder than its threshold, so nothing is measured again after either.
+    if (analysis && !metered && bits == 16)
+        meter.add((const short*)pcm, pcmSize / frameSize);
+    if (analysis)
+        analysis->loudness = meter.result();
+
+    // The first sampler loop, if it lies within the data. Its end is
+    // inclusive in the file.
+    int frames = keepAdpcm ? adpcmFrames : pcmSize / frameSize;
+    if (smpl && readLE32(smpl + 28) > 0) {
+        unsigned int start = readLE32(smpl + 36 + 8);
+        unsigned int end = readLE32(smpl + 36 + 12) + 1;
+        if (start < end && end <= (unsigned int)frames) {
+            loop.start = start;
+            loop.end = end;
         }
     }
 
-    // Read in the rest of the file a chunk (section) at a time.
-    while (true) {
-        // Check if we are at the end of the file without reading the data.
-        if (feof(file)) {
-            qDebug() << "Failed to load wave file; file appears to have no data.";
-            return false;
-        }
+    if (cues && cue)
+        readCueRegions(cue, cueSize, adtl, adtlSize, frames, *cues);
 
-        // Read in the type of the next section of the file.
-        if (fread(stream, 1, 4, file) != 4) {
-            qDebug() << "Failed to read next section type from wave file.";
+    if (keepAdpcm) {
+        if (!clip->assignAdpcm(pcm, pcmSize, frames, channels, blockAlign, frequency))
             return false;
-        }
-
-        // Data chunk.
-        if (memcmp(stream, "data", 4) == 0) {
-            // Read how much data is remaining and buffer it up.
-            unsigned int dataSize;
-            if (fread(&dataSize, sizeof(int), 1, file) != 1) {
-                qDebug() << "Failed to read size of data section from wave file.";
-                return false;
-            }
-
-            char* data = new char[dataSize];
-            if (fread(data, sizeof(char), dataSize, file) != dataSize)  {
-                qDebug() << "Failed to load wave file; file is missing data.";
-                delete data;
-                return false;
-            }
-
-            alBufferData(buffer, format, data, dataSize, frequency);
-            ALenum error = alGetError();
-            if (error != AL_NO_ERROR) {
-                reportOpenALError(error);
-            }
-            delete data;
+        clip->setLoop(loop.start, loop.end);
+        return true;
+    }
 
-            // We've read the data, so return now.
-            return true;
+    // Convert to the output rate once here rather than in every voice. The
+    // loop and cue points move with the samples.
+    Resampler resampler;
+    vector<short> resampled;
+    if (resampleToOutput(pcm, bits, frames, channels, frequency, resampler, resampled)) {
+        pcm = (const unsigned char*)&resampled[0];
+        pcmSize = resampled.size() * sizeof(short);
+        bits = 16;
+        format = channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16;
+        frameSize = channels * 2;
+        frequency = m_outputRate;
+
+        if (loop.end) {
+            loop.start = resampler.mapFrame(loop.start);
+            loop.end = resampler.mapFrame(loop.end);
+            if (loop.start >= loop.end)
+                loop.start = loop.end = 0;
         }
-        // Other chunk - could be any of the following:
-        // - Fact ("fact")
-        // - Wave List ("wavl")
-        // - Silent ("slnt")
-        // - Cue ("cue ")
-        // - Playlist ("plst")
-        // - Associated Data List ("list")
-        // - Label ("labl")
-        // - Note ("note")
-        // - Labeled Text ("ltxt")
-        // - Sampler ("smpl")
-        // - Instrument ("inst")
-        else {
-            // Store the name of the chunk so we can report errors informatively.
-            char chunk[5] = { 0 };
-            memcpy(chunk, stream, 4);
+        for (size_t i = 0; cues && i < cues->size(); i++) {
+            (*cues)[i].start = resampler.mapFrame((*cues)[i].start);
+            (*cues)[i].end = resampler.mapFrame((*cues)[i].end);
+        }
+    }
 
-            // Read the chunk size.
-            if (fread(stream, 1, 4, file) != 4) {
-                qDebug() << "Failed to read size of " << chunk << "chunk from wave file.";
-                return false;
-            }
+    // Cut silence from the ends, short of the loop, which moves with the
+    // samples. Float and 8 bit data is left as it is.
+    if (bits == 16) {
+        long total = pcmSize / frameSize;
+        const short* samples = (const short*)pcm;
+        long kept = total;
+        long cut = trimSilence(samples, kept, channels, frequency, loop.end ? loop.start : total, loop.end, analysis);
+        pcm = (const unsigned char*)samples;
+        pcmSize = kept * frameSize;
+        if (loop.end) {
+            loop.start -= cut;
+            loop.end -= cut;
+        }
+    }
 
-            section_size  = stream[3]<<24;
-            section_size |= stream[2]<<16;
-            section_size |= stream[1]<<8;
-            section_size |= stream[0];
+    // The software mixer keeps its own 16 bit copy.
+    if (clip) {
+        if (!clip->assign(pcm, pcmSize, channels, bits, frequency))
+            return false;
+        clip->setLoop(loop.start, loop.end);
+        return true;
+    }
 
-            // Seek past the chunk.
-            if (fseek(file, section_size, SEEK_CUR) != 0) {
-                qDebug() << "Failed to seek past " << chunk << "in wave file.";
-                return false;
-            }
+    // Hand the mapped PCM region straight to OpenAL, which takes its own copy.
+    alBufferData(buffer, format, pcm, pcmSize, frequency);
+
+    // Let OpenAL loop the region itself where it can; otherwise keep the
+    // attack and sustain regions as buffers of their own to queue.
+    if (loop.end) {
+        if (alIsExtensionPresent("AL_SOFT_loop_points")) {
+            ALint points[2] = { loop.start, loop.end };
+            alBufferiv(buffer, AL_LOOP_POINTS_SOFT, points);
+        } else {
+            if (loop.start > 0)
+                loop.attack = regionBuffer(format, pcm, frameSize, 0, loop.start, frequency);
+            loop.sustain = regionBuffer(format, pcm, frameSize, loop.start, loop.end, frequency);
         }
     }
 
+    ALenum error = alGetError();
+    if (error != AL_NO_ERROR) {
+        reportOpenALError(error);
+        return false;
+    }
+
     return true;
 }
 
-bool LowLatencyAudio_JS::loadOgg(FILE* file, ALuint buffer)
+bool LowLatencyAudio_JS::loadOgg(const MappedFile& file, ALuint buffer, MixerClip* clip, const char* path,
+                                 AssetLoadStats* analysis)
 {
     OggVorbis_File ogg_file;
     vorbis_info* info;
@@ -232,10 +535,13 @@ bool LowLatencyAudio_JS::loadOgg(FILE* file, ALuint buffer)
     int section;
     unsigned int size = 0;
 
-    rewind(file);
+    // PCM decoded on an earlier launch skips Vorbis entirely.
+    bool loaded;
+    if (loadCachedPcm(path, buffer, clip, loaded, analysis))
+        return loaded;
 
-    if ((result = ov_open(file, &ogg_file, NULL, 0)) < 0) {
-        fclose(file);
+    OggMemorySource source = { &file, 0 };
+    if ((result = ov_open_callbacks(&source, &ogg_file, NULL, 0, oggMemoryCallbacks())) < 0) {
         qDebug() << "Failed to open ogg file.";
         return false;
     }
@@ -251,13 +557,18 @@ bool LowLatencyAudio_JS::loadOgg(FILE* file, ALuint buffer)
     unsigned int data_size = ov_pcm_total(&ogg_file, -1) * info->channels * 2;
     char* data = new char[data_size];
 
+    // Each packet is measured as it comes out of the decoder.
+    LoudnessMeter meter(info->rate, info->channels);
     while (size < data_size) {
         result = ov_read(&ogg_file, data + size, data_size - size, 0, 2, 1, &section);
         if (result > 0) {
+            if (analysis)
+                meter.add((const short*)(data + size), result / (info->channels * 2));
             size += result;
         }
         else if (result < 0) {
-            delete data;
+            delete[] data;
+            ov_clear(&ogg_file);
             qDebug() << "Failed to read ogg file; file is missing data.";
             return false;
         }
@@ -267,31 +578,182 @@ bool LowLatencyAudio_JS::loadOgg(FILE* file, ALuint buffer)
     }
 
     if (size == 0) {
-        delete data;
+        delete[] data;
+        ov_clear(&ogg_file);
         qDebug() << "Filed to read ogg file; unable to read any data.";
         return false;
     }
 
-    alBufferData(buffer, format, data, data_size, info->rate);
+    if (analysis)
+        analysis->loudness = meter.result();
+    bool uploaded = uploadPcm(buffer, clip, data, size, info->channels, info->rate, analysis);
+
+    // The cache keeps the decoder's own rate, whatever the output rate is.
+    PcmFormat decoded = { format, info->channels, (int)info->rate };
+    m_pcmCache.store(path, decoded, data, size);
+
+    delete[] data;
+    ov_clear(&ogg_file);
+    return uploaded;
+}
+
+bool LowLatencyAudio_JS::loadMp3(const MappedFile& file, ALuint buffer, MixerClip* clip, const char* path,
+                                 AssetLoadStats* analysis)
+{
+    bool loaded;
+    if (loadCachedPcm(path, buffer, clip, loaded, analysis))
+        return loaded;
+
+    // The decoder keeps its bit reservoir and filterbank state inline, which
+    // is too much for a loader thread's stack.
+    Mp3Decoder* decoder = new Mp3Decoder();
+    if (!decoder->open(file.data(), file.size())) {
+        delete decoder;
+        qDebug() << "Failed to open mp3 file.";
+        return false;
+    }
+
+    Mp3Info info = decoder->info();
+    ALenum format = info.channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16;
+
+    // The frame count is known up front from the tags or frame headers.
+    // Decoding goes a block at a time so each is measured while in cache.
+    vector<short> data(info.frames * info.channels);
+    LoudnessMeter meter(info.rate, info.channels);
+    int frames = 0;
+    while (frames < info.frames) {
+        int count = info.frames - frames < SAMPLE_ANALYSIS_BLOCK_FRAMES ? info.frames - frames
+                                                                        : SAMPLE_ANALYSIS_BLOCK_FRAMES;
+        int decoded = decoder->read(&data[frames * info.channels], count);
+        if (decoded <= 0)
+            break;
+        if (analysis)
+            meter.add(&data[frames * info.channels], decoded);
+        frames += decoded;
+    }
+    delete decoder;
+
+    if (frames == 0) {
+        qDebug() << "Failed to read mp3 file; unable to read any data.";
+        return false;
+    }
+
+    if (analysis)
+        analysis->loudness = meter.result();
+    unsigned int size = frames * info.channels * 2;
+    bool uploaded = uploadPcm(buffer, clip, &data[0], size, info.channels, info.rate, analysis);
+
+    PcmFormat decoded = { format, info.channels, info.rate };
+    m_pcmCache.store(path, decoded, (const char*)&data[0], size);
+    return uploaded;
+}
+
+bool LowLatencyAudio_JS::loadCachedPcm(const char* path, ALuint buffer, MixerClip* clip, bool& loaded,
+                                       AssetLoadStats* analysis)
+{
+    MappedFile cached;
+    PcmFormat cachedFormat;
+    const unsigned char* cachedData;
+    size_t cachedSize;
+    if (!m_pcmCache.lookup(path, cached, cachedFormat, cachedData, cachedSize))
+        return false;
+
+    // Nothing is decoded on a hit, so the cached PCM is measured in place.
+    if (analysis) {
+        LoudnessMeter meter(cachedFormat.rate, cachedFormat.channels);
+        meter.add((const short*)cachedData, cachedSize / (cachedFormat.channels * 2));
+        analysis->loudness = meter.result();
+    }
+    loaded = uploadPcm(buffer, clip, cachedData, cachedSize, cachedFormat.channels, cachedFormat.rate, analysis);
+    return true;
+}
+
+bool LowLatencyAudio_JS::uploadPcm(ALuint buffer, MixerClip* clip, const void* pcm, unsigned int size,
+                                   int channels, int rate, AssetLoadStats* analysis)
+{
+    Resampler resampler;
+    vector<short> resampled;
+    if (resampleToOutput(pcm, 16, size / (channels * 2), channels, rate, resampler, resampled)) {
+        pcm = &resampled[0];
+        size = resampled.size() * sizeof(short);
+        rate = m_outputRate;
+    }
+
+    const short* samples = (const short*)pcm;
+    long frames = size / (channels * 2);
+    trimSilence(samples, frames, channels, rate, frames, 0, analysis);
+    pcm = samples;
+    size = frames * channels * 2;
+
+    if (clip)
+        return clip->assign(pcm, size, channels, 16, rate);
+
+    alBufferData(buffer, channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16, pcm, size, rate);
 
     ALenum error = alGetError();
     if (error != AL_NO_ERROR) {
         reportOpenALError(error);
+        return false;
     }
 
-    delete data;
-    ov_clear(&ogg_file);
+    return true;
+}
+
+long LowLatencyAudio_JS::trimSilence(const short*& pcm, long& frames, int channels, int rate,
+                                     long keepStart, long keepEnd, AssetLoadStats* analysis) const {
+    if (!m_trimSilence || !analysis || frames <= 0)
+        return 0;
+
+    // A frame stays if any of its channels is audible. Assets that are
+    // silent throughout are left whole.
+    long count = frames * channels;
+    long leading = SampleAnalysis::leadingSilence(pcm, count, m_trimThreshold) / channels;
+    if (leading >= frames)
+        return 0;
+    long trailing = SampleAnalysis::trailingSilence(pcm, count, m_trimThreshold) / channels;
+
+    if (leading > keepStart)
+        leading = keepStart;
+    if (frames - trailing < keepEnd)
+        trailing = keepEnd < frames ? frames - keepEnd : 0;
+
+    pcm += leading * channels;
+    frames -= leading + trailing;
+    analysis->trimmedLeading = leading * 1000.0 / rate;
+    analysis->trimmedTrailing = trailing * 1000.0 / rate;
+    return leading;
+}
+
+bool LowLatencyAudio_JS::resamplesFrom(int rate) const {
+    return m_resampleQuality != RESAMPLE_OFF && m_outputRate && rate != m_outputRate;
+}
+
+bool LowLatencyAudio_JS::resampleToOutput(const void* pcm, int bits, long frames, int channels, int rate,
+                                          Resampler& resampler, vector<short>& out) const
+{
+    if (frames <= 0 || !resamplesFrom(rate) || !resampler.configure(rate, m_outputRate, m_resampleQuality))
+        return false;
 
-    // ov_clear actually closes the file pointer as well.
-    file = 0;
+    // Unsigned 8 bit samples are widened first; the output is 16 bit either way.
+    const short* samples = (const short*)pcm;
+    vector<short> widened;
+    if (bits == 8) {
+        const unsigned char* bytes = (const unsigned char*)pcm;
+        widened.resize(frames * channels);
+        for (size_t i = 0; i < widened.size(); i++)
+            widened[i] = (short)((bytes[i] - 128) << 8);
+        samples = &widened[0];
+    }
 
+    out.resize(resampler.outputFrames(frames) * channels);
+    resampler.process(samples, frames, channels, &out[0]);
     return true;
 }
 
-bool LowLatencyAudio_JS::loadAudio(QString id, QString assetPath) {
+// Resolve an asset path relative to the application's native folder.
+QString resolveAssetPath(QString assetPath) {
     QString fileLocation;
     char cwd[PATH_MAX];
-    ALuint bufferID;
 
     // Retrieve the actual file location
     getcwd(cwd, PATH_MAX);
@@ -300,302 +762,2174 @@ bool LowLatencyAudio_JS::loadAudio(QString id, QString assetPath) {
                     .append(assetPath);
 
     QFileInfo fileInfo(fileLocation);
-    const char* path = fileInfo.absoluteFilePath().toStdString().c_str();
+    return fileInfo.absoluteFilePath();
+}
+
+// Delete the attack and sustain copies made for a loop, if any.
+static void deleteLoopBuffers(SampleLoop& loop) {
+    if (loop.attack)
+        alDeleteBuffers(1, &loop.attack);
+    if (loop.sustain)
+        alDeleteBuffers(1, &loop.sustain);
+    loop.attack = 0;
+    loop.sustain = 0;
+}
+
+bool LowLatencyAudio_JS::decodeAudio(QString filePath, ALuint& bufferID, MixerClip* clip, SampleLoop& loop,
+                                     AssetLoadStats& stats, vector<SpriteRegion>* cues) {
+    QByteArray pathBytes = filePath.toLocal8Bit();
+    const char* path = pathBytes.constData();
 
-    // Generate buffers to hold audio data.
-    alGenBuffers(1, &m_audioBuffers[id]);
+    double startTime = monotonicMs();
 
-    // Load sound file.
-    FILE* file = fopen(path, "rb");
+    // Map the whole sound file; the loaders parse it in place.
+    MappedFile file;
+    if (!file.open(path)) {
+        qDebug() << "Could not map audio file " << path;
+        return false;
+    }
 
-    // Read the file header
-    char header[12];
-    bufferID = m_audioBuffers[id];
-    if (fread(header, 1, 12, file) != 12) {
+    // Check the file header
+    const unsigned char* header = file.data();
+    if (file.size() < 12) {
         qDebug() << "Invalid header for audio file " << path;
-        alDeleteBuffers(1, &bufferID);
-        if (file) { fclose(file); }
         return false;
     }
 
+    // A sprite sheet is kept whole and unmeasured; its regions are trimmed
+    // as they are cut.
+    Loudness unmeasured = { false, 0, 0, 0 };
+    stats.trimmedLeading = 0;
+    stats.trimmedTrailing = 0;
+    stats.loudness = unmeasured;
+    AssetLoadStats* analysis = cues ? 0 : &stats;
+
+    // Generate buffers to hold audio data, unless it goes into a clip.
+    SampleLoop none = { 0, 0, 0, 0 };
+    loop = none;
+    bufferID = 0;
+    if (!clip)
+        alGenBuffers(1, &bufferID);
+
     // Check the file format & load the buffer with audio data.
+    bool loaded = false;
     if (memcmp(header, "RIFF", 4) == 0) {
-        if (!loadWav(file, bufferID)) {
+        loaded = loadWav(file, bufferID, clip, loop, cues, analysis);
+        if (!loaded)
             qDebug() << "Invalid wav file: " << path;
-            alDeleteBuffers(1, &bufferID);
-            if (file) { fclose(file); }
-            return false;
-        }
     }
     else if (memcmp(header, "OggS", 4) == 0) {
-        if (!loadOgg(file, bufferID)) {
+        loaded = loadOgg(file, bufferID, clip, path, analysis);
+        if (!loaded)
             qDebug() << "Invalid ogg file: " << path;
-            alDeleteBuffers(1, &bufferID);
-            if (file) { fclose(file); }
-            return false;
-        }
+    }
+    else if (isMp3(header, file.size())) {
+        loaded = loadMp3(file, bufferID, clip, path, analysis);
+        if (!loaded)
+            qDebug() << "Invalid mp3 file: " << path;
     }
     else {
         qDebug() << "Unsupported audio file: " << path;
-        if (file) { fclose(file); }
+    }
+
+    if (!loaded) {
+        if (bufferID)
+            alDeleteBuffers(1, &bufferID);
+        deleteLoopBuffers(loop);
+        bufferID = 0;
         return false;
     }
 
+    // Record how long the load took and how much of the file was mapped.
+    stats.loadTime = monotonicMs() - startTime;
+    stats.bytesMapped = file.size();
+
+    qDebug() << "Loaded " << path << ": " << stats.bytesMapped << " bytes mapped in " << stats.loadTime << " ms";
+
     return true;
 }
 
+bool LowLatencyAudio_JS::loadAudio(QString id, QString assetPath) {
+    QString filePath = resolveAssetPath(assetPath);
 
-/**
- * Default constructor.
- */
-LowLatencyAudio_JS::LowLatencyAudio_JS(const std::string& id) :
-		m_id(id) {
-	// Initialize the ALUT and creates OpenAL context on default device
-    // Input 0,0 so it grabs the native device as default and creates the context automatically
-    alutInit(0, 0);
-}
+    // Aliases of an already loaded file share its buffer.
+    if (retainBuffer(id, filePath))
+        return true;
 
-/**
- * LowLatencyAudio_JS destructor.
- */
-LowLatencyAudio_JS::~LowLatencyAudio_JS() {
-    ALuint bufferID = 0;
-    ALuint sources = 0;
-    QString name;
+    ALuint bufferID;
+    SampleLoop loop;
+    AssetLoadStats stats;
+    MixerClip* clip = m_softwareMixing ? createClip() : 0;
 
-    // Stop and unload all files before deleting the sources and buffers
-    for (int bufferIndex = 0; bufferIndex < m_audioBuffers.size(); bufferIndex++) {
-        name = m_audioBuffers.key(bufferIndex);
-        unload(name);
+    if (!decodeAudio(filePath, bufferID, clip, loop, stats)) {
+        delete clip;
+        return false;
     }
 
-    m_assetSources.clear();
-    m_soundSources.clear();
-    m_audioBuffers.clear();
+    adoptBuffer(id, filePath, bufferID, clip, loop, stats);
+    return true;
+}
 
-    // Exit the ALUT.
-    alutExit();
+// Length of a buffer's audio in seconds, read back once at load time.
+static double bufferDuration(ALuint buffer) {
+    ALint size = 0, channels = 0, bits = 0, frequency = 0;
+    alGetBufferi(buffer, AL_SIZE, &size);
+    alGetBufferi(buffer, AL_CHANNELS, &channels);
+    alGetBufferi(buffer, AL_BITS, &bits);
+    alGetBufferi(buffer, AL_FREQUENCY, &frequency);
+
+    if (channels <= 0 || bits <= 0 || frequency <= 0)
+        return 0;
+    return (double)size / (channels * (bits / 8)) / frequency;
 }
 
-/**
- * This method returns the list of objects implemented by this native
- * extension.
- */
-char* onGetObjList() {
-    static char name[] = "LowLatencyAudio_JS";
-	return name;
+// Bytes of PCM an asset holds: what was given to alBufferData for its buffer
+// and loop regions, or the clip's samples.
+static size_t decodedBytes(ALuint buffer, const MixerClip* clip, const SampleLoop& loop) {
+    if (clip)
+        return clip->bytes();
+
+    ALuint buffers[3] = { buffer, loop.attack, loop.sustain };
+    size_t bytes = 0;
+    for (int i = 0; i < 3; i++) {
+        ALint size = 0;
+        if (buffers[i])
+            alGetBufferi(buffers[i], AL_SIZE, &size);
+        bytes += size;
+    }
+    return bytes;
 }
 
-/**
- * This method is used by JNext to instantiate the LowLatencyAudio_JS object when
- * an object is created on the JavaScript server side.
- */
-JSExt* onCreateObject(const string& className, const string& id) {
-    if (className == "LowLatencyAudio_JS") {
-		return new LowLatencyAudio_JS(id);
-	}
+// Point id at the buffer already decoded from filePath, if there is one.
+bool LowLatencyAudio_JS::retainBuffer(QString id, QString filePath) {
+    if (!m_sharedBuffers.contains(filePath))
+        return false;
 
-	return NULL;
-}
+    SharedBuffer& shared = m_sharedBuffers[filePath];
+    shared.references++;
+    shared.lastUsed = ++m_useClock;
+    m_audioBuffers[id] = shared.buffer;
+    m_bufferPaths[id] = filePath;
 
-/**
- * Method used by JNext to determine if the object can be deleted.
- */
-bool LowLatencyAudio_JS::CanDelete() {
+    // An alias costs neither I/O nor decoding.
+    AssetLoadStats stats = { 0, 0, 0, 0, { false, 0, 0, 0 } };
+    m_loadStats[id] = stats;
     return true;
 }
 
-string LowLatencyAudio_JS::preloadFX(QString id, QString assetPath) {
-    ALuint bufferID;
-    ALuint source;
+// An empty clip for the software mixer, storing samples as configured.
+MixerClip* LowLatencyAudio_JS::createClip() const {
+    MixerClip* clip = new MixerClip();
+    clip->setAdpcmStorage(m_adpcmStorage);
+    return clip;
+}
 
-    // Load the audio file into memory if necessary
-    if (!m_audioBuffers[id]) {
-        if (!loadAudio(id, assetPath))
-            return "preloadFX failed: " + id.toStdString();
-    }
+// Register a freshly decoded buffer for id as the shared copy of filePath.
+void LowLatencyAudio_JS::adoptBuffer(QString id, QString filePath, ALuint bufferID, MixerClip* clip,
+                                     const SampleLoop& loop, const AssetLoadStats& stats, bool reloadable) {
+    SharedBuffer shared;
+    shared.buffer = bufferID;
+    shared.clip = clip;
+    shared.loop = loop;
+    shared.references = 1;
+    shared.duration = clip ? clip->duration() : bufferDuration(bufferID);
+    shared.bytes = decodedBytes(bufferID, clip, loop);
+    shared.lastUsed = ++m_useClock;
+    shared.pins = 0;
+    shared.reloadable = reloadable;
+    shared.evicted = false;
+    shared.loudness = stats.loudness;
+    m_sharedBuffers.insert(filePath, shared);
+    m_residentBytes += shared.bytes;
+
+    m_audioBuffers[id] = bufferID;
+    m_bufferPaths[id] = filePath;
+    m_loadStats[id] = stats;
+
+    // Make room for it among the idle assets. That stops sources, which
+    // loader threads leave to the control thread.
+    if (onControlThread())
+        enforceBudget(filePath);
+    else
+        m_poolWorkPending = true;
+}
 
-    // Create sound source if not available
-    if (!m_soundSources[id]) {
-        bufferID = m_audioBuffers[id];
-        alGenSources(1, &source);
-        alSourcei(source, AL_BUFFER, bufferID);
-        m_soundSources.insertMulti(id, source);
+// Drop id's reference to its buffer, deleting it with the last reference.
+void LowLatencyAudio_JS::releaseBuffer(QString id) {
+    m_audioBuffers.remove(id);
+    if (!m_bufferPaths.contains(id))
+        return;
+
+    QString filePath = m_bufferPaths.take(id);
+    SharedBuffer& shared = m_sharedBuffers[filePath];
+    if (m_pinnedIds.remove(id))
+        shared.pins--;
+    if (--shared.references > 0)
+        return;
+
+    if (shared.clip) {
+        if (m_mixer)
+            m_mixer->stopClip(shared.clip);
+        delete shared.clip;
+    } else if (!shared.evicted) {
+        alDeleteBuffers(1, &shared.buffer);
+        deleteLoopBuffers(shared.loop);
     }
+    if (!shared.evicted)
+        m_residentBytes -= shared.bytes;
+    m_sharedBuffers.remove(filePath);
+}
 
-    int x = 3;
-    pthread_t useCheck_thread;
-
-    // Create a thread to check if the preloaded audio file if being used or not. If not, kill the audio device channel
-    if(pthread_create(&useCheck_thread, NULL, useCheck, &x)) {
-        fprintf(stderr, "Error creating thread\n");
-        return NULL;
-    }
+// Decode the asset in slot again if the memory budget evicted it, timing
+// how long the trigger waited; either way it becomes the most recently used.
+bool LowLatencyAudio_JS::ensureResident(int slot) {
+    QHash<QString, SharedBuffer>::iterator it = m_sharedBuffers.find(m_bufferPaths.value(m_assets[slot]->id));
+    if (it == m_sharedBuffers.end())
+        return false;
 
-    return "File: <" + id.toStdString() + "> is loaded";
-}
+    SharedBuffer& shared = it.value();
+    shared.lastUsed = ++m_useClock;
+    if (!shared.evicted)
+        return true;
 
-string LowLatencyAudio_JS::preloadAudio(QString id, QString assetPath, double volume, int voices) {
+    double startTime = monotonicMs();
     ALuint bufferID;
-    ALuint source;
+    SampleLoop loop;
+    AssetLoadStats stats;
+    if (!decodeAudio(it.key(), bufferID, shared.clip, loop, stats))
+        return false;
 
-    // Load the audio file into memory if necessary
-    if (!m_audioBuffers[id]) {
-        if (!loadAudio(id, assetPath))
-            return "preloadAudio failed: " + id.toStdString();
-    }
+    // Resampling and trimming may have been set differently since the first
+    // decode, so the length and loop come from this one.
+    shared.buffer = bufferID;
+    shared.loop = loop;
+    shared.duration = shared.clip ? shared.clip->duration() : bufferDuration(bufferID);
+    shared.bytes = decodedBytes(bufferID, shared.clip, loop);
+    shared.evicted = false;
+    shared.loudness = stats.loudness;
+    m_residentBytes += shared.bytes;
+    rebindAssets(it.key(), shared, &stats);
+
+    double latency = monotonicMs() - startTime;
+    m_redecodes++;
+    m_redecodeTotal += latency;
+    m_redecodeLast = latency;
+    if (latency > m_redecodeMax)
+        m_redecodeMax = latency;
+
+    enforceBudget(it.key());
+    return true;
+}
 
-    // Create asset source if not available
-    if (!m_soundSources[id]) {
-        bufferID = m_audioBuffers[id];
-        for (int i = 0; i < voices; i++) {
-            alGenSources(1, &source);
-            alSourcei(source, AL_BUFFER, bufferID);
-            alSourcef(source, AL_GAIN, (float)(volume));
-            m_assetSources.insertMulti(id, source);
+// Evict idle, unpinned buffers, least recently used first, until the
+// resident PCM fits the budget again. keep is never evicted.
+void LowLatencyAudio_JS::enforceBudget(const QString& keep) {
+    if (!m_memoryBudget || m_residentBytes <= m_memoryBudget)
+        return;
+
+    // This also reclaims pool voices that have finished.
+    bool silent = m_voicePool.isSilent(deviceTime());
+
+    while (m_residentBytes > m_memoryBudget) {
+        QHash<QString, SharedBuffer>::iterator victim = m_sharedBuffers.end();
+        for (QHash<QString, SharedBuffer>::iterator it = m_sharedBuffers.begin(); it != m_sharedBuffers.end(); ++it) {
+            const SharedBuffer& shared = it.value();
+            if (shared.evicted || shared.pins > 0 || !shared.reloadable || it.key() == keep)
+                continue;
+            if (victim != m_sharedBuffers.end() && victim.value().lastUsed <= shared.lastUsed)
+                continue;
+            if (isBufferIdle(it.key(), shared, silent))
+                victim = it;
         }
+
+        // Everything left is playing, pinned or just loaded.
+        if (victim == m_sharedBuffers.end())
+            return;
+        evictBuffer(victim.key(), victim.value());
     }
+}
 
-    int x = 3;
-    pthread_t useCheck_thread;
+bool LowLatencyAudio_JS::isBufferIdle(const QString& filePath, const SharedBuffer& shared, bool silent) {
+    if (shared.clip)
+        return !m_mixer || m_mixer->clipVoices(shared.clip) == 0;
+    if (silent)
+        return true;
 
-    // Create a thread to check if the preloaded audio file if being used or not. If not, kill the audio device channel
-    if(pthread_create(&useCheck_thread, NULL, useCheck, &x)) {
-        fprintf(stderr, "Error creating thread\n");
-        return NULL;
+    for (QHash<QString, QString>::const_iterator it = m_bufferPaths.constBegin(); it != m_bufferPaths.constEnd(); ++it) {
+        int slot = it.value() == filePath ? m_assetSlots.value(it.key(), -1) : -1;
+        if (slot >= 0 && m_voicePool.activeVoices(slot) > 0)
+            return false;
     }
-
-    return "File: <" + id.toStdString() + "> is loaded";
+    return true;
+}
+
+void LowLatencyAudio_JS::evictBuffer(const QString& filePath, SharedBuffer& shared) {
+    if (shared.clip) {
+        shared.clip->release();
+    } else {
+        // Sources keep finished buffers bound; unbind them so it can go.
+        for (QHash<QString, QString>::const_iterator it = m_bufferPaths.constBegin(); it != m_bufferPaths.constEnd(); ++it) {
+            int slot = it.value() == filePath ? m_assetSlots.value(it.key(), -1) : -1;
+            if (slot < 0)
+                continue;
+            vector<ALuint> sources;
+            m_voicePool.detachOwner(slot, sources);
+            for (size_t i = 0; i < sources.size(); ++i) {
+                alSourceStop(sources[i]);
+                alSourcei(sources[i], AL_BUFFER, 0);
+            }
+        }
+        alDeleteBuffers(1, &shared.buffer);
+        deleteLoopBuffers(shared.loop);
+        shared.buffer = 0;
+    }
+
+    m_residentBytes -= shared.bytes;
+    shared.evicted = true;
+    m_evictions++;
+    rebindAssets(filePath, shared);
+}
+
+void LowLatencyAudio_JS::rebindAssets(const QString& filePath, const SharedBuffer& shared,
+                                      const AssetLoadStats* redecoded) {
+    for (QHash<QString, QString>::const_iterator it = m_bufferPaths.constBegin(); it != m_bufferPaths.constEnd(); ++it) {
+        if (it.value() != filePath)
+            continue;
+        m_audioBuffers[it.key()] = shared.buffer;
+        int slot = m_assetSlots.value(it.key(), -1);
+        if (slot >= 0) {
+            m_assets[slot]->buffer = shared.buffer;
+            m_assets[slot]->loop = shared.loop;
+            m_assets[slot]->duration = shared.duration;
+        }
+
+        // The original load time stands; what the decode found is replaced.
+        if (redecoded && m_loadStats.contains(it.key())) {
+            AssetLoadStats& stats = m_loadStats[it.key()];
+            stats.trimmedLeading = redecoded->trimmedLeading;
+            stats.trimmedTrailing = redecoded->trimmedTrailing;
+            stats.loudness = redecoded->loudness;
+        }
+    }
+}
+
+// Register a loaded asset and make sure the pool can serve its voices.
+int LowLatencyAudio_JS::createAsset(QString id, double volume, int voices, int priority) {
+    if (m_assetSlots.contains(id))
+        return m_assets[m_assetSlots.value(id)]->handle;
+
+    AudioAsset* asset = new AudioAsset();
+    asset->id = id;
+    asset->buffer = m_audioBuffers[id];
+    const SharedBuffer& shared = m_sharedBuffers[m_bufferPaths.value(id)];
+    asset->clip = shared.clip;
+    asset->loop = shared.loop;
+    asset->duration = shared.duration;
+    asset->normalization = normalizationGain(shared.loudness);
+    asset->volume = (float)(volume) * asset->normalization;
+    asset->voices = voices > 0 ? voices : 1;
+    asset->priority = priority;
+
+    // Reuse a slot freed by unload before growing the table.
+    int slot = 0;
+    while (slot < (int)m_assets.size() && m_assets[slot])
+        slot++;
+    if (slot == (int)m_assets.size()) {
+        m_assets.push_back(asset);
+        m_slotGenerations.push_back(0);
+    } else {
+        m_assets[slot] = asset;
+    }
+    m_assetSlots.insert(id, slot);
+
+    // First handles are simply 1, 2, 3...; a reused slot gets a new one.
+    // Past the mask the count goes round to 1, not 0, so handles stay
+    // positive and never repeat the slot's first one.
+    int generation = m_slotGenerations[slot];
+    m_slotGenerations[slot] = generation == AUDIO_HANDLE_GENERATION_MASK ? 1 : generation + 1;
+    asset->handle = (generation << AUDIO_HANDLE_SLOT_BITS) | (slot + 1);
+
+    // Mixed assets take their voices from the software mixer.
+    if (asset->clip)
+        return asset->handle;
+
+    // Allocate sources now rather than on the first trigger, as the per
+    // asset sources used to be, until the device limit is reached. Assets
+    // completed on a loader thread get theirs on the control thread.
+    m_requestedVoices += asset->voices;
+    if (onControlThread())
+        growVoicePool(m_requestedVoices - m_voicePool.count());
+    else
+        m_poolWorkPending = true;
+    return asset->handle;
+}
+
+int LowLatencyAudio_JS::resolveHandle(int handle) const {
+    int slot = (handle & AUDIO_HANDLE_SLOT_MASK) - 1;
+    if (slot < 0 || slot >= (int)m_assets.size() || !m_assets[slot] || m_assets[slot]->handle != handle)
+        return -1;
+    return slot;
+}
+
+void LowLatencyAudio_JS::growVoicePool(int count) {
+    for (; count > 0 && m_voicePool.count() < m_voicePool.capacity(); count--) {
+        ALuint source;
+        alGenSources(1, &source);
+
+        // The device may have fewer sources than it reported.
+        ALenum error = alGetError();
+        if (error != AL_NO_ERROR) {
+            reportOpenALError(error);
+            m_voicePool.setCapacity(m_voicePool.count());
+            return;
+        }
+        m_voicePool.addVoice(source);
+    }
+}
+
+bool LowLatencyAudio_JS::reserveStreamSource() {
+    if (m_streams.size() < SOUNDMANAGER_STREAM_SOURCES)
+        return true;
+    if (m_voicePool.count() >= m_voicePool.capacity() || m_voicePool.capacity() <= 1)
+        return false;
+    m_voicePool.setCapacity(m_voicePool.capacity() - 1);
+    return true;
+}
+
+// Called once the stream is out of m_streams, or was never put in it.
+void LowLatencyAudio_JS::releaseStreamSource() {
+    if (m_streams.size() >= SOUNDMANAGER_STREAM_SOURCES)
+        m_voicePool.setCapacity(m_voicePool.capacity() + 1);
+}
+
+int LowLatencyAudio_JS::acquireVoice(int slot, double now, bool& stolen) {
+    AudioAsset* asset = m_assets[slot];
+
+    // Sources are added lazily once the preallocated ones are all busy.
+    if (!m_voicePool.hasIdleVoice(now) && m_voicePool.activeVoices(slot) < asset->voices)
+        growVoicePool(1);
+
+    VoiceLease lease = m_voicePool.acquire(slot, asset->priority, asset->voices, asset->duration, now);
+    stolen = lease.stolen;
+    if (lease.voice < 0)
+        return -1;
+
+    ALuint source = m_voicePool.voice(lease.voice).source;
+    if (lease.unloop)
+        alSourcei(source, AL_LOOPING, AL_FALSE);
+
+    // A source last used by another asset must be stopped before its buffer
+    // can be swapped. One that looped a sustain region holds a queue instead.
+    if (lease.rebind || asset->loop.sustain) {
+        if (lease.stolen)
+            alSourceStop(source);
+        alSourcei(source, AL_BUFFER, asset->buffer);
+        alSourcef(source, AL_GAIN, asset->volume);
+
+        // Sources clamp their gain to AL_MAX_GAIN, 1 by default. Only a
+        // loudness target's boost may take an asset past it, so a volume
+        // above 1 is still clamped to 1 before the boost.
+        alSourcef(source, AL_MAX_GAIN, asset->normalization > 1 ? asset->normalization : 1.0f);
+    }
+
+    return lease.voice;
+}
+
+/**
+ * Default constructor.
+ */
+LowLatencyAudio_JS::LowLatencyAudio_JS(const std::string& id) :
+		m_id(id), m_requestedVoices(0), m_loaderPool(0), m_lastTicket(0),
+		m_deviceRetained(false), m_deviceOpenedAt(0), m_firstTriggerMs(-1), m_firstTriggerDelay(0),
+		m_controlStarted(false), m_poolWorkPending(false), m_commandCount(0), m_commandLatency(0), m_lastCommandLatency(0),
+		m_maxCommandLatency(0), m_commandWaits(0), m_scheduleSequence(0),
+		m_mixerPeriod(1.0 / SCHEDULER_DEFAULT_REFRESH), m_scheduled(0), m_fired(0), m_dropped(0),
+		m_firedInPeriod(0), m_lateTotal(0), m_lateMax(0), m_softwareMixing(false), m_mixer(0),
+		m_offlineRate(0), m_renderedFrames(0), m_outputRate(0), m_resampleQuality(RESAMPLE_OFF),
+		m_memoryBudget(0), m_residentBytes(0), m_useClock(0), m_evictions(0), m_redecodes(0),
+		m_redecodeTotal(0), m_redecodeLast(0), m_redecodeMax(0), m_adpcmStorage(false),
+		m_trimSilence(false), m_trimThreshold(0), m_normalize(false), m_loudnessTarget(-23) {
+    pthread_mutex_init(&m_lock, NULL);
+    sem_init(&m_commandReady, 0, 0);
+
+    // Open the device up front so the first trigger finds it warm.
+    openDevice();
+
+    // One thread for the plugin's lifetime suspends the device when idle.
+    m_idleMonitor.start(isEngineActive, this);
+
+    // Without the control thread commands run on the caller's thread.
+    if (pthread_create(&m_controlThread, NULL, controlThread, this))
+        qDebug() << "Error creating audio control thread";
+    else
+        m_controlStarted = true;
+}
+
+/**
+ * LowLatencyAudio_JS destructor.
+ */
+LowLatencyAudio_JS::~LowLatencyAudio_JS() {
+    // Let queued commands run, then take over on this thread.
+    if (m_controlStarted) {
+        AudioCommand quit;
+        quit.type = AUDIO_COMMAND_QUIT;
+        quit.call = 0;
+        quit.batched = false;
+        enqueueCommand(quit);
+        pthread_join(m_controlThread, NULL);
+        m_controlStarted = false;
+    }
+
+    // Let in-flight loads finish before tearing down what they register into.
+    delete m_loaderPool;
+    m_loaderPool = 0;
+
+    // Resume the device so teardown runs against a live context.
+    m_idleMonitor.stop();
+
+    closeDevice();
+
+    sem_destroy(&m_commandReady);
+    pthread_mutex_destroy(&m_lock);
+}
+
+// Take a reference on the shared device, sizing the voice pool the first
+// time this object sees it open.
+bool LowLatencyAudio_JS::openDevice() {
+    if (m_deviceRetained)
+        return true;
+
+    if (!AudioDevice::retain())
+        return false;
+    m_deviceRetained = true;
+    m_deviceOpenedAt = monotonicMs();
+    m_firstTriggerMs = -1;
+    m_offlineRate = AudioDevice::loopbackRate();
+    m_renderedFrames = 0;
+
+    // Size the voice pool to what the device can mix, leaving room for streams.
+    ALCint sources = 0;
+    alcGetIntegerv(AudioDevice::device(), ALC_MONO_SOURCES, 1, &sources);
+    if (sources <= 0)
+        sources = SOUNDMANAGER_MAX_NBR_OF_SOURCES;
+    sources -= SOUNDMANAGER_STREAM_SOURCES;
+    m_voicePool.setCapacity(sources > 1 ? sources : 1);
+
+    // Scheduled starts are measured against one mixer update.
+    ALCint refresh = 0;
+    alcGetIntegerv(AudioDevice::device(), ALC_REFRESH, 1, &refresh);
+    m_mixerPeriod = 1.0 / (refresh > 0 ? refresh : SCHEDULER_DEFAULT_REFRESH);
+
+    // Assets are resampled to the rate the device mixes at, if asked to.
+    ALCint frequency = 0;
+    alcGetIntegerv(AudioDevice::device(), ALC_FREQUENCY, 1, &frequency);
+    m_outputRate = frequency > 0 ? frequency : 0;
+
+    if (m_softwareMixing)
+        openMixer();
+    return true;
+}
+
+// Start the software mixer at the device's output rate.
+void LowLatencyAudio_JS::openMixer() {
+    m_mixer = new SoftwareMixer();
+    if (!m_mixer->open(m_outputRate ? m_outputRate : SOFTWARE_MIXER_DEFAULT_RATE)) {
+        delete m_mixer;
+        m_mixer = 0;
+    }
+}
+
+// Unload everything and drop this object's reference on the device, which
+// closes with the last one.
+void LowLatencyAudio_JS::closeDevice() {
+    if (!m_deviceRetained)
+        return;
+
+    // Device time restarts with the next open; drop what was scheduled on it.
+    m_dropped += m_schedule.size();
+    m_schedule = std::priority_queue<ScheduledEvent, std::vector<ScheduledEvent>, std::greater<ScheduledEvent> >();
+
+    // Stop and unload all files before deleting the sources and buffers
+    QList<QString> ids = m_sprites.keys();
+    ids.append(m_bufferPaths.keys());
+    ids.append(m_streams.keys());
+    for (int i = 0; i < ids.size(); ++i)
+        unload(ids.at(i));
+
+    delete m_mixer;
+    m_mixer = 0;
+
+    for (int i = 0; i < m_voicePool.count(); ++i)
+        alDeleteSources(1, &m_voicePool.voice(i).source);
+    m_voicePool = VoicePool();
+    m_requestedVoices = 0;
+
+    AudioDevice::release();
+    m_deviceRetained = false;
+}
+
+/**
+ * This method returns the list of objects implemented by this native
+ * extension.
+ */
+char* onGetObjList() {
+    static char name[] = "LowLatencyAudio_JS";
+	return name;
+}
+
+/**
+ * This method is used by JNext to instantiate the LowLatencyAudio_JS object when
+ * an object is created on the JavaScript server side.
+ */
+JSExt* onCreateObject(const string& className, const string& id) {
+    if (className == "LowLatencyAudio_JS") {
+		return new LowLatencyAudio_JS(id);
+	}
+
+	return NULL;
+}
+
+/**
+ * Method used by JNext to determine if the object can be deleted.
+ */
+bool LowLatencyAudio_JS::CanDelete() {
+    return true;
+}
+
+string LowLatencyAudio_JS::preloadFX(QString id, QString assetPath) {
+    m_idleMonitor.touch();
+    if (!openDevice())
+        return "preloadFX failed: no audio device";
+
+    // Load the audio file into memory if necessary
+    if (!m_bufferPaths.contains(id)) {
+        if (!loadAudio(id, assetPath))
+            return "preloadFX failed: " + id.toStdString();
+    }
+
+    // Register the asset if not available; its handle is the result.
+    ostringstream handle;
+    handle << createAsset(id, 1.0, 1, 0);
+    return handle.str();
+}
+
+string LowLatencyAudio_JS::preloadAudio(QString id, QString assetPath, double volume, int voices, int priority) {
+    m_idleMonitor.touch();
+    if (!openDevice())
+        return "preloadAudio failed: no audio device";
+
+    // Load the audio file into memory if necessary
+    if (!m_bufferPaths.contains(id)) {
+        if (!loadAudio(id, assetPath))
+            return "preloadAudio failed: " + id.toStdString();
+    }
+
+    // Register the asset if not available; its handle is the result.
+    ostringstream handle;
+    handle << createAsset(id, volume, voices, priority);
+    return handle.str();
+}
+
+// Decodes one asset on a loader thread and reports back through an event.
+// Progress of one preloadManifest request, shared by the jobs it queued.
+// Guarded by the plugin lock.
+struct ManifestBatch {
+    int ticket;
+    int count;
+    int completed;
+    int references;
+    double startTime;
+    double decodeTime;
+    Json::Value assets;
+};
+
+// Decodes one asset on a loader thread and reports back through an event.
+class PreloadJob: public LoaderJob {
+
+public:
+    PreloadJob(LowLatencyAudio_JS* owner, int ticket, QString id, QString assetPath,
+               double volume, int voices, int priority, ManifestBatch* batch = 0) :
+            m_owner(owner), m_ticket(ticket), m_id(id), m_assetPath(assetPath),
+            m_volume(volume), m_voices(voices), m_priority(priority), m_batch(batch),
+            m_softwareMixing(owner->m_softwareMixing), m_cancelled(false) {
+    }
+
+    virtual ~PreloadJob() {
+        // Jobs dropped by the pool still release their hold on the batch.
+        if (m_batch) {
+            pthread_mutex_lock(&m_owner->m_lock);
+            if (--m_batch->references == 0)
+                delete m_batch;
+            pthread_mutex_unlock(&m_owner->m_lock);
+        }
+    }
+
+    virtual void run() {
+        ALuint bufferID = 0;
+        SampleLoop loop = { 0, 0, 0, 0 };
+        AssetLoadStats stats;
+        QString filePath = resolveAssetPath(m_assetPath);
+
+        // The expensive part runs without holding the plugin lock, and is
+        // skipped when the file is already loaded under another id.
+        pthread_mutex_lock(&m_owner->m_lock);
+        bool shared = m_owner->m_sharedBuffers.contains(filePath);
+        pthread_mutex_unlock(&m_owner->m_lock);
+
+        MixerClip* clip = !shared && m_softwareMixing ? m_owner->createClip() : 0;
+        bool loaded = !shared && m_owner->decodeAudio(filePath, bufferID, clip, loop, stats);
+        m_owner->completePreload(*this, filePath, loaded, bufferID, clip, loop, stats);
+    }
+
+    // Never started before shutdown; reported as failed so the caller hears.
+    virtual void cancel() {
+        SampleLoop loop = { 0, 0, 0, 0 };
+        AssetLoadStats stats = { 0, 0, 0, 0, { false, 0, 0, 0 } };
+        m_cancelled = true;
+        m_owner->completePreload(*this, resolveAssetPath(m_assetPath), false, 0, 0, loop, stats);
+    }
+
+    LowLatencyAudio_JS* m_owner;
+    int m_ticket;
+    QString m_id;
+    QString m_assetPath;
+    double m_volume;
+    int m_voices;
+    int m_priority;
+    ManifestBatch* m_batch;
+    // Engine mode when queued; a switch before completion voids the decode.
+    bool m_softwareMixing;
+    bool m_cancelled;
+};
+
+// Returns 0 if there is no loader thread to run the job.
+int LowLatencyAudio_JS::preloadAsync(QString id, QString assetPath, double volume, int voices, int priority) {
+    if (!loaderPool()->threadCount())
+        return 0;
+
+    // Without a device the decode fails and reports preloadFailed.
+    openDevice();
+
+    int ticket = ++m_lastTicket;
+    loaderPool()->submit(new PreloadJob(this, ticket, id, assetPath, volume, voices, priority));
+    return ticket;
+}
+
+// Workers are only started once something is loaded asynchronously. A
+// pool that could not start any is never given jobs, and is retried here.
+LoaderPool* LowLatencyAudio_JS::loaderPool() {
+    if (m_loaderPool && !m_loaderPool->threadCount()) {
+        delete m_loaderPool;
+        m_loaderPool = 0;
+    }
+    if (!m_loaderPool)
+        m_loaderPool = new LoaderPool();
+    return m_loaderPool;
+}
+
+string LowLatencyAudio_JS::preloadFXAsync(QString id, QString assetPath) {
+    int ticket = preloadAsync(id, assetPath, 1.0, 1, 0);
+    if (!ticket)
+        return "preloadFXAsync failed: no loader thread";
+
+    ostringstream result;
+    result << ticket;
+    return result.str();
+}
+
+string LowLatencyAudio_JS::preloadAudioAsync(QString id, QString assetPath, double volume, int voices, int priority) {
+    int ticket = preloadAsync(id, assetPath, volume, voices, priority);
+    if (!ticket)
+        return "preloadAudioAsync failed: no loader thread";
+
+    ostringstream result;
+    result << ticket;
+    return result.str();
+}
+
+/**
+ * Preload every asset listed in a JSON manifest on the loader pool. The
+ * manifest is either inline JSON or the path of a .json asset, holding an
+ * array of entries (or an object with an "assets" array) of the form
+ * { "id": ..., "path": ..., "volume": 1.0, "voices": 1, "priority": 0 }.
+ * The priority orders loading and also decides which voices the asset may
+ * steal once playing. Returns a ticket; a manifestLoaded event reports the
+ * timings.
+ */
+string LowLatencyAudio_JS::preloadManifest(const string& manifest) {
+    string text = manifest;
+
+    if (text.empty())
+        return "preloadManifest failed: empty manifest";
+
+    if (text[0] != '{' && text[0] != '[') {
+        MappedFile file;
+        QByteArray pathBytes = resolveAssetPath(QString::fromStdString(manifest)).toLocal8Bit();
+        if (!file.open(pathBytes.constData()))
+            return "preloadManifest failed: could not read " + manifest;
+        text.assign((const char*)file.data(), file.size());
+    }
+
+    Json::Value root;
+    Json::Reader reader;
+    if (!reader.parse(text, root, false))
+        return "preloadManifest failed: " + reader.getFormatedErrorMessages();
+
+    const Json::Value& entries = root.isObject() ? root["assets"] : root;
+    if (!entries.isArray() || entries.size() == 0)
+        return "preloadManifest failed: no assets listed";
+    if (!loaderPool()->threadCount())
+        return "preloadManifest failed: no loader thread";
+
+    openDevice();
+
+    ManifestBatch* batch = new ManifestBatch();
+    batch->ticket = ++m_lastTicket;
+    batch->count = entries.size();
+    batch->completed = 0;
+    batch->references = batch->count;
+    batch->startTime = monotonicMs();
+    batch->decodeTime = 0;
+    batch->assets = Json::Value(Json::arrayValue);
+
+    for (Json::Value::UInt i = 0; i < entries.size(); i++) {
+        const Json::Value& entry = entries[i];
+        QString id = QString::fromStdString(entry.get("id", "").asString());
+        QString path = QString::fromStdString(entry.get("path", entry.get("id", "")).asString());
+
+        int priority = entry.get("priority", 0).asInt();
+        PreloadJob* job = new PreloadJob(this, batch->ticket, id, path,
+                                         entry.get("volume", 1.0).asDouble(),
+                                         entry.get("voices", 1).asInt(), priority, batch);
+        loaderPool()->submit(job, priority);
+    }
+
+    ostringstream ticket;
+    ticket << batch->ticket;
+    return ticket.str();
+}
+
+void LowLatencyAudio_JS::completePreload(const PreloadJob& job, QString filePath, bool decoded,
+                                         ALuint bufferID, MixerClip* clip, SampleLoop& loop,
+                                         const AssetLoadStats& stats) {
+    ostringstream event;
+
+    pthread_mutex_lock(&m_lock);
+
+    // Decoded for the engine mode that was active when the load was queued.
+    if (job.m_softwareMixing != m_softwareMixing) {
+        if (decoded && bufferID)
+            alDeleteBuffers(1, &bufferID);
+        if (decoded)
+            deleteLoopBuffers(loop);
+        decoded = false;
+    }
+
+    // Another load of the same id or file may have finished first; keep that
+    // one. Nothing is registered once the device has been shut down, or for
+    // a job cancelled by it.
+    bool loaded = m_deviceRetained && !job.m_cancelled
+                  && (m_bufferPaths.contains(job.m_id) || retainBuffer(job.m_id, filePath));
+    if (!m_deviceRetained) {
+        decoded = false;
+    } else if (loaded && decoded) {
+        if (bufferID)
+            alDeleteBuffers(1, &bufferID);
+        deleteLoopBuffers(loop);
+    } else if (decoded) {
+        adoptBuffer(job.m_id, filePath, bufferID, clip, loop, stats);
+        clip = 0;
+        loaded = true;
+    }
+    delete clip;
+
+    int handle = 0;
+    if (loaded)
+        handle = createAsset(job.m_id, job.m_volume, job.m_voices, job.m_priority);
+
+    ManifestBatch* batch = job.m_batch;
+    if (batch) {
+        // Manifest entries report once, when the last of them is done.
+        Json::Value asset;
+        asset["id"] = job.m_id.toStdString();
+        asset["loaded"] = loaded;
+        asset["handle"] = handle;
+        asset["ms"] = decoded ? stats.loadTime : 0.0;
+        batch->assets.append(asset);
+        if (decoded)
+            batch->decodeTime += stats.loadTime;
+
+        if (++batch->completed == batch->count) {
+            Json::Value result;
+            result["totalMs"] = monotonicMs() - batch->startTime;
+            result["decodeMs"] = batch->decodeTime;
+            result["threads"] = m_loaderPool->threadCount();
+            result["assets"] = batch->assets;
+
+            event << "manifestLoaded " << batch->ticket << " " << toJson(result);
+        }
+    } else if (loaded) {
+        event << "preloaded " << job.m_ticket << " " << handle << " " << job.m_id.toStdString();
+    } else {
+        event << "preloadFailed " << job.m_ticket << " " << job.m_id.toStdString();
+    }
+
+    bool wake = m_poolWorkPending;
+    pthread_mutex_unlock(&m_lock);
+
+    // Have the control thread pick up the sources and eviction left to it.
+    if (wake)
+        sem_post(&m_commandReady);
+    if (!event.str().empty())
+        notifyEvent(event.str());
+}
+
+bool LowLatencyAudio_JS::isEngineActive(void* plugin) {
+    LowLatencyAudio_JS* self = static_cast<LowLatencyAudio_JS*>(plugin);
+    bool active = false;
+
+    pthread_mutex_lock(&self->m_lock);
+    // A loopback device costs nothing between renders; it is never suspended.
+    if (self->m_offlineRate) {
+        pthread_mutex_unlock(&self->m_lock);
+        return true;
+    }
+
+    // Events still waiting in the scheduler count as activity too.
+    active = !self->m_voicePool.isSilent(self->deviceTime()) || !self->m_schedule.empty()
+             || (self->m_mixer && self->m_mixer->isActive());
+    for (QHash<QString, OggStream*>::iterator it = self->m_streams.begin(); !active && it != self->m_streams.end(); ++it)
+        active = it.value()->isPlaying();
+    pthread_mutex_unlock(&self->m_lock);
+
+    return active;
+}
+
+// Send an event to the JavaScript side of this object.
+void LowLatencyAudio_JS::notifyEvent(const std::string& event) {
+    std::string eventString = m_id + " " + event;
+    SendPluginEvent(eventString.c_str(), m_pContext);
+}
+
+string LowLatencyAudio_JS::preloadStream(QString id, QString assetPath, double volume) {
+    if (m_streams.contains(id))
+        return "File: <" + id.toStdString() + "> is loaded";
+
+    if (!openDevice())
+        return "preloadStream failed: no audio device";
+
+    // A stream's source comes out of the same device limit as the voices.
+    if (!reserveStreamSource())
+        return "preloadStream failed: no source left for " + id.toStdString();
+
+    QByteArray pathBytes = resolveAssetPath(assetPath).toLocal8Bit();
+    double startTime = monotonicMs();
+
+    OggStream* stream = new OggStream();
+    if (!stream->open(pathBytes.constData(), (float)(volume))) {
+        delete stream;
+        releaseStreamSource();
+        return "preloadStream failed: " + id.toStdString();
+    }
+    m_streams.insert(id, stream);
+
+    AssetLoadStats stats = { 0, 0, 0, 0, { false, 0, 0, 0 } };
+    stats.loadTime = monotonicMs() - startTime;
+    stats.bytesMapped = stream->bytesMapped();
+    m_loadStats[id] = stats;
+
+    return "File: <" + id.toStdString() + "> is loaded";
+}
+
+// Read sprite regions from a JSON sidecar, either as howler.js writes them,
+// { "sprite": { "name": [startMs, durationMs], ... } }, or as audiosprite
+// does, { "spritemap": { "name": { "start": s, "end": s }, ... } }.
+static bool readSpriteRegions(QString path, int rate, vector<SpriteRegion>& regions)
+{
+    MappedFile file;
+    QByteArray pathBytes = path.toLocal8Bit();
+    if (!file.open(pathBytes.constData()))
+        return false;
+
+    Json::Value root;
+    Json::Reader reader;
+    string text((const char*)file.data(), file.size());
+    if (!reader.parse(text, root, false) || !root.isObject()) {
+        qDebug() << "Invalid sprite regions in " << pathBytes.constData();
+        return false;
+    }
+
+    bool milliseconds = root.isMember("sprite");
+    const Json::Value& table = milliseconds ? root["sprite"] : root["spritemap"];
+    if (!table.isObject())
+        return false;
+
+    regions.clear();
+    Json::Value::Members names = table.getMemberNames();
+    for (size_t i = 0; i < names.size(); i++) {
+        const Json::Value& entry = table[names[i]];
+        double start, end;
+        if (milliseconds && entry.isArray() && entry.size() >= 2) {
+            start = entry[0u].asDouble() / 1000;
+            end = start + entry[1u].asDouble() / 1000;
+        } else if (!milliseconds && entry.isObject()) {
+            start = entry.get("start", 0.0).asDouble();
+            end = entry.get("end", 0.0).asDouble();
+        } else {
+            continue;
+        }
+
+        SpriteRegion region;
+        region.name = names[i];
+        region.start = (int)(start * rate + 0.5);
+        region.end = (int)(end * rate + 0.5);
+        regions.push_back(region);
+    }
+    return true;
+}
+
+/**
+ * Function to load an audio sprite: one file holding many sounds, each of
+ * which becomes an asset "id:region". Regions come from the file's labelled
+ * cue points, or from a JSON sidecar, by default the asset path with a
+ * .json extension. The file is mapped and decoded once; each region is
+ * copied into a buffer of its own so it stops exactly at its end. Returns
+ * a JSON object of the regions' handles.
+ */
+string LowLatencyAudio_JS::preloadSprite(QString id, QString assetPath, double volume, int voices, QString regionsPath) {
+    m_idleMonitor.touch();
+    if (!openDevice())
+        return "preloadSprite failed: no audio device";
+
+    Json::Value handles(Json::objectValue);
+    QString prefix = id + QString(":");
+
+    if (!m_sprites.contains(id)) {
+        QString filePath = resolveAssetPath(assetPath);
+
+        // Decoded as 16 bit PCM in plugin memory, whatever the source format.
+        MixerClip sheet;
+        ALuint unused;
+        SampleLoop loop;
+        AssetLoadStats stats;
+        vector<SpriteRegion> regions;
+        if (!decodeAudio(filePath, unused, &sheet, loop, stats, &regions))
+            return "preloadSprite failed: " + id.toStdString();
+
+        // An explicit sidecar takes precedence over cue points.
+        if (!regionsPath.isEmpty() || regions.empty()) {
+            if (regionsPath.isEmpty()) {
+                int extension = assetPath.lastIndexOf('.');
+                regionsPath = (extension < 0 ? assetPath : assetPath.left(extension)) + QString(".json");
+            }
+            if (!readSpriteRegions(resolveAssetPath(regionsPath), sheet.rate(), regions))
+                return "preloadSprite failed: no regions for " + id.toStdString();
+        }
+
+        int channels = sheet.channels();
+        ALenum format = channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16;
+        SampleLoop none = { 0, 0, 0, 0 };
+        AssetLoadStats shared = { 0, 0, 0, 0, { false, 0, 0, 0 } };
+        QList<QString> regionIds;
+
+        for (size_t i = 0; i < regions.size(); i++) {
+            const SpriteRegion& region = regions[i];
+            int end = region.end < sheet.frames() ? region.end : sheet.frames();
+            QString regionId = prefix + QString::fromStdString(region.name);
+            if (region.start < 0 || region.start >= end || m_bufferPaths.contains(regionId))
+                continue;
+
+            const short* samples = sheet.samples() + region.start * channels;
+            long frames = end - region.start;
+            AssetLoadStats regionStats = shared;
+            trimSilence(samples, frames, channels, sheet.rate(), frames, 0, &regionStats);
+
+            // The sheet decodes unmeasured; each region is measured once, as
+            // it is cut.
+            LoudnessMeter meter(sheet.rate(), channels);
+            meter.add(samples, frames);
+            regionStats.loudness = meter.result();
+            size_t size = frames * channels * sizeof(short);
+            ALuint buffer = 0;
+            MixerClip* clip = 0;
+            if (m_softwareMixing) {
+                clip = createClip();
+                clip->assign(samples, size, channels, 16, sheet.rate());
+            } else {
+                alGenBuffers(1, &buffer);
+                alBufferData(buffer, format, samples, size, sheet.rate());
+                ALenum error = alGetError();
+                if (error != AL_NO_ERROR) {
+                    reportOpenALError(error);
+                    alDeleteBuffers(1, &buffer);
+                    continue;
+                }
+            }
+
+            // Keyed apart from other loads of the file, which get all of it.
+            adoptBuffer(regionId, filePath + QString("#") + QString::fromStdString(region.name),
+                        buffer, clip, none, regionStats, false);
+            createAsset(regionId, volume, voices, 0);
+            regionIds.append(regionId);
+        }
+
+        if (regionIds.isEmpty())
+            return "preloadSprite failed: no regions for " + id.toStdString();
+
+        m_sprites.insert(id, regionIds);
+        m_loadStats[id] = stats;
+    }
+
+    const QList<QString>& regionIds = m_sprites[id];
+    for (int i = 0; i < regionIds.size(); ++i) {
+        int slot = m_assetSlots.value(regionIds.at(i), -1);
+        if (slot >= 0)
+            handles[regionIds.at(i).mid(prefix.length()).toStdString()] = m_assets[slot]->handle;
+    }
+
+    return toJson(handles);
 }
 
 string LowLatencyAudio_JS::unload(QString id) {
-    isUsed = true;
+    m_idleMonitor.touch();
+
+    // A sprite goes with all of its regions.
+    if (m_sprites.contains(id)) {
+        QList<QString> regionIds = m_sprites.take(id);
+        for (int i = 0; i < regionIds.size(); ++i)
+            unload(regionIds.at(i));
+        m_loadStats.remove(id);
+        return "Unloading " + id.toStdString();
+    }
+
+    // Streams are self contained; deleting one releases its source.
+    if (m_streams.contains(id)) {
+        delete m_streams.take(id);
+        releaseStreamSource();
+        m_loadStats.remove(id);
+        return "Unloading " + id.toStdString();
+    }
+
+    // Stop all sources before unloading.
+    stop(id);
+
+    // Pool sources outlive the asset; detach its buffer from every one still
+    // holding it so the buffer can be deleted.
+    if (m_assetSlots.contains(id)) {
+        int slot = m_assetSlots.take(id);
+        vector<ALuint> sources;
+        m_voicePool.detachOwner(slot, sources);
+        for (size_t i = 0; i < sources.size(); ++i)
+            alSourcei(sources[i], AL_BUFFER, 0);
+
+        if (!m_assets[slot]->clip)
+            m_requestedVoices -= m_assets[slot]->voices;
+        delete m_assets[slot];
+        m_assets[slot] = 0;
+    }
+
+    // Delete the buffer once no other id shares it. The device stays open
+    // for the other assets and the next preload.
+    releaseBuffer(id);
+    m_loadStats.remove(id);
+
+    return "Unloading " + id.toStdString();
+}
+
+// Function to report how long an asset took to load and how much was mapped.
+string LowLatencyAudio_JS::getLoadStats(QString id){
+    if (!m_loadStats.contains(id))
+        return "Could not find the file " + id.toStdString() + " . Maybe it hasn't been loaded.";
+
+    const AssetLoadStats& stats = m_loadStats[id];
+
+    ostringstream result;
+    result << id.toStdString() << " loaded in " << stats.loadTime << " ms, "
+           << stats.bytesMapped << " bytes mapped";
+
+    int slot = m_assetSlots.value(id, -1);
+    if (slot >= 0 && m_assets[slot]->loop.end)
+        result << ", sustain loop frames " << m_assets[slot]->loop.start << " to " << m_assets[slot]->loop.end;
+
+    // Trimmed leading silence is taken straight off the time to first sound.
+    if (stats.trimmedLeading || stats.trimmedTrailing)
+        result << ", analysis " << stats.trimmedLeading << " ms of leading and "
+               << stats.trimmedTrailing << " ms of trailing silence";
+
+    QHash<QString, SharedBuffer>::const_iterator shared = m_sharedBuffers.constFind(m_bufferPaths.value(id));
+    if (shared != m_sharedBuffers.constEnd()) {
+        result << ", " << shared.value().bytes << " bytes decoded";
+        if (shared.value().evicted)
+            result << " (evicted)";
+        if (m_pinnedIds.contains(id))
+            result << ", pinned";
+    }
+    return result.str();
+}
+
+// Function to enable the decoded PCM cache. A size limit of 0 turns it off;
+// the directory defaults to the application's data folder.
+string LowLatencyAudio_JS::setPcmCache(size_t limit, QString directory){
+    if (directory.isEmpty()) {
+        char cwd[PATH_MAX];
+        getcwd(cwd, PATH_MAX);
+        directory = QString(cwd).append("/data/pcmcache");
+    }
+
+    if (!m_pcmCache.configure(directory.toStdString(), limit))
+        return "Could not enable the PCM cache in " + directory.toStdString();
+
+    return limit ? "PCM cache enabled in " + directory.toStdString() : "PCM cache disabled";
+}
+
+string LowLatencyAudio_JS::getPcmCacheStats(){
+    return m_pcmCache.stats();
+}
+
+// Function to report how long commands waited in the queue before the audio
+// control thread ran them.
+string LowLatencyAudio_JS::getCommandStats(){
+    ostringstream result;
+    result << "commands " << m_commandCount << ", enqueue to execute last "
+           << m_lastCommandLatency * 1000 << " us, mean "
+           << (m_commandCount ? m_commandLatency * 1000 / m_commandCount : 0) << " us, max "
+           << m_maxCommandLatency * 1000 << " us, waits for a full queue " << m_commandWaits;
+    return result.str();
+}
+
+// Time the first sound started after the device opened, from the play
+// call to alSourcePlay returning.
+void LowLatencyAudio_JS::recordFirstTrigger(double startTime) {
+    if (m_firstTriggerMs >= 0)
+        return;
+
+    double now = monotonicMs();
+    m_firstTriggerMs = now - startTime;
+    m_firstTriggerDelay = startTime - m_deviceOpenedAt;
+}
+
+// Function to report how long opening the device took and how long the
+// first trigger after that waited.
+string LowLatencyAudio_JS::getDeviceStats(){
+    ostringstream result;
+    result << AudioDevice::stats();
+    if (m_firstTriggerMs < 0)
+        result << ", no trigger since open";
+    else
+        result << ", first trigger " << m_firstTriggerMs << " ms, "
+               << m_firstTriggerDelay << " ms after open";
+    return result.str();
+}
+
+// Function to release the audio device. Every asset is unloaded; the next
+// preload opens the device again.
+string LowLatencyAudio_JS::shutdown(){
+    m_idleMonitor.touch();
+    closeDevice();
+    return "Audio device released";
+}
+
+// Function to report how long the device spent suspended while idle and
+// how long triggers waited for it to resume.
+string LowLatencyAudio_JS::getIdleStats(){
+    return m_idleMonitor.stats();
+}
+
+// Function to report how the shared voice pool is being used, and how often
+// a trigger had to cut another sound short.
+string LowLatencyAudio_JS::getVoiceStats(){
+    ostringstream result;
+    result << "voices " << m_voicePool.count() << " of " << m_voicePool.capacity()
+           << ", busy " << m_voicePool.busyVoices() << ", triggers " << m_voicePool.leases()
+           << ", steals " << m_voicePool.steals() << " (" << m_voicePool.ownSteals()
+           << " from the asset's own voices), denied " << m_voicePool.denied();
+    if (m_mixer)
+        result << "; software mixer voices " << m_mixer->activeVoices() << " of "
+               << SOFTWARE_MIXER_MAX_VOICES << ", steals " << m_mixer->steals();
+    return result.str();
+}
+
+/**
+ * Function to choose how assets loaded from now on are played: "openal"
+ * gives every voice its own OpenAL source, "software" mixes all of them in
+ * the plugin onto one streaming source, so polyphony is no longer bounded
+ * by the device's source count. Streams are unaffected. Only allowed while
+ * nothing is loaded.
+ */
+string LowLatencyAudio_JS::setEngineMode(QString mode){
+    bool software;
+    if (mode == "software")
+        software = true;
+    else if (mode == "openal")
+        software = false;
+    else
+        return "Unknown engine mode: " + mode.toStdString() + ". Available: openal, software";
+
+    if (software == m_softwareMixing)
+        return "Engine mode " + mode.toStdString();
+
+    if (!m_bufferPaths.isEmpty())
+        return "Engine mode can only change while nothing is loaded";
+
+    m_softwareMixing = software;
+    if (!software) {
+        delete m_mixer;
+        m_mixer = 0;
+    } else if (m_deviceRetained) {
+        openMixer();
+    }
+    return "Engine mode " + mode.toStdString();
+}
+
+// Function to resample assets loaded from now on to the device's output rate,
+// at quality off, fast, medium or best. Loaded assets keep their rate.
+string LowLatencyAudio_JS::setResampling(QString quality){
+    ResampleQuality parsed;
+    if (!Resampler::parseQuality(quality.toStdString().c_str(), parsed))
+        return "Unknown resampling quality: " + quality.toStdString() + ". Available: off, fast, medium, best";
+
+    m_resampleQuality = parsed;
+    if (parsed == RESAMPLE_OFF)
+        return "Resampling off";
+
+    ostringstream result;
+    result << "Resampling " << Resampler::qualityName(parsed) << " with " << Resampler::kernelName()
+           << " kernels to ";
+    if (m_outputRate)
+        result << m_outputRate << " Hz";
+    else
+        result << "the output rate once the device opens";
+    return result.str();
+}
+
+// Function to choose how the software mixer keeps assets loaded from now on:
+// as 16 bit PCM, or as IMA ADPCM at a quarter of the size, expanded by each
+// voice as it plays. OpenAL buffers always hold PCM.
+string LowLatencyAudio_JS::setSampleStorage(QString storage){
+    if (storage == "adpcm")
+        m_adpcmStorage = true;
+    else if (storage == "pcm")
+        m_adpcmStorage = false;
+    else
+        return "Unknown sample storage: " + storage.toStdString() + ". Available: pcm, adpcm";
+
+    if (m_adpcmStorage && !m_softwareMixing)
+        return "Sample storage adpcm, used once the engine mode is software";
+    return "Sample storage " + storage.toStdString();
+}
+
+// Function to trim silence from the start and end of assets loaded from now
+// on: "off", or a threshold in dB below full scale at or under which samples
+// count as silent, "-inf" for digital silence only. Loop and cue regions are
+// never cut into.
+string LowLatencyAudio_JS::setSilenceTrim(QString threshold){
+    if (threshold == "off") {
+        m_trimSilence = false;
+        return "Silence trimming off";
+    }
+
+    bool ok = threshold == "-inf";
+    double db = ok ? -HUGE_VAL : threshold.toDouble(&ok);
+    if (!ok || db > 0)
+        return "Invalid silence threshold: " + threshold.toStdString() + ". Use off, -inf or dB at most 0";
+
+    m_trimThreshold = SampleAnalysis::thresholdFromDb(db);
+    m_trimSilence = true;
+
+    ostringstream result;
+    result << "Silence trimming at " << threshold.toStdString() << " dBFS (samples up to "
+           << m_trimThreshold << ") with " << SampleAnalysis::kernelName() << " kernels";
+    return result.str();
+}
+
+// Function to give assets created from now on the gain that brings their
+// integrated loudness to a target in LUFS, or "off". The gain never lifts
+// an asset's peak past full scale, nor goes over LOUDNESS_MAX_GAIN; assets
+// that were not measured keep unity gain.
+string LowLatencyAudio_JS::setLoudnessTarget(QString target){
+    if (target == "off") {
+        m_normalize = false;
+        return "Loudness target off";
+    }
+
+    bool ok;
+    double lufs = target.toDouble(&ok);
+    if (!ok || lufs > 0 || lufs < -70)
+        return "Invalid loudness target: " + target.toStdString() + ". Use off or LUFS from -70 to 0";
+
+    m_loudnessTarget = lufs;
+    m_normalize = true;
+
+    ostringstream result;
+    result << "Loudness target " << lufs << " LUFS";
+    return result.str();
+}
+
+// Gain applied to an asset by the loudness target, if any.
+float LowLatencyAudio_JS::normalizationGain(const Loudness& loudness) const {
+    if (!m_normalize || !loudness.measured || loudness.integrated == -HUGE_VAL)
+        return 1.0f;
+
+    double gain = m_loudnessTarget - loudness.integrated;
+    if (gain > -loudness.peak)
+        gain = -loudness.peak;
+    double linear = pow(10.0, gain / 20.0);
+    return (float)(linear < LOUDNESS_MAX_GAIN ? linear : LOUDNESS_MAX_GAIN);
+}
+
+// Function to report an asset's measured level and the gain the loudness
+// target gave it, as JSON. Silent levels are null.
+string LowLatencyAudio_JS::getLoudness(QString id){
+    QHash<QString, SharedBuffer>::const_iterator shared = m_sharedBuffers.constFind(m_bufferPaths.value(id));
+    if (shared == m_sharedBuffers.constEnd())
+        return "Could not find the file " + id.toStdString() + " . Maybe it hasn't been loaded.";
+
+    const Loudness& loudness = shared.value().loudness;
+    if (!loudness.measured)
+        return "No loudness measured for " + id.toStdString();
+
+    Json::Value result(Json::objectValue);
+    result["peak"] = loudness.peak == -HUGE_VAL ? Json::Value() : Json::Value(loudness.peak);
+    result["rms"] = loudness.rms == -HUGE_VAL ? Json::Value() : Json::Value(loudness.rms);
+    result["lufs"] = loudness.integrated == -HUGE_VAL ? Json::Value() : Json::Value(loudness.integrated);
+    int slot = m_assetSlots.value(id, -1);
+    double gain = slot >= 0 ? m_assets[slot]->normalization : 1.0;
+    result["gain"] = 20.0 * log10(gain);
+    return toJson(result);
+}
+
+// Function to cap the decoded PCM kept in memory, in bytes; 0 removes the
+// cap. Idle assets over it are evicted and decoded again when triggered.
+string LowLatencyAudio_JS::setMemoryBudget(size_t bytes){
+    m_memoryBudget = bytes;
+    enforceBudget(QString());
+
+    ostringstream result;
+    if (bytes)
+        result << "Memory budget " << bytes << " bytes, " << m_residentBytes << " resident";
+    else
+        result << "Memory budget off";
+    return result.str();
+}
+
+// Function to keep an asset in memory whatever the budget, or let it be
+// evicted again. Pinning an evicted asset decodes it now.
+string LowLatencyAudio_JS::setPinned(QString id, bool pinned){
+    int slot = m_assetSlots.value(id, -1);
+    if (slot < 0)
+        return "Could not find the file " + id.toStdString() + " . Maybe it hasn't been loaded.";
+
+    SharedBuffer& shared = m_sharedBuffers[m_bufferPaths.value(id)];
+    if (pinned && !m_pinnedIds.contains(id)) {
+        m_pinnedIds.insert(id);
+        shared.pins++;
+        if (!ensureResident(slot))
+            return "Could not decode " + id.toStdString() + " again";
+    } else if (!pinned && m_pinnedIds.remove(id)) {
+        shared.pins--;
+        enforceBudget(QString());
+    }
+    return (pinned ? "Pinned " : "Unpinned ") + id.toStdString();
+}
+
+// Function to report resident decoded PCM against the budget, and how often
+// and how slowly evicted assets were decoded again.
+string LowLatencyAudio_JS::getMemoryStats(){
+    int resident = 0, evicted = 0;
+    for (QHash<QString, SharedBuffer>::const_iterator it = m_sharedBuffers.constBegin(); it != m_sharedBuffers.constEnd(); ++it) {
+        if (it.value().evicted)
+            evicted++;
+        else
+            resident++;
+    }
+
+    ostringstream result;
+    result << "resident " << m_residentBytes << " bytes of ";
+    if (m_memoryBudget)
+        result << m_memoryBudget;
+    else
+        result << "unlimited";
+    result << ", buffers resident " << resident << ", evicted " << evicted << ", pinned ids "
+           << m_pinnedIds.size() << ", evictions " << m_evictions << ", re-decodes " << m_redecodes
+           << ", re-decode last " << m_redecodeLast << " ms, mean "
+           << (m_redecodes ? m_redecodeTotal / m_redecodes : 0) << " ms, max " << m_redecodeMax << " ms";
+    return result.str();
+}
+
+// Function to stop playing sounds. Takes in sound file name.
+string LowLatencyAudio_JS::stop(QString id){
+    if (m_streams.contains(id)) {
+        m_idleMonitor.touch();
+        m_streams[id]->stop();
+        return "Stopped " + id.toStdString();
+    }
 
-    // Stop all sources before unloading.
-    stop(id);
+    int slot = m_assetSlots.value(id, -1);
+    if (slot >= 0)
+        stopSlot(slot);
+    else
+        m_idleMonitor.touch();
 
-    // Get corresponding buffers, voices and sources from the unique file name.
-    ALuint bufferID = m_audioBuffers[id];
+    // Stopped playing source.
+    return "Stopped " + id.toStdString();
+}
 
-    // Loop to make sure every source is deleted in case it had multiple voices.
-    QList<ALuint> sources = m_soundSources.values(id);
-    for (int i = 0; i < sources.size(); ++i)
-        alDeleteSources(1, &sources.at(i));
+// Function to play single sound. Takes in one parameter, the sound file name.
+string LowLatencyAudio_JS::play(QString id){
+    // Streams have a single voice; playing restarts them.
+    if (m_streams.contains(id)) {
+        double startTime = m_firstTriggerMs < 0 ? monotonicMs() : 0;
+        m_idleMonitor.touch();
+        m_streams[id]->play();
+        recordFirstTrigger(startTime);
+        return "Playing " + id.toStdString();
+    }
 
-    sources = m_assetSources.values(id);
-    for (int i = 0; i < sources.size(); ++i)
-        alDeleteSources(1, &sources.at(i));
+    // Check to see if it has been preloaded.
+    int slot = m_assetSlots.value(id, -1);
+    if (slot < 0)
+        return "Could not find the file " + id.toStdString() + " . Maybe it hasn't been loaded.";
 
-    // Delete sources and buffers.
-    alDeleteBuffers(1, &bufferID);
-    m_soundSources.remove(id);
-    m_assetSources.remove(id);
+    TriggerResult result = playSlot(slot);
+    if (result == TRIGGER_DENIED)
+        return "No voice available for " + id.toStdString() + "; every voice is playing a higher priority sound";
+    if (result == TRIGGER_STOLE)
+        return "Every single voice is currently being played, now overwriting previous ones";
+    return "Playing " + id.toStdString();
+}
 
-    // Re-initialize the buffers.
-    m_audioBuffers[id] = 0;
+// Function to loop sound.
+string LowLatencyAudio_JS::loop(QString id){
+    if (m_streams.contains(id)) {
+        m_idleMonitor.touch();
+        m_streams[id]->loop();
+        return "Looping " + id.toStdString();
+    }
 
-    alutExit();
+    // If sound file has been preloaded loop sound
+    int slot = m_assetSlots.value(id, -1);
+    if (slot < 0)
+        return "Could not find the file " + id.toStdString() + " . Maybe it hasn't been loaded.";
 
-    return "Unloading " + id.toStdString();
+    TriggerResult result = loopSlot(slot);
+    if (result == TRIGGER_DENIED)
+        return "No voice available for " + id.toStdString() + "; every voice is playing a higher priority sound";
+    if (result == TRIGGER_ALREADY_PLAYING)
+        return id.toStdString() + " is already playing";
+    return "Looping " + id.toStdString();
 }
 
-// Function to stop playing sounds. Takes in sound file name.
-string LowLatencyAudio_JS::stop(QString id){
-    isUsed = true;
+// Handle variants of play, stop and loop, for ids returned by preload. The
+// handle already names the slot, so the id is only used in the reply.
+string LowLatencyAudio_JS::playHandle(int handle){
+    int slot = resolveHandle(handle);
+    if (slot < 0)
+        return "Could not find the handle. Maybe it hasn't been loaded.";
+
+    TriggerResult result = playSlot(slot);
+    if (result == TRIGGER_DENIED)
+        return "No voice available for " + m_assets[slot]->id.toStdString() + "; every voice is playing a higher priority sound";
+    if (result == TRIGGER_STOLE)
+        return "Every single voice is currently being played, now overwriting previous ones";
+    return "Playing " + m_assets[slot]->id.toStdString();
+}
 
-    // Loop and stop every sound with corresponding fileName.
-    QList<ALuint> sources = m_soundSources.values(id);
-    for (int i = 0; i < sources.size(); ++i)
-        alSourceStop(sources.at(i));
+string LowLatencyAudio_JS::stopHandle(int handle){
+    int slot = resolveHandle(handle);
+    if (slot < 0)
+        return "Could not find the handle. Maybe it hasn't been loaded.";
 
-    sources = m_assetSources.values(id);
-    for (int i = 0; i < sources.size(); ++i)
-        alSourceStop(sources.at(i));
+    stopSlot(slot);
+    return "Stopped " + m_assets[slot]->id.toStdString();
+}
 
-    // Stopped playing source.
-    return "Stopped " + id.toStdString();
+string LowLatencyAudio_JS::loopHandle(int handle){
+    int slot = resolveHandle(handle);
+    if (slot < 0)
+        return "Could not find the handle. Maybe it hasn't been loaded.";
+
+    TriggerResult result = loopSlot(slot);
+    if (result == TRIGGER_DENIED)
+        return "No voice available for " + m_assets[slot]->id.toStdString() + "; every voice is playing a higher priority sound";
+    if (result == TRIGGER_ALREADY_PLAYING)
+        return m_assets[slot]->id.toStdString() + " is already playing";
+    return "Looping " + m_assets[slot]->id.toStdString();
 }
 
-// Function to play single sound. Takes in one parameter, the sound file name.
-string LowLatencyAudio_JS::play(QString id){
-    isUsed = true;
+TriggerResult LowLatencyAudio_JS::playSlot(int slot, vector<ALuint>* deferred) {
+    // Only the first trigger after the device opens is timed.
+    double startTime = m_firstTriggerMs < 0 ? monotonicMs() : 0;
 
-    float currentTime = 0, furthestTime = 0;
-    ALuint replayingSource = 0;
+    m_idleMonitor.touch();
 
-    // Get corresponding buffer from the unique file name.
-    ALuint bufferID = m_audioBuffers[id];
+    // An asset evicted for the memory budget is decoded again first.
+    if (!ensureResident(slot))
+        return TRIGGER_DENIED;
 
-    // Check to see if it has been preloaded.
-    if (!bufferID)
-        return "Could not find the file " + id.toStdString() + " . Maybe it hasn't been loaded.";
+    // Mixed assets start within the next block, so batches need no deferral.
+    AudioAsset* asset = m_assets[slot];
+    if (asset->clip) {
+        bool stolen;
+        if (!m_mixer || !m_mixer->play(slot, asset->clip, asset->volume, false, asset->voices, 0, stolen))
+            return TRIGGER_DENIED;
+        recordFirstTrigger(startTime);
+        return stolen ? TRIGGER_STOLE : TRIGGER_PLAYING;
+    }
+
+    // Take an idle pool voice, or steal one by priority and age, from the
+    // engine's own bookkeeping rather than by polling every source.
+    bool stolen;
+    int index = acquireVoice(slot, deviceTime(), stolen);
+    if (index < 0)
+        return TRIGGER_DENIED;
+
+    // Batched plays are started together by the caller.
+    if (deferred)
+        deferred->push_back(m_voicePool.voice(index).source);
+    else
+        alSourcePlay(m_voicePool.voice(index).source);
+    recordFirstTrigger(startTime);
+
+    return stolen ? TRIGGER_STOLE : TRIGGER_PLAYING;
+}
+
+TriggerResult LowLatencyAudio_JS::loopSlot(int slot) {
+    m_idleMonitor.touch();
+    if (!ensureResident(slot))
+        return TRIGGER_DENIED;
+
+    AudioAsset* asset = m_assets[slot];
+    if (asset->clip) {
+        bool stolen;
+        if (!m_mixer)
+            return TRIGGER_DENIED;
+        if (m_mixer->loopNewest(slot))
+            return TRIGGER_ALREADY_PLAYING;
+        if (!m_mixer->play(slot, asset->clip, asset->volume, true, asset->voices, 0, stolen))
+            return TRIGGER_DENIED;
+        return stolen ? TRIGGER_STOLE : TRIGGER_PLAYING;
+    }
+
+    // Check to see if the sound is already playing or not; if it is, keep
+    // its newest voice going instead of starting another. A voice playing
+    // a whole buffer cannot switch to a queued sustain loop midway.
+    double now = deviceTime();
+    int index = m_voicePool.newestVoice(slot);
+    if (index >= 0 && m_voicePool.isPlaying(index, now)
+            && (!asset->loop.sustain || m_voicePool.voice(index).looping)) {
+        // A queued loop may still be in its attack; leave it to the handoff.
+        if (!m_voicePool.voice(index).looping) {
+            alSourcei(m_voicePool.voice(index).source, AL_LOOPING, AL_TRUE);
+            m_voicePool.setLooping(index, true);
+        }
+        return TRIGGER_ALREADY_PLAYING;
+    }
 
-    // Iterate through a list of sources associated with with the file and play the sound if it is not currently playing
-    QList<ALuint> sources;
-    if (m_soundSources[id]) {
-        sources = m_soundSources.values(id);
+    bool stolen;
+    index = acquireVoice(slot, now, stolen);
+    if (index < 0)
+        return TRIGGER_DENIED;
+
+    // Loop the source. With loop points in the buffer, OpenAL plays up to
+    // the loop end once and then repeats the region.
+    ALuint source = m_voicePool.voice(index).source;
+    const SampleLoop& loop = asset->loop;
+    if (loop.sustain) {
+        alSourcei(source, AL_BUFFER, 0);
+        if (loop.attack) {
+            // The queue loops as a whole, so looping waits for the attack
+            // to be unqueued.
+            ALuint queue[2] = { loop.attack, loop.sustain };
+            alSourceQueueBuffers(source, 2, queue);
+            bool pending = false;
+            for (size_t i = 0; i < m_loopHandoffs.size(); ++i)
+                pending = pending || m_loopHandoffs[i] == source;
+            if (!pending)
+                m_loopHandoffs.push_back(source);
+        } else {
+            alSourceQueueBuffers(source, 1, &loop.sustain);
+            alSourcei(source, AL_LOOPING, AL_TRUE);
+        }
     } else {
-        sources = m_assetSources.values(id);
+        alSourcei(source, AL_LOOPING, AL_TRUE);
     }
+    m_voicePool.setLooping(index, true);
+    alSourcePlay(source);
+    return stolen ? TRIGGER_STOLE : TRIGGER_PLAYING;
+}
 
-    for (int i = 0; i < sources.size(); ++i) {
-        ALenum state;
-        alGetSourcef(sources.at(i), AL_SEC_OFFSET, &currentTime);
-        alGetSourcei(sources.at(i), AL_SOURCE_STATE, &state);
-        if (state != AL_PLAYING) {
-            alSourcePlay(sources.at(i));
-            return "Playing " + id.toStdString();
+void LowLatencyAudio_JS::serviceLoopHandoffs() {
+    for (size_t i = m_loopHandoffs.size(); i-- > 0;) {
+        ALuint source = m_loopHandoffs[i];
+        ALint state, queued, processed;
+        alGetSourcei(source, AL_SOURCE_STATE, &state);
+        alGetSourcei(source, AL_BUFFERS_QUEUED, &queued);
+        alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
+
+        // Stopped, or reused for something else since.
+        bool done = state != AL_PLAYING || queued != 2;
+        if (!done && processed > 0) {
+            ALuint attack;
+            alSourceUnqueueBuffers(source, 1, &attack);
+            alSourcei(source, AL_LOOPING, AL_TRUE);
+            done = true;
         }
-        if (currentTime > furthestTime) {
-            furthestTime = currentTime;
-            replayingSource = sources.at(i);
+
+        if (done) {
+            m_loopHandoffs[i] = m_loopHandoffs.back();
+            m_loopHandoffs.pop_back();
         }
     }
+}
+
+void LowLatencyAudio_JS::stopSlot(int slot) {
+    m_idleMonitor.touch();
+
+    if (m_assets[slot]->clip) {
+        if (m_mixer)
+            m_mixer->stopOwner(slot);
+        return;
+    }
 
-    // Continue cycling through and overwrite the sources if all sources are currently being used
-    alSourcePlay(replayingSource);
-    return "Every single voice is currently being played, now overwriting previous ones";
+    // Stop every voice the asset holds in one call.
+    m_stopSources.clear();
+    for (int index; (index = m_voicePool.newestVoice(slot)) >= 0;) {
+        const Voice& voice = m_voicePool.voice(index);
+        if (voice.looping)
+            alSourcei(voice.source, AL_LOOPING, AL_FALSE);
+        m_stopSources.push_back(voice.source);
+        m_voicePool.release(index);
+    }
+    if (!m_stopSources.empty())
+        alSourceStopv(m_stopSources.size(), &m_stopSources[0]);
 }
 
-// Function to loop sound.
-string LowLatencyAudio_JS::loop(QString id){
-    isUsed = true;
+void LowLatencyAudio_JS::setSlotVolume(int slot, float volume) {
+    // Idle sources keep the buffer bound and are reused without rebinding,
+    // so they need the new gain as much as the playing ones. The loudness
+    // target gain stays applied.
+    volume *= m_assets[slot]->normalization;
+    m_assets[slot]->volume = volume;
+    if (m_assets[slot]->clip) {
+        if (m_mixer)
+            m_mixer->setOwnerGain(slot, volume);
+        return;
+    }
 
-    // Get corresponding buffers and sources from the unique file name.
-    ALuint bufferID = m_audioBuffers[id];
+    m_stopSources.clear();
+    m_voicePool.attachedSources(slot, m_stopSources);
+    for (size_t i = 0; i < m_stopSources.size(); ++i)
+        alSourcef(m_stopSources[i], AL_GAIN, volume);
+}
 
-    // If sound file has been preloaded loop sound
-    if (!bufferID)
-        return "Could not find the file " + id.toStdString() + " . Maybe it hasn't been loaded.";
+// Point record at an id, or at a handle written as '#' and a number. Ids
+// that would not fit AUDIO_COMMAND_ID_SIZE are refused rather than cut.
+static bool setCommandTarget(AudioCommand& record, const string& target) {
+    if (target.empty() || target.size() >= AUDIO_COMMAND_ID_SIZE)
+        return false;
 
-    // Get the source from which the sound will be played.
-    QList<ALuint> sources;
-    if (m_soundSources[id]) {
-        sources = m_soundSources.values(id);
+    if (target[0] == '#') {
+        record.handle = atoi(target.c_str() + 1);
+        record.id[0] = 0;
     } else {
-        sources = m_assetSources.values(id);
+        record.handle = -1;
+        memcpy(record.id, target.c_str(), target.size() + 1);
     }
+    return true;
+}
 
-    ALuint source;
-    source = sources.at(sources.size() - 1);
+/**
+ * Queue a list of operations for the control thread in a single bridge
+ * crossing. Operations are separated by ';' and take the form
+ * "play <target>", "loop <target>", "stop <target>" or
+ * "volume <target> <gain>", where the target is an id or '#' and a handle.
+ * They run in order; consecutive plays start together with alSourcePlayv.
+ * Returns the number of operations queued out of those given, followed by
+ * the first one that could not be parsed, if any.
+ */
+string LowLatencyAudio_JS::batch(const string& operations) {
+    AudioCommand pending;
+    bool havePending = false;
+    int count = 0, queued = 0;
+    string rejected;
+
+    size_t start = 0;
+    while (start < operations.size()) {
+        size_t end = operations.find(';', start);
+        if (end == string::npos)
+            end = operations.size();
+
+        size_t length = end - start;
+        start = end + 1;
+        if (length == 0)
+            continue;
+        count++;
+
+        istringstream fields(operations.substr(end - length, length));
+        string name, target;
+        float value = 0;
+        fields >> name >> target;
+        bool valued = !fields.fail() && !(fields >> value).fail();
+
+        AudioCommand record;
+        record.type = -1;
+        record.call = 0;
+        record.value = value;
+        record.batched = true;
+        record.endOfBatch = false;
+        if (setCommandTarget(record, target)) {
+            if (name == "play")
+                record.type = AUDIO_COMMAND_PLAY;
+            else if (name == "loop")
+                record.type = AUDIO_COMMAND_LOOP;
+            else if (name == "stop")
+                record.type = AUDIO_COMMAND_STOP;
+            else if (name == "volume" && valued)
+                record.type = AUDIO_COMMAND_VOLUME;
+        }
 
-    if (alIsSource(source) == AL_TRUE) {
-        // Loop the source.
-        alSourcei(source, AL_LOOPING, AL_TRUE);
+        if (record.type < 0) {
+            if (rejected.empty())
+                rejected = operations.substr(end - length, length);
+            continue;
+        }
 
-        // Check to see if the sound is already looping or not, if not, loop sound.
-        ALenum state;
-        alGetSourcei(source, AL_SOURCE_STATE, &state);
-        if (state != AL_PLAYING) {
-            alSourcePlay(source);
-            return "Looping " + id.toStdString();
+        // Hold each operation back until the next one is parsed, so the
+        // last can be marked as the end of the batch.
+        if (havePending) {
+            if (m_controlStarted)
+                enqueueCommand(pending);
+            else
+                executeBatchOperation(pending);
         }
-        return id.toStdString() + " is already playing";
+        pending = record;
+        havePending = true;
+        queued++;
+    }
+
+    if (havePending) {
+        pending.endOfBatch = true;
+        if (m_controlStarted)
+            enqueueCommand(pending);
+        else
+            executeBatchOperation(pending);
+    }
+
+    ostringstream result;
+    result << queued << "/" << count;
+    if (!rejected.empty())
+        result << " rejected: " << rejected;
+    return result.str();
+}
+
+void LowLatencyAudio_JS::executeBatchOperation(const AudioCommand& operation) {
+    // Anything but a play runs after the plays queued before it have started.
+    if (operation.type != AUDIO_COMMAND_PLAY)
+        flushBatchPlays();
+
+    int slot = -1;
+    OggStream* stream = 0;
+    if (operation.handle >= 0) {
+        slot = resolveHandle(operation.handle);
+    } else {
+        QString id = QString::fromAscii(operation.id);
+        stream = m_streams.value(id);
+        if (!stream)
+            slot = m_assetSlots.value(id, -1);
+    }
+
+    if (stream) {
+        m_idleMonitor.touch();
+        if (operation.type == AUDIO_COMMAND_PLAY)
+            stream->play();
+        else if (operation.type == AUDIO_COMMAND_LOOP)
+            stream->loop();
+        else if (operation.type == AUDIO_COMMAND_STOP)
+            stream->stop();
+        else
+            stream->setVolume(operation.value);
+    } else if (slot < 0) {
+        qDebug() << "Batch target " << (operation.handle >= 0 ? "#" : operation.id)
+                 << operation.handle << " has not been loaded";
+    } else if (operation.type == AUDIO_COMMAND_PLAY) {
+        if (playSlot(slot, &m_batchPlays) == TRIGGER_DENIED)
+            qDebug() << "No voice available for " << m_assets[slot]->id.toStdString().c_str();
+    } else if (operation.type == AUDIO_COMMAND_LOOP) {
+        loopSlot(slot);
+    } else if (operation.type == AUDIO_COMMAND_STOP) {
+        stopSlot(slot);
+    } else {
+        setSlotVolume(slot, operation.value);
+    }
+
+    if (operation.endOfBatch)
+        flushBatchPlays();
+}
+
+double LowLatencyAudio_JS::deviceTime() const {
+    if (m_offlineRate)
+        return (double)m_renderedFrames / m_offlineRate;
+    return (monotonicMs() - m_deviceOpenedAt) / 1000.0;
+}
+
+// Function to read the device clock that playAt and stopAt are timed against.
+string LowLatencyAudio_JS::now() {
+    char result[32];
+    snprintf(result, sizeof(result), "%.6f", deviceTime());
+    return result;
+}
+
+void LowLatencyAudio_JS::scheduleCommand(const AudioCommand& command) {
+    ScheduledEvent event;
+    event.time = command.time;
+    event.sequence = m_scheduleSequence++;
+    event.type = command.type;
+    event.handle = command.handle;
+
+    // Ids are resolved now; handles are checked again when the event fires.
+    if (event.handle < 0) {
+        QString id = QString::fromAscii(command.id);
+        if (m_streams.contains(id)) {
+            event.streamId = id;
+        } else {
+            int slot = m_assetSlots.value(id, -1);
+            if (slot < 0) {
+                qDebug() << "Could not schedule " << command.id << ". Maybe it hasn't been loaded.";
+                m_dropped++;
+                return;
+            }
+            event.handle = m_assets[slot]->handle;
+        }
+    }
+
+    m_schedule.push(event);
+    m_scheduled++;
+}
+
+void LowLatencyAudio_JS::runSchedule() {
+    while (!m_schedule.empty()) {
+        double now = deviceTime();
+        double due = m_schedule.top().time;
+
+        // Offline time only moves while rendering, which stops on the frame
+        // nearest each event, so anything within half a frame is due now.
+        // Online, the control loop waits out the last moments unlocked.
+        if (m_offlineRate)
+            now += 0.5 / m_offlineRate;
+        if (due > now)
+            break;
+
+        // Everything due by now starts in one alSourcePlayv.
+        while (!m_schedule.empty() && m_schedule.top().time <= now) {
+            ScheduledEvent event = m_schedule.top();
+            m_schedule.pop();
+            fireScheduled(event, now);
+        }
+        flushBatchPlays();
+    }
+}
+
+void LowLatencyAudio_JS::fireScheduled(const ScheduledEvent& event, double now) {
+    if (event.handle < 0) {
+        OggStream* stream = m_streams.value(event.streamId);
+        if (!stream) {
+            m_dropped++;
+            return;
+        }
+        m_idleMonitor.touch();
+        if (event.type == AUDIO_COMMAND_PLAY_AT)
+            stream->play();
+        else
+            stream->stop();
+        m_fired++;
+        return;
+    }
+
+    int slot = resolveHandle(event.handle);
+    if (slot < 0) {
+        m_dropped++;
+        return;
+    }
+
+    if (event.type == AUDIO_COMMAND_STOP_AT) {
+        stopSlot(slot);
+        m_fired++;
+        return;
+    }
+
+    // A late start skips the samples it missed, so the sound stays on the
+    // timeline it was scheduled against.
+    double late = now - event.time;
+    const AudioAsset* asset = m_assets[slot];
+    if (asset->clip) {
+        bool stolen;
+        m_idleMonitor.touch();
+        if (late >= asset->duration || !m_mixer || !ensureResident(slot)
+                || !m_mixer->play(slot, asset->clip, asset->volume, false, asset->voices,
+                                  late > 0 ? (int)(late * asset->clip->rate()) : 0, stolen)) {
+            m_dropped++;
+            return;
+        }
+    } else {
+        size_t queued = m_batchPlays.size();
+        if (playSlot(slot, &m_batchPlays) == TRIGGER_DENIED) {
+            m_dropped++;
+            return;
+        }
+        if (late > 0 && m_batchPlays.size() > queued) {
+            ALint frequency = 0;
+            alGetBufferi(asset->buffer, AL_FREQUENCY, &frequency);
+            if (late < asset->duration)
+                alSourcei(m_batchPlays.back(), AL_SAMPLE_OFFSET, (ALint)(late * frequency));
+            else
+                m_batchPlays.pop_back();
+        }
+    }
+
+    // Lateness as the mixer will see it: when the play call is issued.
+    double error = deviceTime() - event.time;
+    m_fired++;
+    m_lateTotal += error;
+    if (error > m_lateMax)
+        m_lateMax = error;
+    if (error <= m_mixerPeriod)
+        m_firedInPeriod++;
+}
+
+/**
+ * Function to replace the audio device with a loopback device mixing 16 bit
+ * stereo at rate, which renders nothing until renderOffline asks it to; a
+ * rate of 0 goes back to the real device. Like shutdown, this unloads
+ * everything. Offline, the device clock counts rendered frames, so what
+ * playAt schedules lands on exact frames and renders the same every time.
+ */
+string LowLatencyAudio_JS::setOfflineMode(int rate) {
+    if (rate < 0)
+        return "setOfflineMode needs a sample rate, or 0 for the audio device";
+
+    m_idleMonitor.touch();
+    closeDevice();
+    if (!AudioDevice::setLoopback(rate)) {
+        openDevice();
+        return "The audio device is still in use by another object";
+    }
+
+    if (!openDevice()) {
+        AudioDevice::setLoopback(0);
+        openDevice();
+        return "Could not open a loopback device at the given rate";
+    }
+
+    ostringstream result;
+    if (rate)
+        result << "Rendering offline at " << rate << " Hz";
+    else
+        result << "Playing on the audio device";
+    return result.str();
+}
+
+/**
+ * Function to mix the next seconds of audio on the loopback device into a
+ * 16 bit stereo wave file, as fast as the CPU allows. Scheduled events fire
+ * on the frame nearest their time. A relative path is taken from the
+ * application's data folder.
+ */
+string LowLatencyAudio_JS::renderOffline(double seconds, QString path) {
+    if (!m_offlineRate || !m_deviceRetained)
+        return "renderOffline needs setOfflineMode first";
+    if (seconds <= 0 || path.isEmpty())
+        return "renderOffline needs a length in seconds and a file";
+
+    if (!path.startsWith("/")) {
+        char cwd[PATH_MAX];
+        getcwd(cwd, PATH_MAX);
+        path = QString(cwd).append("/data/").append(path);
+    }
+
+    QByteArray pathBytes = path.toLocal8Bit();
+    FILE* file = fopen(pathBytes.constData(), "wb");
+    if (!file)
+        return "Could not write " + path.toStdString();
+
+    // The sizes in the header are filled in once rendering is done.
+    unsigned char header[44];
+    writeWavHeader(header, m_offlineRate, 0);
+    bool written = fwrite(header, sizeof(header), 1, file) == 1;
+
+    long long frames = (long long)(seconds * m_offlineRate);
+    long long rendered = 0;
+    short block[OFFLINE_RENDER_BLOCK_FRAMES * 2];
+    double startTime = monotonicMs();
+
+    while (written && rendered < frames) {
+        runSchedule();
+
+        // Stop at the next event's frame so it starts exactly on it.
+        long long count = frames - rendered;
+        if (count > OFFLINE_RENDER_BLOCK_FRAMES)
+            count = OFFLINE_RENDER_BLOCK_FRAMES;
+        if (!m_schedule.empty()) {
+            long long next = (long long)ceil(m_schedule.top().time * m_offlineRate - 0.5) - m_renderedFrames;
+            if (next > 0 && next < count)
+                count = next;
+        }
+
+        // Stream threads cannot keep up at this speed; feed them in step.
+        serviceLoopHandoffs();
+        if (m_mixer)
+            m_mixer->service();
+        for (QHash<QString, OggStream*>::iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+            it.value()->service();
+
+        AudioDevice::render(block, count);
+        written = fwrite(block, 4, count, file) == (size_t)count;
+        rendered += count;
+        m_renderedFrames += count;
     }
+    runSchedule();
+
+    double elapsed = monotonicMs() - startTime;
+    writeWavHeader(header, m_offlineRate, rendered);
+    if (fseek(file, 0, SEEK_SET) != 0 || fwrite(header, sizeof(header), 1, file) != 1)
+        written = false;
+    if (fclose(file) != 0)
+        written = false;
+
+    if (!written)
+        return "Could not write " + path.toStdString();
+
+    ostringstream result;
+    result << "Rendered " << rendered << " frames to " << path.toStdString() << " in "
+           << elapsed << " ms, " << (elapsed > 0 ? seconds * 1000 / elapsed : 0) << "x realtime";
+    return result.str();
+}
 
-    return "Could not find the file " + id.toStdString() + " . Maybe it hasn't been loaded.";
+// Function to report how closely scheduled plays met their device time.
+string LowLatencyAudio_JS::getScheduleStats() {
+    ostringstream result;
+    result << "scheduled " << m_scheduled << ", pending " << m_schedule.size()
+           << ", fired " << m_fired << ", dropped " << m_dropped
+           << ", late mean " << (m_fired ? m_lateTotal * 1000 / m_fired : 0) << " ms, max "
+           << m_lateMax * 1000 << " ms, within one mixer period ("
+           << m_mixerPeriod * 1000 << " ms) " << m_firedInPeriod << " of " << m_fired;
+    return result.str();
 }
 
+void LowLatencyAudio_JS::flushBatchPlays() {
+    if (m_batchPlays.empty())
+        return;
+
+    alSourcePlayv(m_batchPlays.size(), &m_batchPlays[0]);
+    m_batchPlays.clear();
+}
+
+// A command queued by InvokeMethod whose caller waits for the result.
+struct PendingCall {
+    const string* command;
+    string result;
+    sem_t done;
+};
+
 /**
  * It will be called from JNext JavaScript side with passed string.
  * This method implements the interface for the JavaScript to native binding
@@ -603,6 +2937,263 @@ string LowLatencyAudio_JS::loop(QString id){
  * called on the JavaScript side with this native objects id.
  */
 string LowLatencyAudio_JS::InvokeMethod(const string& command) {
+    if (!m_controlStarted) {
+        // Loader threads register their results under the same lock.
+        pthread_mutex_lock(&m_lock);
+        string result = runCommand(command);
+        pthread_mutex_unlock(&m_lock);
+        return result;
+    }
+
+    // The clock is read here rather than queued, so it is as fresh as possible.
+    // Offline it only moves on the control thread, and is read there. The
+    // fields it is read from change when the device opens, under the lock.
+    if (command == "now") {
+        pthread_mutex_lock(&m_lock);
+        string result = m_offlineRate ? string() : now();
+        pthread_mutex_unlock(&m_lock);
+        if (!result.empty())
+            return result;
+    }
+
+    // Timed triggers: "playAt <target> <seconds>", "stopAt <target> <seconds>".
+    if (command.compare(0, 7, "playAt ") == 0 || command.compare(0, 7, "stopAt ") == 0) {
+        AudioCommand record;
+        istringstream fields(command.substr(7));
+        string target;
+        if ((fields >> target >> record.time).fail() || !setCommandTarget(record, target))
+            return "Usage: " + command.substr(0, 6) + " <id or #handle> <device time>";
+
+        record.type = command[0] == 'p' ? AUDIO_COMMAND_PLAY_AT : AUDIO_COMMAND_STOP_AT;
+        record.call = 0;
+        record.value = 0;
+        record.batched = false;
+        record.endOfBatch = false;
+        enqueueCommand(record);
+        return "Scheduled";
+    }
+
+    // Many operations in one crossing, e.g. "batch play #3;play #4;stop hat".
+    if (command.compare(0, 6, "batch ") == 0)
+        return batch(command.substr(6));
+
+    AudioCommand record;
+    record.call = 0;
+    record.handle = -1;
+    record.value = 0;
+    record.batched = false;
+    record.endOfBatch = false;
+
+    // Handle triggers, e.g. "playHandle 3", are recognised in place without
+    // splitting the command into strings.
+    record.type = -1;
+    size_t nameLength = 0;
+    if (command.compare(0, 11, "playHandle ") == 0) {
+        record.type = AUDIO_COMMAND_PLAY;
+        nameLength = 11;
+    } else if (command.compare(0, 11, "loopHandle ") == 0) {
+        record.type = AUDIO_COMMAND_LOOP;
+        nameLength = 11;
+    } else if (command.compare(0, 11, "stopHandle ") == 0) {
+        record.type = AUDIO_COMMAND_STOP;
+        nameLength = 11;
+    }
+
+    if (record.type >= 0) {
+        record.handle = atoi(command.c_str() + nameLength);
+        record.id[0] = 0;
+        enqueueCommand(record);
+
+        if (record.type == AUDIO_COMMAND_PLAY)
+            return "Playing";
+        if (record.type == AUDIO_COMMAND_LOOP)
+            return "Looping";
+        return "Stopped";
+    }
+
+    size_t indexOfFirstSpace = command.find_first_of(" ");
+    string strCommand = command.substr(0, indexOfFirstSpace);
+    string strValue = indexOfFirstSpace == string::npos ? "" : command.substr(indexOfFirstSpace + 1);
+
+    if (strCommand == "play")
+        record.type = AUDIO_COMMAND_PLAY;
+    else if (strCommand == "loop")
+        record.type = AUDIO_COMMAND_LOOP;
+    else if (strCommand == "stop")
+        record.type = AUDIO_COMMAND_STOP;
+
+    // Triggers are fire and forget: queue them and return straight away.
+    // The control thread logs anything that goes wrong.
+    if (record.type >= 0 && strValue.size() < AUDIO_COMMAND_ID_SIZE) {
+        memcpy(record.id, strValue.c_str(), strValue.size() + 1);
+        enqueueCommand(record);
+
+        if (record.type == AUDIO_COMMAND_PLAY)
+            return "Playing " + strValue;
+        if (record.type == AUDIO_COMMAND_LOOP)
+            return "Looping " + strValue;
+        return "Stopped " + strValue;
+    }
+
+    // Everything else still returns its result, so wait for it.
+    PendingCall call;
+    call.command = &command;
+    sem_init(&call.done, 0, 0);
+
+    record.type = AUDIO_COMMAND_CALL;
+    record.call = &call;
+    enqueueCommand(record);
+
+    while (sem_wait(&call.done) != 0 && errno == EINTR)
+        ;
+    sem_destroy(&call.done);
+    return call.result;
+}
+
+bool LowLatencyAudio_JS::onControlThread() const {
+    return !m_controlStarted || pthread_equal(pthread_self(), m_controlThread);
+}
+
+void* LowLatencyAudio_JS::controlThread(void* plugin) {
+    static_cast<LowLatencyAudio_JS*>(plugin)->runControlLoop();
+    return NULL;
+}
+
+void LowLatencyAudio_JS::enqueueCommand(AudioCommand& command) {
+    command.enqueuedAt = monotonicMs();
+
+    // A full ring means the control thread is behind; let it catch up.
+    while (!m_commands.push(command)) {
+        __sync_fetch_and_add(&m_commandWaits, 1);
+        sched_yield();
+    }
+    sem_post(&m_commandReady);
+}
+
+void LowLatencyAudio_JS::runControlLoop() {
+    for (;;) {
+        // Sleep until the next command, or until shortly before the next
+        // scheduled event. m_schedule is only touched on this thread.
+        // Offline, events only come due while renderOffline runs. Loops
+        // waiting for their attack to end are checked in between.
+        // The clock fields are only written on this thread, so they can be
+        // read here without the lock.
+        bool timed = !m_schedule.empty() && !m_offlineRate;
+        double due = timed ? m_schedule.top().time : 0;
+        double wait = timed ? due - deviceTime() - SCHEDULER_SPIN_MS / 1000.0 : 0;
+        bool spin = timed;
+        if (!m_loopHandoffs.empty() && !m_offlineRate && (!timed || wait > LOOP_HANDOFF_POLL_MS / 1000.0)) {
+            timed = true;
+            spin = false;
+            wait = LOOP_HANDOFF_POLL_MS / 1000.0;
+        }
+
+        if (!timed) {
+            sem_wait(&m_commandReady);
+        } else if (wait <= 0) {
+            // Close enough that sleeping could overshoot. The wait is spun
+            // out before taking the lock, so commands and InvokeMethod are
+            // not held up by it, and a new command ends it early.
+            while (spin && deviceTime() < due && sem_trywait(&m_commandReady) != 0)
+                sched_yield();
+        } else {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            long long nanoseconds = (long long)(wait * 1000000000.0);
+            deadline.tv_sec += nanoseconds / 1000000000LL;
+            deadline.tv_nsec += nanoseconds % 1000000000LL;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            sem_timedwait(&m_commandReady, &deadline);
+        }
+
+        // Drain everything queued so far in one pass under the lock.
+        AudioCommand command;
+        pthread_mutex_lock(&m_lock);
+        while (m_commands.pop(command)) {
+            if (command.type == AUDIO_COMMAND_QUIT) {
+                pthread_mutex_unlock(&m_lock);
+                return;
+            }
+
+            double latency = monotonicMs() - command.enqueuedAt;
+            m_commandCount++;
+            m_commandLatency += latency;
+            m_lastCommandLatency = latency;
+            if (latency > m_maxCommandLatency)
+                m_maxCommandLatency = latency;
+
+            executeCommand(command);
+        }
+        if (m_poolWorkPending) {
+            m_poolWorkPending = false;
+            growVoicePool(m_requestedVoices - m_voicePool.count());
+            enforceBudget(QString());
+        }
+        runSchedule();
+        serviceLoopHandoffs();
+        pthread_mutex_unlock(&m_lock);
+    }
+}
+
+void LowLatencyAudio_JS::executeCommand(const AudioCommand& command) {
+    if (command.type == AUDIO_COMMAND_PLAY_AT || command.type == AUDIO_COMMAND_STOP_AT) {
+        scheduleCommand(command);
+        return;
+    }
+
+    if (command.batched) {
+        executeBatchOperation(command);
+        return;
+    }
+
+    if (command.type == AUDIO_COMMAND_CALL) {
+        command.call->result = runCommand(*command.call->command);
+        sem_post(&command.call->done);
+        return;
+    }
+
+    // Streams cannot fail once loaded, so their replies are dropped.
+    QString id;
+    if (command.handle < 0) {
+        id = QString::fromAscii(command.id);
+        if (m_streams.contains(id)) {
+            if (command.type == AUDIO_COMMAND_PLAY)
+                play(id);
+            else if (command.type == AUDIO_COMMAND_LOOP)
+                loop(id);
+            else
+                stop(id);
+            return;
+        }
+    }
+
+    // Handles and asset ids go straight to the slot; only failures are
+    // worth a log line. Stopping an id that is not loaded is not one.
+    int slot = command.handle >= 0 ? resolveHandle(command.handle) : m_assetSlots.value(id, -1);
+    TriggerResult result = TRIGGER_PLAYING;
+    if (slot < 0 && command.handle < 0 && command.type == AUDIO_COMMAND_STOP)
+        m_idleMonitor.touch();
+    else if (slot < 0 && command.handle >= 0)
+        qDebug() << "Could not find handle " << command.handle << ". Maybe it hasn't been loaded.";
+    else if (slot < 0)
+        qDebug() << "Could not find the file " << command.id << ". Maybe it hasn't been loaded.";
+    else if (command.type == AUDIO_COMMAND_PLAY)
+        result = playSlot(slot);
+    else if (command.type == AUDIO_COMMAND_LOOP)
+        result = loopSlot(slot);
+    else
+        stopSlot(slot);
+
+    if (result == TRIGGER_DENIED && command.handle >= 0)
+        qDebug() << "No voice available for handle " << command.handle;
+    else if (result == TRIGGER_DENIED)
+        qDebug() << "No voice available for " << command.id;
+}
+
+string LowLatencyAudio_JS::runCommand(const string& command) {
     // parse command and args from string
     int indexOfFirstSpace = command.find_first_of(" ");
     string strCommand = command.substr(0, indexOfFirstSpace);
@@ -646,18 +3237,122 @@ string LowLatencyAudio_JS::InvokeMethod(const string& command) {
         string volumeString = volumeVoice.substr(0, indexOfFourthSpace);
         string voicesString = volumeVoice.substr(indexOfFourthSpace + 1, volumeVoice.length());
 
+        // optional priority after the voices
+        int indexOfFifthSpace = voicesString.find_first_of(" ");
+        string priorityString = indexOfFifthSpace < 0 ? "0" : voicesString.substr(indexOfFifthSpace + 1, voicesString.length());
+
         QString id = QString::fromStdString(idString);
         QString assetPath = QString::fromStdString(pathString);
         double volume = atof (volumeString.c_str());
         int voices = atoi (voicesString.c_str());
+        int priority = atoi (priorityString.c_str());
+
+        return preloadAudio(id, assetPath, volume, voices, priority);
+    }
+
+    // Audio sprite: "preloadSprite <id> <path> <volume> <voices> [regions.json]".
+    if (strCommand == "preloadSprite") {
+        istringstream arguments(strValue);
+        string idString, pathString, regionsString;
+        double volume = 1.0;
+        int voices = 1;
+        arguments >> idString >> pathString >> volume >> voices >> regionsString;
+
+        return preloadSprite(QString::fromStdString(idString), QString::fromStdString(pathString),
+                             volume, voices, QString::fromStdString(regionsString));
+    }
+
+    // Asynchronous variants; both return a ticket and report through events.
+    if (strCommand == "preloadFXAsync") {
+        int indexOfSecondSpace = strValue.find_first_of(" ");
+        string idString = strValue.substr(0, indexOfSecondSpace);
+        string pathString = strValue.substr(indexOfSecondSpace + 1, strValue.length());
+
+        return preloadFXAsync(QString::fromStdString(idString), QString::fromStdString(pathString));
+    }
+
+    if (strCommand == "preloadAudioAsync") {
+        int indexOfSecondSpace = strValue.find_first_of(" ");
+        string idString = strValue.substr(0, indexOfSecondSpace);
+        string pathVolumeVoice = strValue.substr(indexOfSecondSpace + 1, strValue.length());
+
+        int indexOfThirdSpace = pathVolumeVoice.find_first_of(" ");
+        string pathString = pathVolumeVoice.substr(0, indexOfThirdSpace);
+        string volumeVoice = pathVolumeVoice.substr(indexOfThirdSpace + 1, pathVolumeVoice.length());
+
+        int indexOfFourthSpace = volumeVoice.find_first_of(" ");
+        string volumeString = volumeVoice.substr(0, indexOfFourthSpace);
+        string voicesString = volumeVoice.substr(indexOfFourthSpace + 1, volumeVoice.length());
+
+        int indexOfFifthSpace = voicesString.find_first_of(" ");
+        string priorityString = indexOfFifthSpace < 0 ? "0" : voicesString.substr(indexOfFifthSpace + 1, voicesString.length());
+
+        return preloadAudioAsync(QString::fromStdString(idString), QString::fromStdString(pathString),
+                                 atof(volumeString.c_str()), atoi(voicesString.c_str()),
+                                 atoi(priorityString.c_str()));
+    }
+
+    // Batch preload from a JSON manifest; the whole value is the manifest.
+    if (strCommand == "preloadManifest")
+        return preloadManifest(strValue);
+
+    if (strCommand == "preloadStream") {
+        // parse id, path and volume from strValue
+        int indexOfSecondSpace = strValue.find_first_of(" ");
+        string idString = strValue.substr(0, indexOfSecondSpace);
+        string pathVolume = strValue.substr(indexOfSecondSpace + 1, strValue.length());
+
+        int indexOfThirdSpace = pathVolume.find_first_of(" ");
+        string pathString = pathVolume.substr(0, indexOfThirdSpace);
+        string volumeString = pathVolume.substr(indexOfThirdSpace + 1, pathVolume.length());
+
+        QString id = QString::fromStdString(idString);
+        QString assetPath = QString::fromStdString(pathString);
+        double volume = atof (volumeString.c_str());
 
-        return preloadAudio(id, assetPath, volume, voices);
+        return preloadStream(id, assetPath, volume);
     }
 
     // Loops the source
     if (strCommand == "loop")
         return loop(id);
 
+    // Scheduling needs the control thread, which doubles as the scheduler.
+    if (strCommand == "playAt" || strCommand == "stopAt")
+        return strCommand + " needs the audio control thread";
+
+    if (strCommand == "getScheduleStats")
+        return getScheduleStats();
+
+    if (strCommand == "now")
+        return now();
+
+    // Render to a WAV file through a loopback device instead of playing.
+    if (strCommand == "setOfflineMode")
+        return setOfflineMode(atoi(strValue.c_str()));
+
+    if (strCommand == "renderOffline") {
+        int indexOfSecondSpace = strValue.find_first_of(" ");
+        string secondsString = strValue.substr(0, indexOfSecondSpace);
+        string pathString = indexOfSecondSpace < 0 ? "" : strValue.substr(indexOfSecondSpace + 1, strValue.length());
+
+        return renderOffline(atof(secondsString.c_str()), QString::fromStdString(pathString));
+    }
+
+    // Several operations at once; only reached without the control thread.
+    if (strCommand == "batch")
+        return batch(strValue);
+
+    // Triggers by the handle preload returned.
+    if (strCommand == "playHandle")
+        return playHandle(atoi(strValue.c_str()));
+
+    if (strCommand == "loopHandle")
+        return loopHandle(atoi(strValue.c_str()));
+
+    if (strCommand == "stopHandle")
+        return stopHandle(atoi(strValue.c_str()));
+
     // Unloads the source
     if (strCommand == "unload")
         return unload(id);
@@ -666,5 +3361,80 @@ string LowLatencyAudio_JS::InvokeMethod(const string& command) {
     if (strCommand == "stop")
         return stop(id);
 
+    // Configure and query the decoded PCM cache.
+    if (strCommand == "setPcmCache") {
+        int indexOfSecondSpace = strValue.find_first_of(" ");
+        string limitString = strValue.substr(0, indexOfSecondSpace);
+        string directoryString = indexOfSecondSpace < 0 ? "" : strValue.substr(indexOfSecondSpace + 1, strValue.length());
+
+        return setPcmCache(strtoul(limitString.c_str(), NULL, 10), QString::fromStdString(directoryString));
+    }
+
+    if (strCommand == "getPcmCacheStats")
+        return getPcmCacheStats();
+
+    // Report command queue latency.
+    if (strCommand == "getCommandStats")
+        return getCommandStats();
+
+    // Report device open time and warm start latency.
+    if (strCommand == "getDeviceStats")
+        return getDeviceStats();
+
+    // Unload everything and release the device.
+    if (strCommand == "shutdown")
+        return shutdown();
+
+    // Report idle suspend time and resume latency.
+    if (strCommand == "getIdleStats")
+        return getIdleStats();
+
+    // Report voice pool usage and steal counters.
+    if (strCommand == "getVoiceStats")
+        return getVoiceStats();
+
+    // Choose between OpenAL sources and the software mixer for new assets.
+    if (strCommand == "setEngineMode")
+        return setEngineMode(QString::fromStdString(strValue));
+
+    // Resample assets to the output rate as they load.
+    if (strCommand == "setResampling")
+        return setResampling(QString::fromStdString(strValue));
+
+    // Keep software mixer assets as PCM or IMA ADPCM.
+    if (strCommand == "setSampleStorage")
+        return setSampleStorage(QString::fromStdString(strValue));
+
+    // Trim silence from the ends of assets as they load.
+    if (strCommand == "setSilenceTrim")
+        return setSilenceTrim(QString::fromStdString(strValue));
+
+    // Measured loudness, and the gain that brings assets to a target.
+    if (strCommand == "setLoudnessTarget")
+        return setLoudnessTarget(QString::fromStdString(strValue));
+    if (strCommand == "getLoudness")
+        return getLoudness(QString::fromStdString(strValue));
+
+    // Cap decoded PCM in memory and exempt assets from eviction.
+    if (strCommand == "setMemoryBudget")
+        return setMemoryBudget(strtoul(strValue.c_str(), NULL, 10));
+
+    if (strCommand == "pin")
+        return setPinned(id, true);
+
+    if (strCommand == "unpin")
+        return setPinned(id, false);
+
+    if (strCommand == "getMemoryStats")
+        return getMemoryStats();
+
+    // Time engine internals on the device, e.g. "benchmark trigger <id>".
+    if (strCommand == "benchmark")
+        return benchmark(strValue);
+
+    // Report load time and mapped bytes.
+    if (strCommand == "getLoadStats")
+        return getLoadStats(id);
+
     return "Command not found, choose either: load, unload, play ,loop, or stop";
 }
@@ -18,15 +18,174 @@
 #define LowLatencyAudio_JS_HPP_
 
 #include <string>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <semaphore.h>
 #include "../public/plugin.h"
 #include <qstring.h>
 #include <qhash.h>
+#include <qset.h>
 #include <AL/al.h>
 #include <AL/alc.h>
 #include <AL/alut.h>
 #include <vorbis/vorbisfile.h>
+#include "mapped_file.hpp"
+#include "ogg_stream.hpp"
+#include "loader_pool.hpp"
+#include "pcm_cache.hpp"
+#include "voice_pool.hpp"
+#include "idle_monitor.hpp"
+#include "audio_device.hpp"
+#include "command_ring.hpp"
+#include "software_mixer.hpp"
+#include "mp3_decoder.hpp"
+#include "resampler.hpp"
+#include "sample_convert.hpp"
+#include "sample_analysis.hpp"
 
-// #define SOUNDMANAGER_MAX_NBR_OF_SOURCES 32
+// Size of the voice pool when the device does not report its source limit.
+#define SOUNDMANAGER_MAX_NBR_OF_SOURCES 32
+// Sources kept out of the voice pool for streams. Streams past these take
+// theirs from the pool's share, as long as the pool has not used it.
+#define SOUNDMANAGER_STREAM_SOURCES 4
+
+// Handles carry the asset's slot in their low bits and a count of earlier
+// assets in that slot above them, so a stale handle never reaches a new asset.
+#define AUDIO_HANDLE_SLOT_BITS 16
+#define AUDIO_HANDLE_SLOT_MASK ((1 << AUDIO_HANDLE_SLOT_BITS) - 1)
+// The count wraps within the bits left below the sign bit.
+#define AUDIO_HANDLE_GENERATION_MASK 0x7fff
+
+// Most a loudness target may raise an asset's gain. A source playing a
+// boosted asset is allowed that asset's boost over unity gain.
+#define LOUDNESS_MAX_GAIN 4.0f
+
+// Commands that can wait in the queue for the audio control thread.
+#define AUDIO_COMMAND_RING_SIZE 256
+// Longest id a queued trigger can carry; longer ids run synchronously.
+#define AUDIO_COMMAND_ID_SIZE 64
+
+enum AudioCommandType {
+    AUDIO_COMMAND_PLAY,
+    AUDIO_COMMAND_LOOP,
+    AUDIO_COMMAND_STOP,
+    AUDIO_COMMAND_VOLUME,
+    AUDIO_COMMAND_PLAY_AT,
+    AUDIO_COMMAND_STOP_AT,
+    AUDIO_COMMAND_CALL,     // any other command; the caller waits for its result
+    AUDIO_COMMAND_QUIT
+};
+
+struct PendingCall;
+
+// Fixed size record passed from InvokeMethod to the audio control thread.
+struct AudioCommand {
+    int type;
+    double enqueuedAt;      // milliseconds, for enqueue to execute latency
+    PendingCall* call;
+    int handle;             // asset handle, or -1 to look up id instead
+    float value;            // gain for AUDIO_COMMAND_VOLUME
+    double time;            // device time in seconds for the _AT commands
+    bool batched;           // part of a batch; plays wait for the batch end
+    bool endOfBatch;
+    char id[AUDIO_COMMAND_ID_SIZE];
+};
+
+// Per asset load metrics, reported through getLoadStats.
+struct AssetLoadStats {
+    double loadTime;        // milliseconds from open to buffer upload
+    size_t bytesMapped;     // size of the file mapping
+    double trimmedLeading;  // milliseconds of silence cut from the start
+    double trimmedTrailing; // and from the end
+    Loudness loudness;      // measured block by block as the asset decoded
+};
+
+// Sustain loop read from a wave file's smpl chunk, in frames. Without
+// AL_SOFT_loop_points, looping voices queue attack (the frames before
+// start, if any) ahead of sustain and loop sustain alone once attack has
+// played; both are copies of those regions of the asset's buffer.
+struct SampleLoop {
+    int start;
+    int end;                // exclusive; 0 when the file has no loop
+    ALuint attack;
+    ALuint sustain;
+};
+
+// Named region of an audio sprite sheet, in frames.
+struct SpriteRegion {
+    std::string name;
+    int start;
+    int end;                // exclusive
+};
+
+// Looping voices still playing their attack are checked this often, so the
+// sustain buffer can be looped on its own once the attack is done.
+#define LOOP_HANDOFF_POLL_MS 5
+
+// A loaded asset. Its voices come from the shared pool, or from the software
+// mixer when clip is set; voices only caps how many of them it may hold at once.
+struct AudioAsset {
+    QString id;
+    int handle;
+    ALuint buffer;
+    const MixerClip* clip;
+    double duration;        // seconds, used to reclaim finished voices
+    float volume;
+    int voices;
+    int priority;
+    float normalization;    // loudness target gain, folded into volume
+    SampleLoop loop;
+};
+
+enum TriggerResult {
+    TRIGGER_PLAYING,
+    TRIGGER_STOLE,          // started by cutting another voice short
+    TRIGGER_ALREADY_PLAYING,
+    TRIGGER_DENIED          // every voice is held by a higher priority sound
+};
+
+// Scheduled commands wake the control thread this long before they are due
+// and it spins out the rest unlocked, so sleep granularity does not add jitter.
+#define SCHEDULER_SPIN_MS 1.0
+// Mixer period assumed when the device does not report its refresh rate.
+#define SCHEDULER_DEFAULT_REFRESH 50
+
+// Most frames rendered per step offline; steps also end on scheduled events.
+#define OFFLINE_RENDER_BLOCK_FRAMES 1024
+
+// A play or stop waiting in the scheduler for its device time.
+struct ScheduledEvent {
+    double time;
+    unsigned int sequence;  // keeps events due at the same time in order
+    int type;
+    int handle;             // asset handle, or -1 for a stream
+    QString streamId;
+
+    bool operator>(const ScheduledEvent& other) const {
+        return time > other.time || (time == other.time && sequence > other.sequence);
+    }
+};
+
+// Decoded buffer shared by every id that loads the same file.
+struct SharedBuffer {
+    ALuint buffer;
+    MixerClip* clip;        // in place of buffer in software mixing mode
+    SampleLoop loop;
+    int references;
+    double duration;        // seconds, kept while evicted
+    size_t bytes;           // PCM given to alBufferData, or held by the clip
+    unsigned int lastUsed;  // trigger order, for least recently used eviction
+    int pins;               // ids pinning it in memory
+    bool reloadable;        // sprite regions cannot be decoded on their own
+    bool evicted;           // dropped for the memory budget until next trigger
+    Loudness loudness;
+};
+
+class PreloadJob;
+
+// Resolve an asset path relative to the application's native folder.
+QString resolveAssetPath(QString assetPath);
 
 class LowLatencyAudio_JS: public JSExt {
 
@@ -34,28 +193,289 @@ public:
     explicit LowLatencyAudio_JS(const std::string& id);
     virtual ~LowLatencyAudio_JS();
     std::string preloadFX(QString id, QString assetPath);
-    std::string preloadAudio(QString id, QString assetPath, double volume, int voices);
+    std::string preloadAudio(QString id, QString assetPath, double volume, int voices, int priority = 0);
+    std::string preloadStream(QString id, QString assetPath, double volume);
+    std::string preloadSprite(QString id, QString assetPath, double volume, int voices, QString regionsPath);
+    std::string preloadFXAsync(QString id, QString assetPath);
+    std::string preloadAudioAsync(QString id, QString assetPath, double volume, int voices, int priority = 0);
+    std::string preloadManifest(const std::string& manifest);
     std::string play(QString id);
     std::string stop(QString id);
     std::string loop(QString id);
+    std::string playHandle(int handle);
+    std::string stopHandle(int handle);
+    std::string loopHandle(int handle);
+    std::string batch(const std::string& operations);
+    std::string now();
+    std::string getScheduleStats();
     std::string unload(QString id);
+    std::string getLoadStats(QString id);
+    std::string setPcmCache(size_t limit, QString directory);
+    std::string getPcmCacheStats();
+    std::string getVoiceStats();
+    std::string getIdleStats();
+    std::string getDeviceStats();
+    std::string shutdown();
+    std::string getCommandStats();
+    std::string setEngineMode(QString mode);
+    std::string setResampling(QString quality);
+    std::string setSampleStorage(QString storage);
+    std::string setSilenceTrim(QString threshold);
+    std::string setLoudnessTarget(QString target);
+    std::string getLoudness(QString id);
+    std::string setMemoryBudget(size_t bytes);
+    std::string setPinned(QString id, bool pinned);
+    std::string getMemoryStats();
+    std::string setOfflineMode(int rate);
+    std::string renderOffline(double seconds, QString path);
+    std::string benchmark(const std::string& arguments);
     virtual bool CanDelete();
     virtual std::string InvokeMethod(const std::string& command);
 
 private:
+    friend class PreloadJob;
+
     std::string m_id;
 
+    std::string runCommand(const std::string& command);
+
+    // The audio control thread executes every command, and with it every
+    // call on pool voices. InvokeMethod only queues commands, and loader
+    // threads leave it the voices and evictions their preloads call for.
+    // Buffers are also created and deleted elsewhere. Loader threads do so
+    // as they decode and complete. The stream and mixer feed threads do so
+    // for their own rings, and each of them owns its one source.
+    // Commands run one at a time. A long one, such as a synchronous
+    // preload, renderOffline or a benchmark, holds up every trigger queued
+    // behind it.
+    static void* controlThread(void* plugin);
+    void runControlLoop();
+    void enqueueCommand(AudioCommand& command);
+    // Whether the caller is the control thread, or commands run inline
+    bool onControlThread() const;
+    void executeCommand(const AudioCommand& command);
+    void executeBatchOperation(const AudioCommand& operation);
+    // Start every play of the current batch with one alSourcePlayv
+    void flushBatchPlays();
+    // Seconds since the device opened, or rendered offline since then; the
+    // clock playAt and stopAt use
+    double deviceTime() const;
+    void scheduleCommand(const AudioCommand& command);
+    // Fire every scheduled event that is due, waiting out the last moment
+    void runSchedule();
+    void fireScheduled(const ScheduledEvent& event, double now);
+    void notifyEvent(const std::string& event);
+    // Hold or drop this object's reference on the shared device
+    bool openDevice();
+    void closeDevice();
+    void openMixer();
+    void recordFirstTrigger(double startTime);
+    // Whether any voice or stream is still audible, for the idle monitor
+    static bool isEngineActive(void* plugin);
+
+    // Decode an audio file into a new buffer, or into clip when one is given,
+    // without touching shared state
+    bool decodeAudio(QString filePath, ALuint& bufferID, MixerClip* clip, SampleLoop& loop,
+                     AssetLoadStats& stats, std::vector<SpriteRegion>* cues = 0);
     // Load audio file based on it's type
     bool loadAudio(QString id, QString assetPath);
+    // A new clip for the software mixer in the configured sample storage
+    MixerClip* createClip() const;
+    // Reference counting of buffers shared by ids loading the same file
+    bool retainBuffer(QString id, QString filePath);
+    void adoptBuffer(QString id, QString filePath, ALuint bufferID, MixerClip* clip,
+                     const SampleLoop& loop, const AssetLoadStats& stats, bool reloadable = true);
+    void releaseBuffer(QString id);
+    // The memory budget: decode an evicted asset again before it plays, and
+    // evict idle ones, least recently used first, while over budget
+    bool ensureResident(int slot);
+    void enforceBudget(const QString& keep);
+    bool isBufferIdle(const QString& filePath, const SharedBuffer& shared, bool silent);
+    void evictBuffer(const QString& filePath, SharedBuffer& shared);
+    // Point every id and asset of filePath at its current buffer, length
+    // and loop, and at what a re-decode found, if given
+    void rebindAssets(const QString& filePath, const SharedBuffer& shared,
+                      const AssetLoadStats* redecoded = 0);
+    // Returns the asset's handle
+    int createAsset(QString id, double volume, int voices, int priority);
+    // Gain the loudness target gives an asset measured as loudness
+    float normalizationGain(const Loudness& loudness) const;
+    // Slot of a live asset's handle, or -1
+    int resolveHandle(int handle) const;
+    // Add up to count sources to the voice pool, within the device limit
+    void growVoicePool(int count);
+    // Account for a stream's source before it is opened, or after it is
+    // closed; see SOUNDMANAGER_STREAM_SOURCES
+    bool reserveStreamSource();
+    void releaseStreamSource();
+    // Take a pool voice for an asset and bind its buffer, without starting it
+    int acquireVoice(int slot, double now, bool& stolen);
+    // Trigger an asset by slot, without strings or lookups
+    TriggerResult playSlot(int slot, std::vector<ALuint>* deferred = 0);
+    TriggerResult loopSlot(int slot);
+    // Loop the sustain buffer of voices whose attack has finished
+    void serviceLoopHandoffs();
+    void stopSlot(int slot);
+    void setSlotVolume(int slot, float volume);
+
+    LoaderPool* loaderPool();
+    // Microbenchmarks, implemented in benchmark.cpp
+    std::string benchmarkTrigger(QString id, int iterations);
+    std::string benchmarkMixer(int voices, double seconds);
+    std::string benchmarkDecode(const std::vector<std::string>& paths, int runs);
+    std::string benchmarkResample(int rate, ResampleQuality quality, int voices);
+    std::string benchmarkAdpcm(int voices, double seconds);
+    std::string benchmarkConvert(double seconds);
+    std::string benchmarkSilence(double seconds);
+    std::string benchmarkLoudness(double seconds);
+
+    // Queue a preload on the loader pool and return its ticket
+    int preloadAsync(QString id, QString assetPath, double volume, int voices, int priority);
+    // Register the result of an asynchronous preload and report it
+    void completePreload(const PreloadJob& job, QString filePath, bool decoded,
+                         ALuint bufferID, MixerClip* clip, SampleLoop& loop,
+                         const AssetLoadStats& stats);
     // Load the .wav file
-    bool loadWav(FILE* file, ALuint buffer);
+    bool loadWav(const MappedFile& file, ALuint buffer, MixerClip* clip, SampleLoop& loop,
+                 std::vector<SpriteRegion>* cues, AssetLoadStats* analysis);
     // Load the .ogg file
-    bool loadOgg(FILE* file, ALuint buffer);
+    bool loadOgg(const MappedFile& file, ALuint buffer, MixerClip* clip, const char* path,
+                 AssetLoadStats* analysis);
+    // Load the .mp3 file
+    bool loadMp3(const MappedFile& file, ALuint buffer, MixerClip* clip, const char* path,
+                 AssetLoadStats* analysis);
+    // Fill buffer or clip from PCM decoded on an earlier launch, if cached.
+    bool loadCachedPcm(const char* path, ALuint buffer, MixerClip* clip, bool& loaded,
+                       AssetLoadStats* analysis);
+    // Hand decoded 16 bit PCM to the clip, or else the buffer
+    bool uploadPcm(ALuint buffer, MixerClip* clip, const void* pcm, unsigned int size, int channels, int rate,
+                   AssetLoadStats* analysis);
+    // Cut silence from both ends of 16 bit PCM if trimming is on, keeping
+    // frames [keepStart, keepEnd), and record it in analysis. The loaders
+    // also measure loudness into it as they decode; a null analysis keeps
+    // the asset whole and unmeasured. Returns the frames cut from the start
+    long trimSilence(const short*& pcm, long& frames, int channels, int rate,
+                     long keepStart, long keepEnd, AssetLoadStats* analysis) const;
+    // Whether load-time resampling applies to assets at rate
+    bool resamplesFrom(int rate) const;
+    // Convert 8 or 16 bit PCM to the output rate if load-time resampling
+    // applies; false leaves the asset at its own rate
+    bool resampleToOutput(const void* pcm, int bits, long frames, int channels, int rate,
+                          Resampler& resampler, std::vector<short>& out) const;
 
     QHash<QString, ALuint> m_audioBuffers;
 
-    QHash<QString, ALuint> m_soundSources;
-    QHash<QString, ALuint> m_assetSources;
+    // Buffers by resolved file path, shared by every id loading that file.
+    QHash<QString, SharedBuffer> m_sharedBuffers;
+    QHash<QString, QString> m_bufferPaths;
+
+    // Loaded assets by slot; freed slots are reused and hold null. String
+    // ids are resolved through m_assetSlots, handles index m_assets directly.
+    std::vector<AudioAsset*> m_assets;
+    std::vector<int> m_slotGenerations;
+    QHash<QString, int> m_assetSlots;
+    // Reused by stopSlot so stopping does not allocate.
+    std::vector<ALuint> m_stopSources;
+    // Sources of batched plays waiting to start together.
+    std::vector<ALuint> m_batchPlays;
+    // Looping sources still playing the attack queued ahead of a sustain loop.
+    std::vector<ALuint> m_loopHandoffs;
+
+    // Every source the plugin plays buffers on, shared by all assets.
+    VoicePool m_voicePool;
+    // Voices asked for by loaded assets, pre-allocated up to the device limit.
+    int m_requestedVoices;
+
+    QHash<QString, AssetLoadStats> m_loadStats;
+
+    // Region ids of each audio sprite; every region is an asset of its own.
+    QHash<QString, QList<QString> > m_sprites;
+
+    // Long assets decoded on the fly instead of into a single buffer.
+    QHash<QString, OggStream*> m_streams;
+
+    // Guards the tables above against loader threads.
+    pthread_mutex_t m_lock;
+    LoaderPool* m_loaderPool;
+    int m_lastTicket;
+
+    // Decoded Ogg PCM persisted across launches; off until configured.
+    PcmCache m_pcmCache;
+
+    // Suspends the device while nothing is playing.
+    IdleMonitor m_idleMonitor;
+
+    // Whether this object holds a device reference, and warm start timing.
+    bool m_deviceRetained;
+    double m_deviceOpenedAt;
+    double m_firstTriggerMs;
+    double m_firstTriggerDelay;
+
+    // Commands from InvokeMethod, the only producer, to the control thread.
+    CommandRing<AudioCommand, AUDIO_COMMAND_RING_SIZE> m_commands;
+    sem_t m_commandReady;
+    pthread_t m_controlThread;
+    bool m_controlStarted;
+    // Pool growth and budget enforcement left by a loader thread
+    bool m_poolWorkPending;
+
+    // Enqueue to execute latency, kept by the control thread.
+    unsigned int m_commandCount;
+    double m_commandLatency;
+    double m_lastCommandLatency;
+    double m_maxCommandLatency;
+    // Pushes that found the ring full, kept by the producer.
+    unsigned int m_commandWaits;
+
+    // Plays and stops waiting for their device time, soonest first.
+    std::priority_queue<ScheduledEvent, std::vector<ScheduledEvent>, std::greater<ScheduledEvent> > m_schedule;
+    unsigned int m_scheduleSequence;
+    double m_mixerPeriod;   // seconds
+    unsigned int m_scheduled;
+    unsigned int m_fired;
+    unsigned int m_dropped;
+    unsigned int m_firedInPeriod;
+    double m_lateTotal;     // seconds between due time and alSourcePlay
+    double m_lateMax;
+
+    // Assets decode into clips mixed in software instead of into AL buffers.
+    bool m_softwareMixing;
+    SoftwareMixer* m_mixer;
+
+    // Rate of the loopback device when rendering offline, else 0, and the
+    // frames it has rendered since it opened.
+    int m_offlineRate;
+    long long m_renderedFrames;
+
+    // The device's ALC_FREQUENCY, and the quality assets are resampled to it
+    // with as they load; RESAMPLE_OFF leaves them at their own rate.
+    int m_outputRate;
+    ResampleQuality m_resampleQuality;
+
+    // Bytes of decoded PCM resident against the budget, 0 for no limit, and
+    // what keeping to it has cost.
+    size_t m_memoryBudget;
+    size_t m_residentBytes;
+    unsigned int m_useClock;
+    QSet<QString> m_pinnedIds;
+    unsigned int m_evictions;
+    unsigned int m_redecodes;
+    double m_redecodeTotal;     // milliseconds
+    double m_redecodeLast;
+    double m_redecodeMax;
+
+    // Software mixer clips store IMA ADPCM instead of 16 bit PCM.
+    bool m_adpcmStorage;
+
+    // Assets loaded with trimming on lose leading and trailing samples no
+    // louder than the threshold.
+    bool m_trimSilence;
+    short m_trimThreshold;
+
+    // Assets created with normalization on are given the gain that brings
+    // their integrated loudness to the target, in LUFS.
+    bool m_normalize;
+    double m_loudnessTarget;
 
 };
 
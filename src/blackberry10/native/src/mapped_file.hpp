@@ -0,0 +1,48 @@
+/*
+* Copyright (c) 2013 BlackBerry Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef MappedFile_HPP_
+#define MappedFile_HPP_
+
+#include <stddef.h>
+
+// Read-only memory mapping of a whole file. The mapping is released when the
+// object goes out of scope, so loaders can hand pointers into it straight to
+// OpenAL without copying the data onto the heap first.
+class MappedFile {
+
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // Map the file at the given path, releasing any previous mapping.
+    bool open(const char* path);
+    void close();
+
+    bool isOpen() const { return m_data != 0; }
+    const unsigned char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    // Not copyable; the mapping has a single owner.
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const unsigned char* m_data;
+    size_t m_size;
+};
+
+#endif /* MappedFile_HPP_ */
@@ -0,0 +1,1521 @@
+/*
+ * Copyright (c) 2013 BlackBerry Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include "mp3_decoder.hpp"
+
+// Delay of the Layer III filterbank, trimmed along with the encoder delay.
+#define MP3_DECODER_DELAY 529
+
+static const short bitrates[2][15] = {
+    { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+    { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }
+};
+
+static const int sampleRates[3] = { 44100, 48000, 32000 };
+
+// Scalefactor band boundaries for long and short blocks, indexed by the
+// header's rateIndex.
+static const short longBands[9][23] = {
+    { 0, 4, 8, 12, 16, 20, 24, 30, 36, 44, 52, 62, 74, 90, 110, 134, 162, 196, 238, 288, 342, 418, 576 },
+    { 0, 4, 8, 12, 16, 20, 24, 30, 36, 42, 50, 60, 72, 88, 106, 128, 156, 190, 230, 276, 330, 384, 576 },
+    { 0, 4, 8, 12, 16, 20, 24, 30, 36, 44, 54, 66, 82, 102, 126, 156, 194, 240, 296, 364, 448, 550, 576 },
+    { 0, 6, 12, 18, 24, 30, 36, 44, 54, 66, 80, 96, 116, 140, 168, 200, 238, 284, 336, 396, 464, 522, 576 },
+    { 0, 6, 12, 18, 24, 30, 36, 44, 54, 66, 80, 96, 114, 136, 162, 194, 232, 278, 332, 394, 464, 540, 576 },
+    { 0, 6, 12, 18, 24, 30, 36, 44, 54, 66, 80, 96, 116, 140, 168, 200, 238, 284, 336, 396, 464, 522, 576 },
+    { 0, 6, 12, 18, 24, 30, 36, 44, 54, 66, 80, 96, 116, 140, 168, 200, 238, 284, 336, 396, 464, 522, 576 },
+    { 0, 6, 12, 18, 24, 30, 36, 44, 54, 66, 80, 96, 116, 140, 168, 200, 238, 284, 336, 396, 464, 522, 576 },
+    { 0, 12, 24, 36, 48, 60, 72, 88, 108, 132, 160, 192, 232, 280, 336, 400, 476, 566, 568, 570, 572, 574, 576 }
+};
+
+static const short shortBands[9][14] = {
+    { 0, 4, 8, 12, 16, 22, 30, 40, 52, 66, 84, 106, 136, 192 },
+    { 0, 4, 8, 12, 16, 22, 28, 38, 50, 64, 80, 100, 126, 192 },
+    { 0, 4, 8, 12, 16, 22, 30, 42, 58, 78, 104, 138, 180, 192 },
+    { 0, 4, 8, 12, 18, 24, 32, 42, 56, 74, 100, 132, 174, 192 },
+    { 0, 4, 8, 12, 18, 26, 36, 48, 62, 80, 104, 136, 180, 192 },
+    { 0, 4, 8, 12, 18, 26, 36, 48, 62, 80, 104, 134, 174, 192 },
+    { 0, 4, 8, 12, 18, 26, 36, 48, 62, 80, 104, 134, 174, 192 },
+    { 0, 4, 8, 12, 18, 26, 36, 48, 62, 80, 104, 134, 174, 192 },
+    { 0, 8, 16, 24, 36, 52, 72, 96, 124, 160, 162, 164, 166, 192 }
+};
+
+// Scalefactor lengths for MPEG-1 scalefac_compress values.
+static const unsigned char scalefactorLengths[2][16] = {
+    { 0, 0, 0, 0, 3, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4 },
+    { 0, 1, 2, 3, 0, 1, 2, 3, 1, 2, 3, 1, 2, 3, 2, 3 }
+};
+
+// Scalefactors per group for MPEG-2 frames, by scalefac_compress range and
+// long, short or mixed blocks.
+static const unsigned char lsfScalefactorCounts[6][3][4] = {
+    { { 6, 5, 5, 5 }, { 9, 9, 9, 9 }, { 6, 9, 9, 9 } },
+    { { 6, 5, 7, 3 }, { 9, 9, 12, 6 }, { 6, 9, 12, 6 } },
+    { { 11, 10, 0, 0 }, { 18, 18, 0, 0 }, { 15, 18, 0, 0 } },
+    { { 7, 7, 7, 0 }, { 12, 12, 12, 0 }, { 6, 15, 12, 0 } },
+    { { 6, 6, 6, 3 }, { 12, 9, 9, 6 }, { 6, 12, 9, 6 } },
+    { { 8, 8, 5, 0 }, { 15, 12, 9, 0 }, { 6, 18, 9, 0 } }
+};
+
+static const unsigned char pretab[22] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 2, 2, 3, 3, 3, 2, 0, 0
+};
+
+static const float aliasCoefficients[8] = {
+    -0.6f, -0.535f, -0.33f, -0.185f, -0.095f, -0.041f, -0.0142f, -0.0037f
+};
+
+// Huffman codes and lengths from ISO 11172-3 Annex B, row by row.
+
+static const unsigned short huffmanCodes1[4] = {
+    1, 1,
+    1, 0
+};
+
+static const unsigned char huffmanLengths1[4] = {
+    1, 3,
+    2, 3
+};
+
+static const unsigned short huffmanCodes2[9] = {
+    1, 2, 1,
+    3, 1, 1,
+    3, 2, 0
+};
+
+static const unsigned char huffmanLengths2[9] = {
+    1, 3, 6,
+    3, 3, 5,
+    5, 5, 6
+};
+
+static const unsigned short huffmanCodes3[9] = {
+    3, 2, 1,
+    1, 1, 1,
+    3, 2, 0
+};
+
+static const unsigned char huffmanLengths3[9] = {
+    2, 2, 6,
+    3, 2, 5,
+    5, 5, 6
+};
+
+static const unsigned short huffmanCodes5[16] = {
+    1, 2, 6, 5,
+    3, 1, 4, 4,
+    7, 5, 7, 1,
+    6, 1, 1, 0
+};
+
+static const unsigned char huffmanLengths5[16] = {
+    1, 3, 6, 7,
+    3, 3, 6, 7,
+    6, 6, 7, 8,
+    7, 6, 7, 8
+};
+
+static const unsigned short huffmanCodes6[16] = {
+    7, 3, 5, 1,
+    6, 2, 3, 2,
+    5, 4, 4, 1,
+    3, 3, 2, 0
+};
+
+static const unsigned char huffmanLengths6[16] = {
+    3, 3, 5, 7,
+    3, 2, 4, 5,
+    4, 4, 5, 6,
+    6, 5, 6, 7
+};
+
+static const unsigned short huffmanCodes7[36] = {
+    1, 2, 10, 19, 16, 10,
+    3, 3, 7, 10, 5, 3,
+    11, 4, 13, 17, 8, 4,
+    12, 11, 18, 15, 11, 2,
+    7, 6, 9, 14, 3, 1,
+    6, 4, 5, 3, 2, 0
+};
+
+static const unsigned char huffmanLengths7[36] = {
+    1, 3, 6, 8, 8, 9,
+    3, 4, 6, 7, 7, 8,
+    6, 5, 7, 8, 8, 9,
+    7, 7, 8, 9, 9, 9,
+    7, 7, 8, 9, 9, 10,
+    8, 8, 9, 10, 10, 10
+};
+
+static const unsigned short huffmanCodes8[36] = {
+    3, 4, 6, 18, 12, 5,
+    5, 1, 2, 16, 9, 3,
+    7, 3, 5, 14, 7, 3,
+    19, 17, 15, 13, 10, 4,
+    13, 5, 8, 11, 5, 1,
+    12, 4, 4, 1, 1, 0
+};
+
+static const unsigned char huffmanLengths8[36] = {
+    2, 3, 6, 8, 8, 9,
+    3, 2, 4, 8, 8, 8,
+    6, 4, 6, 8, 8, 9,
+    8, 8, 8, 9, 9, 10,
+    8, 7, 8, 9, 10, 10,
+    9, 8, 9, 9, 11, 11
+};
+
+static const unsigned short huffmanCodes9[36] = {
+    7, 5, 9, 14, 15, 7,
+    6, 4, 5, 5, 6, 7,
+    7, 6, 8, 8, 8, 5,
+    15, 6, 9, 10, 5, 1,
+    11, 7, 9, 6, 4, 1,
+    14, 4, 6, 2, 6, 0
+};
+
+static const unsigned char huffmanLengths9[36] = {
+    3, 3, 5, 6, 8, 9,
+    3, 3, 4, 5, 6, 8,
+    4, 4, 5, 6, 7, 8,
+    6, 5, 6, 7, 7, 8,
+    7, 6, 7, 7, 8, 9,
+    8, 7, 8, 8, 9, 9
+};
+
+static const unsigned short huffmanCodes10[64] = {
+    1, 2, 10, 23, 35, 30, 12, 17,
+    3, 3, 8, 12, 18, 21, 12, 7,
+    11, 9, 15, 21, 32, 40, 19, 6,
+    14, 13, 22, 34, 46, 23, 18, 7,
+    20, 19, 33, 47, 27, 22, 9, 3,
+    31, 22, 41, 26, 21, 20, 5, 3,
+    14, 13, 10, 11, 16, 6, 5, 1,
+    9, 8, 7, 8, 4, 4, 2, 0
+};
+
+static const unsigned char huffmanLengths10[64] = {
+    1, 3, 6, 8, 9, 9, 9, 10,
+    3, 4, 6, 7, 8, 9, 8, 8,
+    6, 6, 7, 8, 9, 10, 9, 9,
+    7, 7, 8, 9, 10, 10, 9, 10,
+    8, 8, 9, 10, 10, 10, 10, 10,
+    9, 9, 10, 10, 11, 11, 10, 11,
+    8, 8, 9, 10, 10, 10, 11, 11,
+    9, 8, 9, 10, 10, 11, 11, 11
+};
+
+static const unsigned short huffmanCodes11[64] = {
+    3, 4, 10, 24, 34, 33, 21, 15,
+    5, 3, 4, 10, 32, 17, 11, 10,
+    11, 7, 13, 18, 30, 31, 20, 5,
+    25, 11, 19, 59, 27, 18, 12, 5,
+    35, 33, 31, 58, 30, 16, 7, 5,
+    28, 26, 32, 19, 17, 15, 8, 14,
+    14, 12, 9, 13, 14, 9, 4, 1,
+    11, 4, 6, 6, 6, 3, 2, 0
+};
+
+static const unsigned char huffmanLengths11[64] = {
+    2, 3, 5, 7, 8, 9, 8, 9,
+    3, 3, 4, 6, 8, 8, 7, 8,
+    5, 5, 6, 7, 8, 9, 8, 8,
+    7, 6, 7, 9, 8, 10, 8, 9,
+    8, 8, 8, 9, 9, 10, 9, 10,
+    8, 8, 9, 10, 10, 11, 10, 11,
+    8, 7, 7, 8, 9, 10, 10, 10,
+    8, 7, 8, 9, 10, 10, 10, 10
+};
+
+static const unsigned short huffmanCodes12[64] = {
+    9, 6, 16, 33, 41, 39, 38, 26,
+    7, 5, 6, 9, 23, 16, 26, 11,
+    17, 7, 11, 14, 21, 30, 10, 7,
+    17, 10, 15, 12, 18, 28, 14, 5,
+    32, 13, 22, 19, 18, 16, 9, 5,
+    40, 17, 31, 29, 17, 13, 4, 2,
+    27, 12, 11, 15, 10, 7, 4, 1,
+    27, 12, 8, 12, 6, 3, 1, 0
+};
+
+static const unsigned char huffmanLengths12[64] = {
+    4, 3, 5, 7, 8, 9, 9, 9,
+    3, 3, 4, 5, 7, 7, 8, 8,
+    5, 4, 5, 6, 7, 8, 7, 8,
+    6, 5, 6, 6, 7, 8, 8, 8,
+    7, 6, 7, 7, 8, 8, 8, 9,
+    8, 7, 8, 8, 8, 9, 8, 9,
+    8, 7, 7, 8, 8, 9, 9, 10,
+    9, 8, 8, 9, 9, 9, 9, 10
+};
+
+static const unsigned short huffmanCodes13[256] = {
+    1, 5, 14, 21, 34, 51, 46, 71, 42, 52, 68, 52, 67, 44, 43, 19,
+    3, 4, 12, 19, 31, 26, 44, 33, 31, 24, 32, 24, 31, 35, 22, 14,
+    15, 13, 23, 36, 59, 49, 77, 65, 29, 40, 30, 40, 27, 33, 42, 16,
+    22, 20, 37, 61, 56, 79, 73, 64, 43, 76, 56, 37, 26, 31, 25, 14,
+    35, 16, 60, 57, 97, 75, 114, 91, 54, 73, 55, 41, 48, 53, 23, 24,
+    58, 27, 50, 96, 76, 70, 93, 84, 77, 58, 79, 29, 74, 49, 41, 17,
+    47, 45, 78, 74, 115, 94, 90, 79, 69, 83, 71, 50, 59, 38, 36, 15,
+    72, 34, 56, 95, 92, 85, 91, 90, 86, 73, 77, 65, 51, 44, 43, 42,
+    43, 20, 30, 44, 55, 78, 72, 87, 78, 61, 46, 54, 37, 30, 20, 16,
+    53, 25, 41, 37, 44, 59, 54, 81, 66, 76, 57, 54, 37, 18, 39, 11,
+    35, 33, 31, 57, 42, 82, 72, 80, 47, 58, 55, 21, 22, 26, 38, 22,
+    53, 25, 23, 38, 70, 60, 51, 36, 55, 26, 34, 23, 27, 14, 9, 7,
+    34, 32, 28, 39, 49, 75, 30, 52, 48, 40, 52, 28, 18, 17, 9, 5,
+    45, 21, 34, 64, 56, 50, 49, 45, 31, 19, 12, 15, 10, 7, 6, 3,
+    48, 23, 20, 39, 36, 35, 53, 21, 16, 23, 13, 10, 6, 1, 4, 2,
+    16, 15, 17, 27, 25, 20, 29, 11, 17, 12, 16, 8, 1, 1, 0, 1
+};
+
+static const unsigned char huffmanLengths13[256] = {
+    1, 4, 6, 7, 8, 9, 9, 10, 9, 10, 11, 11, 12, 12, 13, 13,
+    3, 4, 6, 7, 8, 8, 9, 9, 9, 9, 10, 10, 11, 12, 12, 12,
+    6, 6, 7, 8, 9, 9, 10, 10, 9, 10, 10, 11, 11, 12, 13, 13,
+    7, 7, 8, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11, 12, 13, 13,
+    8, 7, 9, 9, 10, 10, 11, 11, 10, 11, 11, 12, 12, 13, 13, 14,
+    9, 8, 9, 10, 10, 10, 11, 11, 11, 11, 12, 11, 13, 13, 14, 14,
+    9, 9, 10, 10, 11, 11, 11, 11, 11, 12, 12, 12, 13, 13, 14, 14,
+    10, 9, 10, 11, 11, 11, 12, 12, 12, 12, 13, 13, 13, 14, 16, 16,
+    9, 8, 9, 10, 10, 11, 11, 12, 12, 12, 12, 13, 13, 14, 15, 15,
+    10, 9, 10, 10, 11, 11, 11, 13, 12, 13, 13, 14, 14, 14, 16, 15,
+    10, 10, 10, 11, 11, 12, 12, 13, 12, 13, 14, 13, 14, 15, 16, 17,
+    11, 10, 10, 11, 12, 12, 12, 12, 13, 13, 13, 14, 15, 15, 15, 16,
+    11, 11, 11, 12, 12, 13, 12, 13, 14, 14, 15, 15, 15, 16, 16, 16,
+    12, 11, 12, 13, 13, 13, 14, 14, 14, 14, 14, 15, 16, 15, 16, 16,
+    13, 12, 12, 13, 13, 13, 15, 14, 14, 17, 15, 15, 15, 17, 16, 16,
+    12, 12, 13, 14, 14, 14, 15, 14, 15, 15, 16, 16, 19, 18, 19, 16
+};
+
+static const unsigned short huffmanCodes15[256] = {
+    7, 12, 18, 53, 47, 76, 124, 108, 89, 123, 108, 119, 107, 81, 122, 63,
+    13, 5, 16, 27, 46, 36, 61, 51, 42, 70, 52, 83, 65, 41, 59, 36,
+    19, 17, 15, 24, 41, 34, 59, 48, 40, 64, 50, 78, 62, 80, 56, 33,
+    29, 28, 25, 43, 39, 63, 55, 93, 76, 59, 93, 72, 54, 75, 50, 29,
+    52, 22, 42, 40, 67, 57, 95, 79, 72, 57, 89, 69, 49, 66, 46, 27,
+    77, 37, 35, 66, 58, 52, 91, 74, 62, 48, 79, 63, 90, 62, 40, 38,
+    125, 32, 60, 56, 50, 92, 78, 65, 55, 87, 71, 51, 73, 51, 70, 30,
+    109, 53, 49, 94, 88, 75, 66, 122, 91, 73, 56, 42, 64, 44, 21, 25,
+    90, 43, 41, 77, 73, 63, 56, 92, 77, 66, 47, 67, 48, 53, 36, 20,
+    71, 34, 67, 60, 58, 49, 88, 76, 67, 106, 71, 54, 38, 39, 23, 15,
+    109, 53, 51, 47, 90, 82, 58, 57, 48, 72, 57, 41, 23, 27, 62, 9,
+    86, 42, 40, 37, 70, 64, 52, 43, 70, 55, 42, 25, 29, 18, 11, 11,
+    118, 68, 30, 55, 50, 46, 74, 65, 49, 39, 24, 16, 22, 13, 14, 7,
+    91, 44, 39, 38, 34, 63, 52, 45, 31, 52, 28, 19, 14, 8, 9, 3,
+    123, 60, 58, 53, 47, 43, 32, 22, 37, 24, 17, 12, 15, 10, 2, 1,
+    71, 37, 34, 30, 28, 20, 17, 26, 21, 16, 10, 6, 8, 6, 2, 0
+};
+
+static const unsigned char huffmanLengths15[256] = {
+    3, 4, 5, 7, 7, 8, 9, 9, 9, 10, 10, 11, 11, 11, 12, 13,
+    4, 3, 5, 6, 7, 7, 8, 8, 8, 9, 9, 10, 10, 10, 11, 11,
+    5, 5, 5, 6, 7, 7, 8, 8, 8, 9, 9, 10, 10, 11, 11, 11,
+    6, 6, 6, 7, 7, 8, 8, 9, 9, 9, 10, 10, 10, 11, 11, 11,
+    7, 6, 7, 7, 8, 8, 9, 9, 9, 9, 10, 10, 10, 11, 11, 11,
+    8, 7, 7, 8, 8, 8, 9, 9, 9, 9, 10, 10, 11, 11, 11, 12,
+    9, 7, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 11, 11, 12, 12,
+    9, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 10, 11, 11, 11, 12,
+    9, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 12, 12, 12,
+    9, 8, 9, 9, 9, 9, 10, 10, 10, 11, 11, 11, 11, 12, 12, 12,
+    10, 9, 9, 9, 10, 10, 10, 10, 10, 11, 11, 11, 11, 12, 13, 12,
+    10, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11, 12, 12, 12, 13,
+    11, 10, 9, 10, 10, 10, 11, 11, 11, 11, 11, 11, 12, 12, 13, 13,
+    11, 10, 10, 10, 10, 11, 11, 11, 11, 12, 12, 12, 12, 12, 13, 13,
+    12, 11, 11, 11, 11, 11, 11, 11, 12, 12, 12, 12, 13, 13, 12, 13,
+    12, 11, 11, 11, 11, 11, 11, 12, 12, 12, 12, 12, 13, 13, 13, 13
+};
+
+static const unsigned short huffmanCodes16[256] = {
+    1, 5, 14, 44, 74, 63, 110, 93, 172, 149, 138, 242, 225, 195, 376, 17,
+    3, 4, 12, 20, 35, 62, 53, 47, 83, 75, 68, 119, 201, 107, 207, 9,
+    15, 13, 23, 38, 67, 58, 103, 90, 161, 72, 127, 117, 110, 209, 206, 16,
+    45, 21, 39, 69, 64, 114, 99, 87, 158, 140, 252, 212, 199, 387, 365, 26,
+    75, 36, 68, 65, 115, 101, 179, 164, 155, 264, 246, 226, 395, 382, 362, 9,
+    66, 30, 59, 56, 102, 185, 173, 265, 142, 253, 232, 400, 388, 378, 445, 16,
+    111, 54, 52, 100, 184, 178, 160, 133, 257, 244, 228, 217, 385, 366, 715, 10,
+    98, 48, 91, 88, 165, 157, 148, 261, 248, 407, 397, 372, 380, 889, 884, 8,
+    85, 84, 81, 159, 156, 143, 260, 249, 427, 401, 392, 383, 727, 713, 708, 7,
+    154, 76, 73, 141, 131, 256, 245, 426, 406, 394, 384, 735, 359, 710, 352, 11,
+    139, 129, 67, 125, 247, 233, 229, 219, 393, 743, 737, 720, 885, 882, 439, 4,
+    243, 120, 118, 115, 227, 223, 396, 746, 742, 736, 721, 712, 706, 223, 436, 6,
+    202, 224, 222, 218, 216, 389, 386, 381, 364, 888, 443, 707, 440, 437, 1728, 4,
+    747, 211, 210, 208, 370, 379, 734, 723, 714, 1735, 883, 877, 876, 3459, 865, 2,
+    377, 369, 102, 187, 726, 722, 358, 711, 709, 866, 1734, 871, 3458, 870, 434, 0,
+    12, 10, 7, 11, 10, 17, 11, 9, 13, 12, 10, 7, 5, 3, 1, 3
+};
+
+static const unsigned char huffmanLengths16[256] = {
+    1, 4, 6, 8, 9, 9, 10, 10, 11, 11, 11, 12, 12, 12, 13, 9,
+    3, 4, 6, 7, 8, 9, 9, 9, 10, 10, 10, 11, 12, 11, 12, 8,
+    6, 6, 7, 8, 9, 9, 10, 10, 11, 10, 11, 11, 11, 12, 12, 9,
+    8, 7, 8, 9, 9, 10, 10, 10, 11, 11, 12, 12, 12, 13, 13, 10,
+    9, 8, 9, 9, 10, 10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 9,
+    9, 8, 9, 9, 10, 11, 11, 12, 11, 12, 12, 13, 13, 13, 14, 10,
+    10, 9, 9, 10, 11, 11, 11, 11, 12, 12, 12, 12, 13, 13, 14, 10,
+    10, 9, 10, 10, 11, 11, 11, 12, 12, 13, 13, 13, 13, 15, 15, 10,
+    10, 10, 10, 11, 11, 11, 12, 12, 13, 13, 13, 13, 14, 14, 14, 10,
+    11, 10, 10, 11, 11, 12, 12, 13, 13, 13, 13, 14, 13, 14, 13, 11,
+    11, 11, 10, 11, 12, 12, 12, 12, 13, 14, 14, 14, 15, 15, 14, 10,
+    12, 11, 11, 11, 12, 12, 13, 14, 14, 14, 14, 14, 14, 13, 14, 11,
+    12, 12, 12, 12, 12, 13, 13, 13, 13, 15, 14, 14, 14, 14, 16, 11,
+    14, 12, 12, 12, 13, 13, 14, 14, 14, 16, 15, 15, 15, 17, 15, 11,
+    13, 13, 11, 12, 14, 14, 13, 14, 14, 15, 16, 15, 17, 15, 14, 11,
+    9, 8, 8, 9, 9, 10, 10, 10, 11, 11, 11, 11, 11, 11, 11, 8
+};
+
+static const unsigned short huffmanCodes24[256] = {
+    15, 13, 46, 80, 146, 262, 248, 434, 426, 669, 653, 649, 621, 517, 1032, 88,
+    14, 12, 21, 38, 71, 130, 122, 216, 209, 198, 327, 345, 319, 297, 279, 42,
+    47, 22, 41, 74, 68, 128, 120, 221, 207, 194, 182, 340, 315, 295, 541, 18,
+    81, 39, 75, 70, 134, 125, 116, 220, 204, 190, 178, 325, 311, 293, 271, 16,
+    147, 72, 69, 135, 127, 118, 112, 210, 200, 188, 352, 323, 306, 285, 540, 14,
+    263, 66, 129, 126, 119, 114, 214, 202, 192, 180, 341, 317, 301, 281, 262, 12,
+    249, 123, 121, 117, 113, 215, 206, 195, 185, 347, 330, 308, 291, 272, 520, 10,
+    435, 115, 111, 109, 211, 203, 196, 187, 353, 332, 313, 298, 283, 531, 381, 17,
+    427, 212, 208, 205, 201, 193, 186, 177, 169, 320, 303, 286, 268, 514, 377, 16,
+    335, 199, 197, 191, 189, 181, 174, 333, 321, 305, 289, 275, 521, 379, 371, 11,
+    668, 184, 183, 179, 175, 344, 331, 314, 304, 290, 277, 530, 383, 373, 366, 10,
+    652, 346, 171, 168, 164, 318, 309, 299, 287, 276, 263, 513, 375, 368, 362, 6,
+    648, 322, 316, 312, 307, 302, 292, 284, 269, 261, 512, 376, 370, 364, 359, 4,
+    620, 300, 296, 294, 288, 282, 273, 266, 515, 380, 374, 369, 365, 361, 357, 2,
+    1033, 280, 278, 274, 267, 264, 259, 382, 378, 372, 367, 363, 360, 358, 356, 0,
+    43, 20, 19, 17, 15, 13, 11, 9, 7, 6, 4, 7, 5, 3, 1, 3
+};
+
+static const unsigned char huffmanLengths24[256] = {
+    4, 4, 6, 7, 8, 9, 9, 10, 10, 11, 11, 11, 11, 11, 12, 9,
+    4, 4, 5, 6, 7, 8, 8, 9, 9, 9, 10, 10, 10, 10, 10, 8,
+    6, 5, 6, 7, 7, 8, 8, 9, 9, 9, 9, 10, 10, 10, 11, 7,
+    7, 6, 7, 7, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 7,
+    8, 7, 7, 8, 8, 8, 8, 9, 9, 9, 10, 10, 10, 10, 11, 7,
+    9, 7, 8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 10, 7,
+    9, 8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 10, 11, 7,
+    10, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 10, 11, 11, 8,
+    10, 9, 9, 9, 9, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 8,
+    10, 9, 9, 9, 9, 9, 9, 10, 10, 10, 10, 10, 11, 11, 11, 8,
+    11, 9, 9, 9, 9, 10, 10, 10, 10, 10, 10, 11, 11, 11, 11, 8,
+    11, 10, 9, 9, 9, 10, 10, 10, 10, 10, 10, 11, 11, 11, 11, 8,
+    11, 10, 10, 10, 10, 10, 10, 10, 10, 10, 11, 11, 11, 11, 11, 8,
+    11, 10, 10, 10, 10, 10, 10, 10, 11, 11, 11, 11, 11, 11, 11, 8,
+    12, 10, 10, 10, 10, 10, 10, 11, 11, 11, 11, 11, 11, 11, 11, 8,
+    8, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 8, 8, 8, 8, 4
+};
+
+static const unsigned short huffmanCodesA[16] = {
+    1, 5, 4, 5, 6, 5, 4, 4, 7, 3, 6, 0, 7, 2, 3, 1
+};
+
+static const unsigned char huffmanLengthsA[16] = {
+    1, 4, 4, 5, 4, 6, 5, 6, 4, 5, 5, 6, 5, 6, 6, 6
+};
+
+// Polyphase synthesis window from ISO 11172-3 Annex B, taps 0-256.
+static const float synthesisWindowHalf[257] = {
+    0.000000000, -0.000015259, -0.000015259, -0.000015259, -0.000015259, -0.000015259, -0.000015259, -0.000030518,
+    -0.000030518, -0.000030518, -0.000030518, -0.000045776, -0.000045776, -0.000061035, -0.000061035, -0.000076294,
+    -0.000076294, -0.000091553, -0.000106812, -0.000106812, -0.000122070, -0.000137329, -0.000152588, -0.000167847,
+    -0.000198364, -0.000213623, -0.000244141, -0.000259399, -0.000289917, -0.000320435, -0.000366211, -0.000396729,
+    -0.000442505, -0.000473022, -0.000534058, -0.000579834, -0.000625610, -0.000686646, -0.000747681, -0.000808716,
+    -0.000885010, -0.000961304, -0.001037598, -0.001113892, -0.001205444, -0.001296997, -0.001388550, -0.001480103,
+    -0.001586914, -0.001693726, -0.001785278, -0.001907349, -0.002014160, -0.002120972, -0.002243042, -0.002349854,
+    -0.002456665, -0.002578735, -0.002685547, -0.002792358, -0.002899170, -0.002990723, -0.003082275, -0.003173828,
+    0.003250122, 0.003326416, 0.003387451, 0.003433228, 0.003463745, 0.003479004, 0.003479004, 0.003463745,
+    0.003417969, 0.003372192, 0.003280640, 0.003173828, 0.003051758, 0.002883911, 0.002700806, 0.002487183,
+    0.002227783, 0.001937866, 0.001617432, 0.001266479, 0.000869751, 0.000442505, -0.000030518, -0.000549316,
+    -0.001098633, -0.001693726, -0.002334595, -0.003005981, -0.003723145, -0.004486084, -0.005294800, -0.006118774,
+    -0.007003784, -0.007919312, -0.008865356, -0.009841919, -0.010848999, -0.011886597, -0.012939453, -0.014022827,
+    -0.015121460, -0.016235352, -0.017349243, -0.018463135, -0.019577026, -0.020690918, -0.021789551, -0.022857666,
+    -0.023910522, -0.024932861, -0.025909424, -0.026840210, -0.027725220, -0.028533936, -0.029281616, -0.029937744,
+    -0.030532837, -0.031005859, -0.031387329, -0.031661987, -0.031814575, -0.031845093, -0.031738281, -0.031478882,
+    0.031082153, 0.030517578, 0.029785156, 0.028884888, 0.027801514, 0.026535034, 0.025085449, 0.023422241,
+    0.021575928, 0.019531250, 0.017257690, 0.014801025, 0.012115479, 0.009231567, 0.006134033, 0.002822876,
+    -0.000686646, -0.004394531, -0.008316040, -0.012420654, -0.016708374, -0.021179199, -0.025817871, -0.030609131,
+    -0.035552979, -0.040634155, -0.045837402, -0.051132202, -0.056533813, -0.061996460, -0.067520142, -0.073059082,
+    -0.078628540, -0.084182739, -0.089706421, -0.095169067, -0.100540161, -0.105819702, -0.110946655, -0.115921021,
+    -0.120697021, -0.125259399, -0.129562378, -0.133590698, -0.137298584, -0.140670776, -0.143676758, -0.146255493,
+    -0.148422241, -0.150115967, -0.151306152, -0.151962280, -0.152069092, -0.151596069, -0.150497437, -0.148773193,
+    -0.146362305, -0.143264771, -0.139450073, -0.134887695, -0.129577637, -0.123474121, -0.116577148, -0.108856201,
+    0.100311279, 0.090927124, 0.080688477, 0.069595337, 0.057617187, 0.044784546, 0.031082153, 0.016510010,
+    0.001068115, -0.015228271, -0.032379150, -0.050354004, -0.069168091, -0.088775635, -0.109161377, -0.130310059,
+    -0.152206421, -0.174789429, -0.198059082, -0.221984863, -0.246505737, -0.271591187, -0.297210693, -0.323318481,
+    -0.349868774, -0.376800537, -0.404083252, -0.431655884, -0.459472656, -0.487472534, -0.515609741, -0.543823242,
+    -0.572036743, -0.600219727, -0.628295898, -0.656219482, -0.683914185, -0.711318970, -0.738372803, -0.765029907,
+    -0.791213989, -0.816864014, -0.841949463, -0.866363525, -0.890090942, -0.913055420, -0.935195923, -0.956481934,
+    -0.976852417, -0.996246338, -1.014617920, -1.031936646, -1.048156738, -1.063217163, -1.077117920, -1.089782715,
+    -1.101211548, -1.111373901, -1.120223999, -1.127746582, -1.133926392, -1.138763428, -1.142211914, -1.144287109,
+    1.144989014
+};
+
+struct HuffmanTable {
+    const unsigned short* codes;
+    const unsigned char* lengths;
+    int width;
+};
+
+// The distinct code tables; tables 16-23 and 24-31 share their codes and
+// only differ in linbits.
+static const HuffmanTable huffmanTables[16] = {
+    { huffmanCodes1, huffmanLengths1, 2 },
+    { huffmanCodes2, huffmanLengths2, 3 },
+    { huffmanCodes3, huffmanLengths3, 3 },
+    { huffmanCodes5, huffmanLengths5, 4 },
+    { huffmanCodes6, huffmanLengths6, 4 },
+    { huffmanCodes7, huffmanLengths7, 6 },
+    { huffmanCodes8, huffmanLengths8, 6 },
+    { huffmanCodes9, huffmanLengths9, 6 },
+    { huffmanCodes10, huffmanLengths10, 8 },
+    { huffmanCodes11, huffmanLengths11, 8 },
+    { huffmanCodes12, huffmanLengths12, 8 },
+    { huffmanCodes13, huffmanLengths13, 16 },
+    { huffmanCodes15, huffmanLengths15, 16 },
+    { huffmanCodes16, huffmanLengths16, 16 },
+    { huffmanCodes24, huffmanLengths24, 16 },
+    { huffmanCodesA, huffmanLengthsA, 16 }
+};
+
+// Code table (index into huffmanTables, -1 for none) and linbits of each
+// table_select value.
+static const signed char huffmanTableIndex[32] = {
+    -1, 0, 1, 2, -1, 3, 4, 5, 6, 7, 8, 9, 10, 11, -1, 12,
+    13, 13, 13, 13, 13, 13, 13, 13, 14, 14, 14, 14, 14, 14, 14, 14
+};
+static const unsigned char huffmanLinbits[32] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 2, 3, 4, 6, 8, 10, 13, 4, 5, 6, 7, 8, 9, 11, 13
+};
+
+#define COUNT1_TABLE_A 15
+
+// Decoding trees built from the tables above. Each node holds its two
+// children: a positive node index, or -(symbol + 1) for a leaf. Symbols of
+// pair tables are x * 16 + y.
+static short huffmanTrees[16][256][2];
+
+// |x|^(4/3) for every quantized value a spectrum line can hold.
+#define POW43_SIZE (8191 + 16)
+static float pow43[POW43_SIZE];
+
+static float imdctLong[36][18];
+static float imdctShort[12][6];
+static float blockWindows[4][36];
+static float aliasSin[8];
+static float aliasCos[8];
+static float synthesisWindow[512];
+static float synthesisMatrix[64][32];
+static float intensityRatios[7][2];
+
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
+
+static void buildTables()
+{
+    for (int t = 0; t < 16; t++) {
+        const HuffmanTable& table = huffmanTables[t];
+        int count = table.width * table.width;
+        int nodes = 1;
+        if (t == COUNT1_TABLE_A)
+            count = 16;
+        for (int i = 0; i < count; i++) {
+            int symbol = t == COUNT1_TABLE_A ? i : (i / table.width) * 16 + i % table.width;
+            int length = table.lengths[i];
+            int node = 0;
+            for (int bit = length - 1; bit > 0; bit--) {
+                int branch = (table.codes[i] >> bit) & 1;
+                if (!huffmanTrees[t][node][branch])
+                    huffmanTrees[t][node][branch] = nodes++;
+                node = huffmanTrees[t][node][branch];
+            }
+            huffmanTrees[t][node][table.codes[i] & 1] = -(symbol + 1);
+        }
+    }
+
+    for (int i = 0; i < POW43_SIZE; i++)
+        pow43[i] = (float)pow((double)i, 4.0 / 3.0);
+
+    for (int i = 0; i < 36; i++)
+        for (int k = 0; k < 18; k++)
+            imdctLong[i][k] = (float)cos(M_PI / 72 * (2 * i + 19) * (2 * k + 1));
+    for (int i = 0; i < 12; i++)
+        for (int k = 0; k < 6; k++)
+            imdctShort[i][k] = (float)cos(M_PI / 24 * (2 * i + 7) * (2 * k + 1));
+
+    // Normal, start, short and stop windows, by block_type.
+    for (int i = 0; i < 36; i++) {
+        float normal = (float)sin(M_PI / 36 * (i + 0.5));
+        blockWindows[0][i] = normal;
+        blockWindows[1][i] = i < 18 ? normal : i < 24 ? 1.0f : i < 30 ? (float)sin(M_PI / 12 * (i - 18 + 0.5)) : 0.0f;
+        blockWindows[3][i] = i < 6 ? 0.0f : i < 12 ? (float)sin(M_PI / 12 * (i - 6 + 0.5)) : i < 18 ? 1.0f : normal;
+        blockWindows[2][i] = i < 12 ? (float)sin(M_PI / 12 * (i + 0.5)) : 0.0f;
+    }
+
+    for (int i = 0; i < 8; i++) {
+        double scale = sqrt(1.0 + aliasCoefficients[i] * aliasCoefficients[i]);
+        aliasCos[i] = (float)(1.0 / scale);
+        aliasSin[i] = (float)(aliasCoefficients[i] / scale);
+    }
+
+    // The window is the symmetric prototype filter with every other block
+    // of 64 taps negated; only its first half is tabulated.
+    for (int i = 0; i < 512; i++) {
+        if (i <= 256) {
+            synthesisWindow[i] = synthesisWindowHalf[i];
+        }
+        else {
+            int mirror = 512 - i;
+            bool flip = ((mirror / 64) & 1) != ((i / 64) & 1);
+            synthesisWindow[i] = flip ? -synthesisWindowHalf[mirror] : synthesisWindowHalf[mirror];
+        }
+    }
+    for (int i = 0; i < 64; i++)
+        for (int k = 0; k < 32; k++)
+            synthesisMatrix[i][k] = (float)cos((16 + i) * (2 * k + 1) * M_PI / 64);
+
+    for (int i = 0; i < 7; i++) {
+        double angle = i * M_PI / 12;
+        double sum = sin(angle) + cos(angle);
+        intensityRatios[i][0] = (float)(sin(angle) / sum);
+        intensityRatios[i][1] = (float)(cos(angle) / sum);
+    }
+}
+
+// MSB-first reader over a block of main data. Reads past the end return
+// zeros, so a corrupt granule cannot run off the buffer.
+struct BitReader {
+    const unsigned char* data;
+    int size;
+    int position;
+
+    unsigned int read(int count) {
+        if (count == 0)
+            return 0;
+        int byte = position >> 3;
+        unsigned int window = 0;
+        for (int i = 0; i < 4; i++)
+            window = (window << 8) | (byte + i < size ? data[byte + i] : 0);
+        window <<= position & 7;
+        position += count;
+        return window >> (32 - count);
+    }
+
+    int bit() {
+        int byte = position >> 3;
+        int value = byte < size ? (data[byte] >> (7 - (position & 7))) & 1 : 0;
+        position++;
+        return value;
+    }
+};
+
+static int huffmanSymbol(const short (*tree)[2], BitReader& bits)
+{
+    int node = 0;
+    for (;;) {
+        int next = tree[node][bits.bit()];
+        if (next < 0)
+            return -next - 1;
+        if (next == 0)
+            return 0;
+        node = next;
+    }
+}
+
+struct Granule {
+    int part23Length;
+    int bigValues;
+    int globalGain;
+    int scalefacCompress;
+    int blockType;
+    bool mixed;
+    int tableSelect[3];
+    int subblockGain[3];
+    int region0Count;
+    int region1Count;
+    int preflag;
+    int scalefacScale;
+    int count1Table;
+};
+
+struct SideInfo {
+    int mainDataBegin;
+    int scfsi[2];
+    Granule granules[2][2];
+};
+
+struct Scalefactors {
+    int longBand[22];
+    int shortBand[13][3];
+    // Highest legal intensity position per band, for MPEG-2 right channels.
+    int longLimit[22];
+    int shortLimit[13];
+};
+
+// A run of lines sharing one scalefactor: a long band, or one window of a
+// short band (window -1 for long). Lines are in bitstream order.
+struct BandSegment {
+    short start;
+    short width;
+    short band;
+    short window;
+};
+
+static int sideInfoSize(const Mp3Header& header)
+{
+    if (header.lsf)
+        return header.channels == 1 ? 9 : 17;
+    return header.channels == 1 ? 17 : 32;
+}
+
+static bool parseHeader(const unsigned char* p, Mp3Header& header)
+{
+    if (p[0] != 0xFF || (p[1] & 0xE0) != 0xE0)
+        return false;
+
+    // Version 0 is MPEG-2.5, 2 MPEG-2, 3 MPEG-1; layer 1 is Layer III.
+    int version = (p[1] >> 3) & 3;
+    int layer = (p[1] >> 1) & 3;
+    int bitrateIndex = p[2] >> 4;
+    int rateIndex = (p[2] >> 2) & 3;
+    if (version == 1 || layer != 1 || bitrateIndex == 0 || bitrateIndex == 15 || rateIndex == 3)
+        return false;
+
+    int shift = version == 3 ? 0 : version == 2 ? 1 : 2;
+    header.lsf = version != 3;
+    header.rateIndex = rateIndex + shift * 3;
+    header.rate = sampleRates[rateIndex] >> shift;
+    header.crc = !(p[1] & 1);
+    header.mode = p[3] >> 6;
+    header.modeExtension = (p[3] >> 4) & 3;
+    header.channels = header.mode == 3 ? 1 : 2;
+    header.samples = header.lsf ? 576 : 1152;
+    int bitrate = bitrates[header.lsf ? 1 : 0][bitrateIndex] * 1000;
+    header.size = (header.lsf ? 72 : 144) * bitrate / header.rate + ((p[2] >> 1) & 1);
+    return true;
+}
+
+static bool sameStream(const Mp3Header& a, const Mp3Header& b)
+{
+    return a.rateIndex == b.rateIndex && a.channels == b.channels;
+}
+
+static unsigned int readBE32(const unsigned char* p)
+{
+    return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+bool isMp3(const unsigned char* data, size_t size)
+{
+    if (size >= 3 && memcmp(data, "ID3", 3) == 0)
+        return true;
+    Mp3Header header;
+    return size >= 4 && parseHeader(data, header);
+}
+
+static void readSideInfo(BitReader& bits, const Mp3Header& header, SideInfo& side)
+{
+    int channels = header.channels;
+    int granules = header.lsf ? 1 : 2;
+
+    if (header.lsf) {
+        side.mainDataBegin = bits.read(8);
+        bits.read(channels == 1 ? 1 : 2);
+        side.scfsi[0] = side.scfsi[1] = 0;
+    }
+    else {
+        side.mainDataBegin = bits.read(9);
+        bits.read(channels == 1 ? 5 : 3);
+        for (int ch = 0; ch < channels; ch++)
+            side.scfsi[ch] = bits.read(4);
+    }
+
+    for (int gr = 0; gr < granules; gr++) {
+        for (int ch = 0; ch < channels; ch++) {
+            Granule& g = side.granules[gr][ch];
+            g.part23Length = bits.read(12);
+            g.bigValues = bits.read(9);
+            if (g.bigValues > 288)
+                g.bigValues = 288;
+            g.globalGain = bits.read(8);
+            g.scalefacCompress = bits.read(header.lsf ? 9 : 4);
+
+            if (bits.read(1)) {
+                // Window switching: region counts are implied.
+                g.blockType = bits.read(2);
+                g.mixed = bits.read(1) != 0;
+                g.tableSelect[0] = bits.read(5);
+                g.tableSelect[1] = bits.read(5);
+                g.tableSelect[2] = 0;
+                for (int w = 0; w < 3; w++)
+                    g.subblockGain[w] = bits.read(3);
+                g.region0Count = g.blockType == 2 && !g.mixed ? 8 : 7;
+                g.region1Count = 36;
+            }
+            else {
+                g.blockType = 0;
+                g.mixed = false;
+                for (int r = 0; r < 3; r++)
+                    g.tableSelect[r] = bits.read(5);
+                g.subblockGain[0] = g.subblockGain[1] = g.subblockGain[2] = 0;
+                g.region0Count = bits.read(4);
+                g.region1Count = bits.read(3);
+            }
+
+            g.preflag = header.lsf ? 0 : bits.read(1);
+            g.scalefacScale = bits.read(1);
+            g.count1Table = bits.read(1);
+        }
+    }
+}
+
+// Number of long bands below the switch to short blocks in a mixed block.
+static int mixedLongBands(int rateIndex)
+{
+    int bands = 0;
+    while (longBands[rateIndex][bands] < 36)
+        bands++;
+    return bands;
+}
+
+// Split a granule's spectrum into the runs its scalefactors cover.
+static int bandSegments(const Granule& g, int rateIndex, BandSegment* segments)
+{
+    int count = 0;
+    int firstShort = 0;
+    if (g.blockType != 2 || g.mixed) {
+        int bands = g.blockType == 2 ? mixedLongBands(rateIndex) : 22;
+        for (int b = 0; b < bands; b++) {
+            BandSegment segment = { longBands[rateIndex][b],
+                                    (short)(longBands[rateIndex][b + 1] - longBands[rateIndex][b]), (short)b, -1 };
+            segments[count++] = segment;
+        }
+        if (g.blockType != 2)
+            return count;
+        firstShort = 3;
+    }
+
+    for (int b = firstShort; b < 13; b++) {
+        short width = shortBands[rateIndex][b + 1] - shortBands[rateIndex][b];
+        for (int w = 0; w < 3; w++) {
+            BandSegment segment = { (short)(shortBands[rateIndex][b] * 3 + w * width), width, (short)b, (short)w };
+            segments[count++] = segment;
+        }
+    }
+    return count;
+}
+
+// Read a channel's scalefactors; MPEG-2 frames also imply its preflag.
+static void readScalefactors(BitReader& bits, const Mp3Header& header, Granule& g, int gr, int ch,
+                             int scfsi, Scalefactors& sf)
+{
+    if (!header.lsf) {
+        int slen1 = scalefactorLengths[0][g.scalefacCompress];
+        int slen2 = scalefactorLengths[1][g.scalefacCompress];
+
+        if (g.blockType == 2) {
+            int band = 0;
+            if (g.mixed) {
+                for (int b = 0; b < 8; b++)
+                    sf.longBand[b] = bits.read(slen1);
+                band = 3;
+            }
+            for (; band < 12; band++)
+                for (int w = 0; w < 3; w++)
+                    sf.shortBand[band][w] = bits.read(band < 6 ? slen1 : slen2);
+            sf.shortBand[12][0] = sf.shortBand[12][1] = sf.shortBand[12][2] = 0;
+        }
+        else {
+            // Granule 1 may reuse granule 0's scalefactors group by group.
+            static const int groups[5] = { 0, 6, 11, 16, 21 };
+            for (int k = 0; k < 4; k++) {
+                if (gr == 0 || !(scfsi & (8 >> k))) {
+                    for (int b = groups[k]; b < groups[k + 1]; b++)
+                        sf.longBand[b] = bits.read(k < 2 ? slen1 : slen2);
+                }
+            }
+            sf.longBand[21] = 0;
+        }
+        return;
+    }
+
+    // MPEG-2 packs four groups of scalefactors whose sizes depend on a
+    // split of scalefac_compress, differently for intensity coded channels.
+    int lengths[4] = { 0, 0, 0, 0 };
+    int range;
+    int compress = g.scalefacCompress;
+    bool intensityChannel = ch == 1 && (header.modeExtension & 1) && header.mode == 1;
+    g.preflag = 0;
+    if (!intensityChannel) {
+        if (compress < 400) {
+            lengths[0] = (compress >> 4) / 5;
+            lengths[1] = (compress >> 4) % 5;
+            lengths[2] = (compress & 15) >> 2;
+            lengths[3] = compress & 3;
+            range = 0;
+        }
+        else if (compress < 500) {
+            compress -= 400;
+            lengths[0] = (compress >> 2) / 5;
+            lengths[1] = (compress >> 2) % 5;
+            lengths[2] = compress & 3;
+            range = 1;
+        }
+        else {
+            compress -= 500;
+            lengths[0] = compress / 3;
+            lengths[1] = compress % 3;
+            g.preflag = 1;
+            range = 2;
+        }
+    }
+    else {
+        compress >>= 1;
+        if (compress < 180) {
+            lengths[0] = compress / 36;
+            lengths[1] = (compress % 36) / 6;
+            lengths[2] = (compress % 36) % 6;
+            range = 3;
+        }
+        else if (compress < 244) {
+            compress -= 180;
+            lengths[0] = (compress & 63) >> 4;
+            lengths[1] = (compress & 15) >> 2;
+            lengths[2] = compress & 3;
+            range = 4;
+        }
+        else {
+            compress -= 244;
+            lengths[0] = compress / 3;
+            lengths[1] = compress % 3;
+            range = 5;
+        }
+    }
+
+    int kind = g.blockType != 2 ? 0 : g.mixed ? 2 : 1;
+    int values[39];
+    int limits[39];
+    int count = 0;
+    for (int k = 0; k < 4; k++) {
+        for (int n = 0; n < lsfScalefactorCounts[range][kind][k]; n++) {
+            values[count] = bits.read(lengths[k]);
+            limits[count++] = (1 << lengths[k]) - 1;
+        }
+    }
+
+    int index = 0;
+    if (g.blockType == 2) {
+        int band = 0;
+        if (g.mixed) {
+            for (int b = 0; b < 6; b++) {
+                sf.longLimit[b] = limits[index];
+                sf.longBand[b] = values[index++];
+            }
+            band = 3;
+        }
+        for (; band < 12; band++) {
+            sf.shortLimit[band] = limits[index];
+            for (int w = 0; w < 3; w++)
+                sf.shortBand[band][w] = values[index++];
+        }
+        sf.shortBand[12][0] = sf.shortBand[12][1] = sf.shortBand[12][2] = 0;
+        sf.shortLimit[12] = sf.shortLimit[11];
+    }
+    else {
+        for (int b = 0; b < 21; b++) {
+            sf.longLimit[b] = limits[index];
+            sf.longBand[b] = values[index++];
+        }
+        sf.longBand[21] = 0;
+        sf.longLimit[21] = sf.longLimit[20];
+    }
+}
+
+// Huffman decode one granule's spectrum, up to end in bits, and return the
+// number of lines that may be nonzero.
+static int readSpectrum(BitReader& bits, int end, const Granule& g, int rateIndex, int* values)
+{
+    int region1;
+    int region2;
+    if (g.blockType == 2 && !g.mixed) {
+        region1 = shortBands[rateIndex][3] * 3;
+        region2 = 576;
+    }
+    else if (g.blockType != 0) {
+        region1 = longBands[rateIndex][8];
+        region2 = 576;
+    }
+    else {
+        int r1 = g.region0Count + 1;
+        int r2 = r1 + g.region1Count + 1;
+        region1 = longBands[rateIndex][r1 > 22 ? 22 : r1];
+        region2 = longBands[rateIndex][r2 > 22 ? 22 : r2];
+    }
+
+    int bigEnd = g.bigValues * 2;
+    int line = 0;
+    for (int region = 0; region < 3 && line < bigEnd; region++) {
+        int limit = region == 0 ? region1 : region == 1 ? region2 : 576;
+        if (limit > bigEnd)
+            limit = bigEnd;
+
+        int select = g.tableSelect[region];
+        int table = huffmanTableIndex[select];
+        int linbits = huffmanLinbits[select];
+        if (table < 0) {
+            for (; line < limit; line++)
+                values[line] = 0;
+            continue;
+        }
+
+        const short (*tree)[2] = huffmanTrees[table];
+        for (; line < limit; line += 2) {
+            int symbol = huffmanSymbol(tree, bits);
+            int x = symbol >> 4;
+            int y = symbol & 15;
+            if (x == 15 && linbits)
+                x += bits.read(linbits);
+            if (x && bits.bit())
+                x = -x;
+            if (y == 15 && linbits)
+                y += bits.read(linbits);
+            if (y && bits.bit())
+                y = -y;
+            values[line] = x;
+            values[line + 1] = y;
+        }
+    }
+
+    // Quadruples of values in -1..1 follow until the granule's bits run out.
+    while (line + 4 <= 576 && bits.position < end) {
+        int start = bits.position;
+        int symbol;
+        if (g.count1Table)
+            symbol = 15 - bits.read(4);
+        else
+            symbol = huffmanSymbol(huffmanTrees[COUNT1_TABLE_A], bits);
+
+        for (int i = 0; i < 4; i++) {
+            int value = (symbol >> (3 - i)) & 1;
+            if (value && bits.bit())
+                value = -1;
+            values[line + i] = value;
+        }
+
+        // A quadruple running past the end is stuffing, not data.
+        if (bits.position > end) {
+            bits.position = start;
+            break;
+        }
+        line += 4;
+    }
+
+    for (int i = line; i < 576; i++)
+        values[i] = 0;
+    bits.position = end;
+    return line;
+}
+
+// Scale quantized values back to spectrum lines.
+static void requantize(const int* values, int lines, const Granule& g, const Scalefactors& sf,
+                       const BandSegment* segments, int segmentCount, float* xr)
+{
+    double shift = g.scalefacScale ? 1.0 : 0.5;
+    for (int s = 0; s < segmentCount; s++) {
+        const BandSegment& segment = segments[s];
+        if (segment.start >= lines) {
+            for (int i = segment.start; i < segment.start + segment.width; i++)
+                xr[i] = 0.0f;
+            continue;
+        }
+
+        double exponent = 0.25 * (g.globalGain - 210);
+        if (segment.window < 0)
+            exponent -= shift * (sf.longBand[segment.band] + g.preflag * pretab[segment.band]);
+        else
+            exponent -= 2.0 * g.subblockGain[segment.window] + shift * sf.shortBand[segment.band][segment.window];
+        float scale = (float)pow(2.0, exponent);
+
+        for (int i = segment.start; i < segment.start + segment.width; i++) {
+            int value = values[i];
+            if (value >= POW43_SIZE)
+                value = POW43_SIZE - 1;
+            else if (value <= -POW43_SIZE)
+                value = 1 - POW43_SIZE;
+            xr[i] = value >= 0 ? pow43[value] * scale : -pow43[-value] * scale;
+        }
+    }
+}
+
+static void midSide(float* left, float* right, int start, int end)
+{
+    const float scale = (float)M_SQRT1_2;
+    for (int i = start; i < end; i++) {
+        float mid = left[i];
+        float side = right[i];
+        left[i] = (mid + side) * scale;
+        right[i] = (mid - side) * scale;
+    }
+}
+
+static bool segmentSilent(const float* xr, const BandSegment& segment)
+{
+    for (int i = segment.start; i < segment.start + segment.width; i++) {
+        if (xr[i] != 0.0f)
+            return false;
+    }
+    return true;
+}
+
+// Joint stereo: mid/side and intensity coding. Intensity bands are those
+// above the last nonzero band of the right channel, per short window.
+static void jointStereo(const Mp3Header& header, const Granule& g, const Scalefactors& right,
+                        const BandSegment* segments, int segmentCount, float* xr0, float* xr1)
+{
+    bool ms = (header.modeExtension & 2) != 0;
+    if (!(header.modeExtension & 1)) {
+        if (ms)
+            midSide(xr0, xr1, 0, 576);
+        return;
+    }
+
+    int lastLong = -1;
+    int lastShort[3] = { -1, -1, -1 };
+    bool shortData = false;
+    for (int s = 0; s < segmentCount; s++) {
+        if (segmentSilent(xr1, segments[s]))
+            continue;
+        if (segments[s].window < 0) {
+            lastLong = segments[s].band;
+        }
+        else {
+            lastShort[segments[s].window] = segments[s].band;
+            shortData = true;
+        }
+    }
+
+    for (int s = 0; s < segmentCount; s++) {
+        const BandSegment& segment = segments[s];
+        int band = segment.band;
+        bool intensity;
+        int position;
+        int limit;
+        if (segment.window < 0) {
+            intensity = !shortData && band > lastLong;
+            position = right.longBand[band < 21 ? band : 20];
+            limit = right.longLimit[band];
+        }
+        else {
+            intensity = band > lastShort[segment.window];
+            position = right.shortBand[band < 12 ? band : 11][segment.window];
+            limit = right.shortLimit[band];
+        }
+
+        int end = segment.start + segment.width;
+        if (intensity && (header.lsf ? position == limit : position >= 7))
+            intensity = false;
+
+        if (!intensity) {
+            if (ms)
+                midSide(xr0, xr1, segment.start, end);
+            continue;
+        }
+
+        float left;
+        float rightScale;
+        if (!header.lsf) {
+            left = intensityRatios[position][0];
+            rightScale = intensityRatios[position][1];
+        }
+        else {
+            // MPEG-2 positions step by a quarter or half of -3 dB.
+            double base = (g.scalefacCompress & 1) ? M_SQRT1_2 : pow(2.0, -0.25);
+            left = 1.0f;
+            rightScale = 1.0f;
+            if (position & 1)
+                left = (float)pow(base, (position + 1) / 2);
+            else
+                rightScale = (float)pow(base, position / 2);
+        }
+
+        for (int i = segment.start; i < end; i++) {
+            float value = xr0[i];
+            xr0[i] = value * left;
+            xr1[i] = value * rightScale;
+        }
+    }
+}
+
+// Interleave the three windows of each short band so that each subband's
+// 18 lines hold six values per window, as the short IMDCT expects.
+static void reorder(float* xr, const BandSegment* segments, int segmentCount)
+{
+    float band[576];
+    for (int s = 0; s < segmentCount; s++) {
+        if (segments[s].window != 0)
+            continue;
+        int start = segments[s].start;
+        int width = segments[s].width;
+        for (int w = 0; w < 3; w++)
+            for (int k = 0; k < width; k++)
+                band[3 * k + w] = xr[start + w * width + k];
+        memcpy(xr + start, band, 3 * width * sizeof(float));
+    }
+}
+
+static void antialias(float* xr, int subbands)
+{
+    for (int sb = 1; sb < subbands; sb++) {
+        float* lower = xr + sb * 18 - 1;
+        float* upper = xr + sb * 18;
+        for (int i = 0; i < 8; i++) {
+            float a = lower[-i];
+            float b = upper[i];
+            lower[-i] = a * aliasCos[i] - b * aliasSin[i];
+            upper[i] = b * aliasCos[i] + a * aliasSin[i];
+        }
+    }
+}
+
+// Inverse MDCT, windowing and overlap-add of each subband, producing 18
+// samples per subband in time order.
+static void hybridSynthesis(const float* xr, const Granule& g, float* overlap, float (*subbands)[32])
+{
+    for (int sb = 0; sb < 32; sb++) {
+        const float* in = xr + sb * 18;
+        float* previous = overlap + sb * 18;
+        float out[36];
+
+        bool silent = true;
+        for (int k = 0; k < 18 && silent; k++)
+            silent = in[k] == 0.0f;
+
+        if (silent) {
+            for (int i = 0; i < 36; i++)
+                out[i] = 0.0f;
+        }
+        else if (g.blockType != 2 || (g.mixed && sb < 2)) {
+            const float* window = blockWindows[g.blockType == 2 ? 0 : g.blockType];
+            for (int i = 0; i < 36; i++) {
+                float sum = 0.0f;
+                for (int k = 0; k < 18; k++)
+                    sum += in[k] * imdctLong[i][k];
+                out[i] = sum * window[i];
+            }
+        }
+        else {
+            for (int i = 0; i < 36; i++)
+                out[i] = 0.0f;
+            for (int w = 0; w < 3; w++) {
+                for (int i = 0; i < 12; i++) {
+                    float sum = 0.0f;
+                    for (int k = 0; k < 6; k++)
+                        sum += in[3 * k + w] * imdctShort[i][k];
+                    out[6 + 6 * w + i] += sum * blockWindows[2][i];
+                }
+            }
+        }
+
+        for (int i = 0; i < 18; i++) {
+            float sample = out[i] + previous[i];
+            previous[i] = out[i + 18];
+            // Odd subbands come out of the filterbank frequency inverted.
+            if ((sb & 1) && (i & 1))
+                sample = -sample;
+            subbands[i][sb] = sample;
+        }
+    }
+}
+
+Mp3Decoder::Mp3Decoder() :
+        m_data(0), m_size(0), m_audioStart(0), m_position(0),
+        m_skip(0), m_remaining(0), m_initialSkip(0), m_reservoirSize(0),
+        m_pcmFrames(0), m_pcmPosition(0) {
+    pthread_once(&tablesOnce, buildTables);
+    memset(&m_info, 0, sizeof(m_info));
+    memset(&m_stream, 0, sizeof(m_stream));
+    m_synthesisOffset[0] = m_synthesisOffset[1] = 0;
+}
+
+bool Mp3Decoder::open(const unsigned char* data, size_t size) {
+    m_data = data;
+    m_size = size;
+
+    // Skip any ID3v2 tags in front of the first frame.
+    size_t offset = 0;
+    while (offset + 10 <= size && memcmp(data + offset, "ID3", 3) == 0) {
+        const unsigned char* tag = data + offset;
+        size_t length = ((tag[6] & 0x7F) << 21) | ((tag[7] & 0x7F) << 14) | ((tag[8] & 0x7F) << 7) | (tag[9] & 0x7F);
+        offset += 10 + length + ((tag[5] & 0x10) ? 10 : 0);
+    }
+
+    Mp3Header header;
+    offset = findFrame(offset, 0, header);
+    if (offset >= size)
+        return false;
+
+    m_stream = header;
+    m_info.rate = header.rate;
+    m_info.channels = header.channels;
+    m_info.frameSamples = header.samples;
+    m_info.delay = 0;
+    m_info.padding = 0;
+
+    // A Xing/Info or VBRI frame carries only the frame count and gapless
+    // info; otherwise count the frames by walking their headers.
+    long frames = -1;
+    bool gapless = false;
+    m_audioStart = offset;
+    if (readTag(offset, header, frames, gapless))
+        m_audioStart = offset + header.size;
+    if (frames < 0) {
+        frames = 0;
+        for (size_t p = nextFrame(m_audioStart, header); p < m_size; p = nextFrame(p + header.size, header))
+            frames++;
+    }
+
+    m_info.frames = frames * m_info.frameSamples;
+    m_initialSkip = 0;
+    if (gapless) {
+        m_info.frames -= m_info.delay + m_info.padding;
+        m_initialSkip = m_info.delay + MP3_DECODER_DELAY;
+    }
+    if (m_info.frames < 0)
+        m_info.frames = 0;
+
+    rewind();
+    return true;
+}
+
+bool Mp3Decoder::readTag(size_t offset, const Mp3Header& header, long& frames, bool& gapless) {
+    const unsigned char* frame = m_data + offset;
+    const unsigned char* end = frame + header.size;
+    if (end > m_data + m_size)
+        end = m_data + m_size;
+
+    const unsigned char* xing = frame + 4 + (header.crc ? 2 : 0) + sideInfoSize(header);
+    if (xing + 8 <= end && (memcmp(xing, "Xing", 4) == 0 || memcmp(xing, "Info", 4) == 0)) {
+        unsigned int flags = readBE32(xing + 4);
+        const unsigned char* p = xing + 8;
+        if ((flags & 1) && p + 4 <= end)
+            frames = readBE32(p);
+        p += (flags & 1 ? 4 : 0) + (flags & 2 ? 4 : 0) + (flags & 4 ? 100 : 0) + (flags & 8 ? 4 : 0);
+
+        // LAME, and ffmpeg after it, extend the tag with the encoder delay
+        // and the padding added to fill the last frame.
+        if (p + 24 <= end && (memcmp(p, "LAME", 4) == 0 || memcmp(p, "Lavc", 4) == 0 || memcmp(p, "Lavf", 4) == 0)) {
+            m_info.delay = (p[21] << 4) | (p[22] >> 4);
+            m_info.padding = ((p[22] & 15) << 8) | p[23];
+            gapless = true;
+        }
+        return true;
+    }
+
+    const unsigned char* vbri = frame + 36;
+    if (vbri + 18 <= end && memcmp(vbri, "VBRI", 4) == 0) {
+        frames = readBE32(vbri + 14);
+        return true;
+    }
+    return false;
+}
+
+size_t Mp3Decoder::findFrame(size_t offset, const Mp3Header* stream, Mp3Header& header) const {
+    // Accept a sync word only when another frame, or the ID3v1 tag, follows
+    // where the header says this frame ends.
+    for (; offset + 4 <= m_size; offset++) {
+        if (!parseHeader(m_data + offset, header) || (stream && !sameStream(*stream, header)))
+            continue;
+
+        size_t next = offset + header.size;
+        if (next + 4 > m_size) {
+            if (next <= m_size && stream)
+                return offset;
+            continue;
+        }
+
+        Mp3Header following;
+        if (memcmp(m_data + next, "TAG", 3) == 0 ||
+            (parseHeader(m_data + next, following) && sameStream(header, following)))
+            return offset;
+    }
+    return m_size;
+}
+
+size_t Mp3Decoder::nextFrame(size_t offset, Mp3Header& header) const {
+    if (offset + 4 <= m_size && parseHeader(m_data + offset, header) &&
+        sameStream(m_stream, header) && offset + header.size <= m_size)
+        return offset;
+    return findFrame(offset, &m_stream, header);
+}
+
+void Mp3Decoder::rewind() {
+    m_position = m_audioStart;
+    m_skip = m_initialSkip;
+    m_remaining = m_info.frames;
+    m_reservoirSize = 0;
+    m_pcmFrames = 0;
+    m_pcmPosition = 0;
+    memset(m_overlap, 0, sizeof(m_overlap));
+    memset(m_synthesis, 0, sizeof(m_synthesis));
+    m_synthesisOffset[0] = m_synthesisOffset[1] = 0;
+}
+
+int Mp3Decoder::read(short* out, int frames) {
+    int channels = m_info.channels;
+    int written = 0;
+    while (written < frames && m_remaining > 0) {
+        if (m_pcmPosition == m_pcmFrames) {
+            if (!decodeFrame())
+                break;
+            // Drop the encoder and decoder delay from the front.
+            int drop = m_skip < m_pcmFrames ? (int)m_skip : m_pcmFrames;
+            m_pcmPosition = drop;
+            m_skip -= drop;
+            continue;
+        }
+
+        int count = m_pcmFrames - m_pcmPosition;
+        if (count > frames - written)
+            count = frames - written;
+        if (count > m_remaining)
+            count = m_remaining;
+        memcpy(out + written * channels, m_pcm + m_pcmPosition * channels, count * channels * sizeof(short));
+        m_pcmPosition += count;
+        m_remaining -= count;
+        written += count;
+    }
+    return written;
+}
+
+bool Mp3Decoder::decodeFrame() {
+    Mp3Header header;
+    size_t offset = nextFrame(m_position, header);
+    if (offset >= m_size)
+        return false;
+    m_position = offset + header.size;
+
+    const unsigned char* frame = m_data + offset;
+    int channels = header.channels;
+    int granules = header.lsf ? 1 : 2;
+    int headerSize = 4 + (header.crc ? 2 : 0);
+    int sideSize = sideInfoSize(header);
+    m_pcmFrames = header.samples;
+    m_pcmPosition = 0;
+
+    if (headerSize + sideSize > header.size) {
+        memset(m_pcm, 0, sizeof(m_pcm));
+        return true;
+    }
+
+    BitReader sideBits = { frame + headerSize, sideSize, 0 };
+    SideInfo side;
+    readSideInfo(sideBits, header, side);
+
+    // Append this frame's main data to the bit reservoir. A frame that
+    // borrows more than the reservoir holds, such as the first one after a
+    // rewind, decodes as silence.
+    const unsigned char* mainData = frame + headerSize + sideSize;
+    int mainSize = header.size - headerSize - sideSize;
+    int begin = side.mainDataBegin;
+    bool complete = begin <= m_reservoirSize;
+    if (m_reservoirSize + mainSize > MP3_RESERVOIR_SIZE) {
+        int keep = MP3_RESERVOIR_SIZE - mainSize;
+        memmove(m_reservoir, m_reservoir + m_reservoirSize - keep, keep);
+        m_reservoirSize = keep;
+    }
+    memcpy(m_reservoir + m_reservoirSize, mainData, mainSize);
+    int dataStart = m_reservoirSize - begin;
+    m_reservoirSize += mainSize;
+
+    if (!complete) {
+        memset(m_pcm, 0, sizeof(m_pcm));
+        return true;
+    }
+
+    BitReader bits = { m_reservoir + dataStart, m_reservoirSize - dataStart, 0 };
+    Scalefactors scalefactors[2];
+    memset(scalefactors, 0, sizeof(scalefactors));
+
+    for (int gr = 0; gr < granules; gr++) {
+        float xr[2][576];
+        int lines[2];
+        BandSegment segments[2][39];
+        int segmentCounts[2];
+
+        for (int ch = 0; ch < channels; ch++) {
+            Granule& g = side.granules[gr][ch];
+            int end = bits.position + g.part23Length;
+            readScalefactors(bits, header, g, gr, ch, side.scfsi[ch], scalefactors[ch]);
+
+            int values[576];
+            lines[ch] = readSpectrum(bits, end, g, header.rateIndex, values);
+            segmentCounts[ch] = bandSegments(g, header.rateIndex, segments[ch]);
+            requantize(values, lines[ch], g, scalefactors[ch], segments[ch], segmentCounts[ch], xr[ch]);
+        }
+
+        if (channels == 2 && header.mode == 1)
+            jointStereo(header, side.granules[gr][1], scalefactors[1], segments[1], segmentCounts[1], xr[0], xr[1]);
+
+        for (int ch = 0; ch < channels; ch++) {
+            const Granule& g = side.granules[gr][ch];
+            if (g.blockType == 2) {
+                reorder(xr[ch], segments[ch], segmentCounts[ch]);
+                if (g.mixed)
+                    antialias(xr[ch], 2);
+            }
+            else {
+                antialias(xr[ch], 32);
+            }
+
+            float subbands[18][32];
+            hybridSynthesis(xr[ch], g, m_overlap[ch], subbands);
+            synthesize(ch, subbands, m_pcm + gr * 576 * channels + ch, channels);
+        }
+    }
+    return true;
+}
+
+void Mp3Decoder::synthesize(int channel, float (*subbands)[32], short* out, int channels) {
+    float* v = m_synthesis[channel];
+    int offset = m_synthesisOffset[channel];
+
+    for (int t = 0; t < 18; t++) {
+        // Shift the 1024 sample history by 64 and matrix in the new slot.
+        offset = (offset - 64) & 1023;
+        const float* samples = subbands[t];
+        for (int i = 0; i < 64; i++) {
+            float sum = 0.0f;
+            for (int k = 0; k < 32; k++)
+                sum += synthesisMatrix[i][k] * samples[k];
+            v[offset + i] = sum;
+        }
+
+        // Window 16 taps of the history into each output sample.
+        for (int j = 0; j < 32; j++) {
+            float sum = 0.0f;
+            for (int i = 0; i < 16; i++) {
+                int index = 128 * (i >> 1) + ((i & 1) ? 96 : 0) + j;
+                sum += v[(offset + index) & 1023] * synthesisWindow[32 * i + j];
+            }
+
+            int sample = (int)(sum * 32768.0f + (sum >= 0.0f ? 0.5f : -0.5f));
+            if (sample > 32767)
+                sample = 32767;
+            else if (sample < -32768)
+                sample = -32768;
+            out[(t * 32 + j) * channels] = (short)sample;
+        }
+    }
+
+    m_synthesisOffset[channel] = offset;
+}
@@ -0,0 +1,111 @@
+/*
+* Copyright (c) 2013 BlackBerry Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+
+#ifndef Mp3Decoder_HPP_
+#define Mp3Decoder_HPP_
+
+#include <stddef.h>
+
+// Samples per channel in the longest Layer III frame.
+#define MP3_MAX_FRAME_SAMPLES 1152
+// Main data one frame may borrow from earlier frames, plus the frame itself.
+#define MP3_RESERVOIR_SIZE 4096
+
+// Stream properties read from the first frame and any Xing/Info, LAME or
+// VBRI tag, before decoding any audio.
+struct Mp3Info {
+    int rate;
+    int channels;
+    int frameSamples;       // samples per channel in each frame
+    long frames;            // samples per channel the decoder will produce
+    int delay;              // encoder delay and padding from a LAME tag,
+    int padding;            // trimmed off so loops stay gapless
+};
+
+// Layer III frame header fields.
+struct Mp3Header {
+    bool lsf;               // MPEG-2 or 2.5 low sampling frequency frame
+    int rateIndex;          // 0-8 across MPEG-1, 2 and 2.5
+    int rate;
+    int channels;
+    int mode;
+    int modeExtension;
+    bool crc;
+    int size;               // bytes, including the header
+    int samples;            // per channel
+};
+
+// Whether the data looks like an MPEG audio file: an ID3v2 tag or a frame
+// sync at the start.
+bool isMp3(const unsigned char* data, size_t size);
+
+// Self-contained MPEG-1/2/2.5 Layer III decoder. It reads frames straight
+// out of memory, such as a MappedFile, and produces interleaved 16 bit PCM
+// one frame at a time, so it serves both full decodes and streams.
+class Mp3Decoder {
+
+public:
+    Mp3Decoder();
+
+    // Find the first frame and read its tags; the data must outlive us.
+    bool open(const unsigned char* data, size_t size);
+    const Mp3Info& info() const { return m_info; }
+
+    // Decode up to frames samples per channel into out and return how many
+    // were written; 0 means the end of the stream.
+    int read(short* out, int frames);
+    // Restart from the first sample.
+    void rewind();
+
+private:
+    Mp3Decoder(const Mp3Decoder&);
+    Mp3Decoder& operator=(const Mp3Decoder&);
+
+    // Locate the next frame of this stream at or after offset, resyncing
+    // past junk; returns the data size when there are none left.
+    size_t nextFrame(size_t offset, Mp3Header& header) const;
+    size_t findFrame(size_t offset, const Mp3Header* stream, Mp3Header& header) const;
+    // Read a Xing/Info or VBRI tag frame; returns false for an audio frame.
+    bool readTag(size_t offset, const Mp3Header& header, long& frames, bool& gapless);
+    // Decode the next frame into m_pcm; returns false at the end.
+    bool decodeFrame();
+    void synthesize(int channel, float (*subbands)[32], short* out, int channels);
+
+    const unsigned char* m_data;
+    size_t m_size;
+    size_t m_audioStart;
+    size_t m_position;
+    Mp3Info m_info;
+    Mp3Header m_stream;
+
+    long m_skip;            // samples still to drop at the start
+    long m_remaining;       // samples still to produce
+    long m_initialSkip;
+
+    unsigned char m_reservoir[MP3_RESERVOIR_SIZE];
+    int m_reservoirSize;
+
+    float m_overlap[2][576];
+    float m_synthesis[2][1024];
+    int m_synthesisOffset[2];
+
+    short m_pcm[MP3_MAX_FRAME_SAMPLES * 2];
+    int m_pcmFrames;
+    int m_pcmPosition;
+};
+
+#endif /* Mp3Decoder_HPP_ */
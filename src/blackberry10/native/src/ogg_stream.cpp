@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2013 BlackBerry Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <qdebug.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "ogg_stream.hpp"
+
+static size_t oggMemoryRead(void* ptr, size_t size, size_t nmemb, void* datasource)
+{
+    OggMemorySource* source = static_cast<OggMemorySource*>(datasource);
+    size_t remaining = source->file->size() - source->position;
+    size_t count = size ? remaining / size : 0;
+    if (count > nmemb)
+        count = nmemb;
+
+    memcpy(ptr, source->file->data() + source->position, count * size);
+    source->position += count * size;
+    return count;
+}
+
+static int oggMemorySeek(void* datasource, ogg_int64_t offset, int whence)
+{
+    OggMemorySource* source = static_cast<OggMemorySource*>(datasource);
+    ogg_int64_t base = 0;
+    if (whence == SEEK_CUR)
+        base = source->position;
+    else if (whence == SEEK_END)
+        base = source->file->size();
+
+    if (base + offset < 0 || base + offset > (ogg_int64_t)source->file->size())
+        return -1;
+
+    source->position = base + offset;
+    return 0;
+}
+
+static long oggMemoryTell(void* datasource)
+{
+    return static_cast<OggMemorySource*>(datasource)->position;
+}
+
+ov_callbacks oggMemoryCallbacks()
+{
+    ov_callbacks callbacks;
+    callbacks.read_func = oggMemoryRead;
+    callbacks.seek_func = oggMemorySeek;
+    callbacks.close_func = NULL;
+    callbacks.tell_func = oggMemoryTell;
+    return callbacks;
+}
+
+OggStream::OggStream() :
+        m_oggOpen(false), m_mp3(0), m_format(0), m_rate(0), m_source(0),
+        m_block(0), m_blockSize(0), m_threadStarted(false),
+        m_playing(false), m_looping(false), m_finished(false), m_quit(false) {
+    memset(m_buffers, 0, sizeof(m_buffers));
+    m_memory.file = &m_file;
+    m_memory.position = 0;
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_wake, NULL);
+}
+
+OggStream::~OggStream() {
+    if (m_threadStarted) {
+        pthread_mutex_lock(&m_lock);
+        m_quit = true;
+        pthread_cond_signal(&m_wake);
+        pthread_mutex_unlock(&m_lock);
+        pthread_join(m_thread, NULL);
+    }
+
+    if (m_source) {
+        alSourceStop(m_source);
+        alSourcei(m_source, AL_BUFFER, 0);
+        alDeleteSources(1, &m_source);
+        alDeleteBuffers(OGG_STREAM_BUFFER_COUNT, m_buffers);
+    }
+
+    if (m_oggOpen)
+        ov_clear(&m_ogg);
+    delete m_mp3;
+
+    delete[] m_block;
+    pthread_cond_destroy(&m_wake);
+    pthread_mutex_destroy(&m_lock);
+}
+
+bool OggStream::open(const char* path, float volume) {
+    if (!m_file.open(path)) {
+        qDebug() << "Could not map audio file " << path;
+        return false;
+    }
+
+    int channels;
+    if (isMp3(m_file.data(), m_file.size())) {
+        m_mp3 = new Mp3Decoder();
+        if (!m_mp3->open(m_file.data(), m_file.size())) {
+            qDebug() << "Failed to open mp3 file.";
+            return false;
+        }
+        channels = m_mp3->info().channels;
+        m_rate = m_mp3->info().rate;
+    }
+    else {
+        if (ov_open_callbacks(&m_memory, &m_ogg, NULL, 0, oggMemoryCallbacks()) < 0) {
+            qDebug() << "Failed to open ogg file.";
+            return false;
+        }
+        m_oggOpen = true;
+
+        vorbis_info* info = ov_info(&m_ogg, -1);
+        channels = info->channels;
+        m_rate = info->rate;
+    }
+    m_format = channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16;
+
+    // Each block holds OGG_STREAM_BUFFER_MS of 16 bit samples.
+    m_blockSize = (m_rate * OGG_STREAM_BUFFER_MS / 1000) * channels * 2;
+    m_block = new char[m_blockSize];
+
+    alGenBuffers(OGG_STREAM_BUFFER_COUNT, m_buffers);
+    alGenSources(1, &m_source);
+    alSourcef(m_source, AL_GAIN, volume);
+
+    ALenum error = alGetError();
+    if (error != AL_NO_ERROR) {
+        qDebug() << "Failed to create streaming source: " << error;
+        return false;
+    }
+
+    if (pthread_create(&m_thread, NULL, streamThread, this)) {
+        qDebug() << "Error creating stream thread";
+        return false;
+    }
+    m_threadStarted = true;
+
+    return true;
+}
+
+void OggStream::play() {
+    pthread_mutex_lock(&m_lock);
+    start(false);
+    pthread_mutex_unlock(&m_lock);
+}
+
+void OggStream::loop() {
+    pthread_mutex_lock(&m_lock);
+    if (m_playing && !m_finished)
+        m_looping = true;
+    else
+        start(true);
+    pthread_mutex_unlock(&m_lock);
+}
+
+void OggStream::stop() {
+    pthread_mutex_lock(&m_lock);
+    m_playing = false;
+    alSourceStop(m_source);
+    alSourcei(m_source, AL_BUFFER, 0);
+    pthread_mutex_unlock(&m_lock);
+}
+
+void OggStream::setVolume(float volume) {
+    pthread_mutex_lock(&m_lock);
+    alSourcef(m_source, AL_GAIN, volume);
+    pthread_mutex_unlock(&m_lock);
+}
+
+bool OggStream::isPlaying() {
+    pthread_mutex_lock(&m_lock);
+    bool playing = m_playing;
+    pthread_mutex_unlock(&m_lock);
+    return playing;
+}
+
+void OggStream::service() {
+    pthread_mutex_lock(&m_lock);
+    if (m_playing)
+        refill();
+    pthread_mutex_unlock(&m_lock);
+}
+
+void OggStream::start(bool looping) {
+    // Detach whatever is still queued before rewinding.
+    alSourceStop(m_source);
+    alSourcei(m_source, AL_BUFFER, 0);
+
+    rewind();
+    m_looping = looping;
+    m_finished = false;
+
+    int queued = 0;
+    for (; queued < OGG_STREAM_BUFFER_COUNT; queued++) {
+        if (!fill(m_buffers[queued]))
+            break;
+    }
+
+    if (queued == 0) {
+        m_playing = false;
+        return;
+    }
+
+    alSourceQueueBuffers(m_source, queued, m_buffers);
+    alSourcePlay(m_source);
+    m_playing = true;
+    pthread_cond_signal(&m_wake);
+}
+
+bool OggStream::fill(ALuint buffer) {
+    int size = 0;
+    bool rewound = false;
+
+    while (size < m_blockSize) {
+        long result = decode(m_block + size, m_blockSize - size);
+        if (result > 0) {
+            size += result;
+            rewound = false;
+        }
+        else if (result == 0) {
+            // End of stream; wrap around within the same block so the loop
+            // seam is sample-contiguous. Stop if the file has no samples.
+            if (!m_looping || rewound)
+                break;
+            rewind();
+            rewound = true;
+        }
+        else if (result != OV_HOLE) {
+            qDebug() << "Failed to read audio stream; file is missing data.";
+            break;
+        }
+    }
+
+    if (size == 0) {
+        m_finished = true;
+        return false;
+    }
+
+    alBufferData(buffer, m_format, m_block, size, m_rate);
+    return true;
+}
+
+long OggStream::decode(char* out, int size) {
+    if (m_mp3) {
+        int frameSize = m_mp3->info().channels * 2;
+        return (long)m_mp3->read((short*)out, size / frameSize) * frameSize;
+    }
+
+    int section;
+    return ov_read(&m_ogg, out, size, 0, 2, 1, &section);
+}
+
+void OggStream::rewind() {
+    if (m_mp3)
+        m_mp3->rewind();
+    else
+        ov_pcm_seek(&m_ogg, 0);
+}
+
+void OggStream::refill() {
+    // Refill and requeue every buffer the source has finished with.
+    ALint processed = 0;
+    alGetSourcei(m_source, AL_BUFFERS_PROCESSED, &processed);
+    while (processed-- > 0) {
+        ALuint buffer;
+        alSourceUnqueueBuffers(m_source, 1, &buffer);
+        if (!m_finished && fill(buffer))
+            alSourceQueueBuffers(m_source, 1, &buffer);
+    }
+
+    ALint state, queued;
+    alGetSourcei(m_source, AL_SOURCE_STATE, &state);
+    alGetSourcei(m_source, AL_BUFFERS_QUEUED, &queued);
+    if (state != AL_PLAYING) {
+        // The source stops by itself if it runs dry; resume it unless
+        // the stream has really ended.
+        if (queued > 0)
+            alSourcePlay(m_source);
+        else
+            m_playing = false;
+    }
+}
+
+void* OggStream::streamThread(void* stream) {
+    static_cast<OggStream*>(stream)->run();
+    return NULL;
+}
+
+void OggStream::run() {
+    pthread_mutex_lock(&m_lock);
+
+    while (!m_quit) {
+        if (!m_playing) {
+            pthread_cond_wait(&m_wake, &m_lock);
+            continue;
+        }
+
+        refill();
+
+        // Check back twice per block, or sooner if play/stop wakes us.
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += OGG_STREAM_BUFFER_MS * 1000000L / 2;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&m_wake, &m_lock, &deadline);
+    }
+
+    pthread_mutex_unlock(&m_lock);
+}
@@ -0,0 +1,105 @@
+/*
+* Copyright (c) 2013 BlackBerry Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef OggStream_HPP_
+#define OggStream_HPP_
+
+#include <pthread.h>
+#include <AL/al.h>
+#include <vorbis/vorbisfile.h>
+#include "mapped_file.hpp"
+#include "mp3_decoder.hpp"
+
+// Number of OpenAL buffers cycled through a streaming source.
+#define OGG_STREAM_BUFFER_COUNT 4
+// Length of audio decoded into each of those buffers.
+#define OGG_STREAM_BUFFER_MS 75
+
+// Vorbis data source reading from a mapped file instead of a FILE handle.
+struct OggMemorySource {
+    const MappedFile* file;
+    size_t position;
+};
+
+// Callbacks for ov_open_callbacks that read from an OggMemorySource.
+ov_callbacks oggMemoryCallbacks();
+
+// Plays an Ogg Vorbis or MP3 file without decoding it up front. A background
+// thread decodes the next few milliseconds of audio into a small ring of
+// buffers queued on a single source, so memory stays bounded regardless of
+// length.
+class OggStream {
+
+public:
+    OggStream();
+    ~OggStream();
+
+    bool open(const char* path, float volume);
+    size_t bytesMapped() const { return m_file.size(); }
+
+    // Start from the beginning, once or looping without a gap at the seam.
+    void play();
+    void loop();
+    void stop();
+    void setVolume(float volume);
+    bool isPlaying();
+    // Refill the buffers the source has played now instead of waiting for
+    // the stream thread, for a device that mixes faster than real time.
+    void service();
+
+private:
+    OggStream(const OggStream&);
+    OggStream& operator=(const OggStream&);
+
+    static void* streamThread(void* stream);
+    void run();
+
+    // Restart decoding from the first sample and queue the whole ring.
+    void start(bool looping);
+    // Decode the next block into buffer; returns false at end of stream.
+    bool fill(ALuint buffer);
+    // Decode into out with whichever decoder the file needs; returns bytes
+    // written, 0 at the end or a negative Vorbis error.
+    long decode(char* out, int size);
+    void rewind();
+    // Requeue played buffers and resume after an underrun.
+    void refill();
+
+    MappedFile m_file;
+    OggMemorySource m_memory;
+    OggVorbis_File m_ogg;
+    bool m_oggOpen;
+    Mp3Decoder* m_mp3;
+
+    ALenum m_format;
+    ALsizei m_rate;
+    ALuint m_source;
+    ALuint m_buffers[OGG_STREAM_BUFFER_COUNT];
+
+    char* m_block;
+    int m_blockSize;
+
+    pthread_t m_thread;
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_wake;
+    bool m_threadStarted;
+    bool m_playing;
+    bool m_looping;
+    bool m_finished;
+    bool m_quit;
+};
+
+#endif /* OggStream_HPP_ */
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2013 BlackBerry Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QDir>
+#include <qdebug.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <sstream>
+#include <vector>
+#include "pcm_cache.hpp"
+
+#define PCM_CACHE_MAGIC "LLAP"
+#define PCM_CACHE_VERSION 1
+#define PCM_CACHE_SUFFIX ".pcm"
+
+// On-disk entry header; the PCM data follows immediately.
+struct PcmCacheHeader {
+    char magic[4];
+    uint32_t version;
+    int32_t format;
+    uint32_t channels;
+    uint32_t rate;
+    uint32_t dataSize;
+    uint32_t reserved[2];
+};
+
+// Cache file and its last use, for eviction.
+struct PcmCacheEntry {
+    std::string path;
+    time_t lastUsed;
+    off_t size;
+
+    bool operator<(const PcmCacheEntry& other) const {
+        return lastUsed < other.lastUsed;
+    }
+};
+
+PcmCache::PcmCache() :
+        m_limit(0), m_hits(0), m_misses(0), m_evictions(0), m_writes(0) {
+    pthread_mutex_init(&m_lock, NULL);
+}
+
+PcmCache::~PcmCache() {
+    pthread_mutex_destroy(&m_lock);
+}
+
+bool PcmCache::configure(const std::string& directory, size_t limit) {
+    if (limit && !QDir().mkpath(QString::fromStdString(directory))) {
+        qDebug() << "Could not create PCM cache directory " << directory.c_str();
+        return false;
+    }
+
+    pthread_mutex_lock(&m_lock);
+    m_directory = directory;
+    m_limit = limit;
+    pthread_mutex_unlock(&m_lock);
+
+    if (limit)
+        evict();
+    return true;
+}
+
+bool PcmCache::isEnabled() {
+    pthread_mutex_lock(&m_lock);
+    bool enabled = m_limit != 0;
+    pthread_mutex_unlock(&m_lock);
+    return enabled;
+}
+
+bool PcmCache::entryPath(const char* sourcePath, std::string& path) {
+    struct stat info;
+    if (stat(sourcePath, &info) != 0)
+        return false;
+
+    // 64 bit FNV-1a over path, size and modification time.
+    std::ostringstream key;
+    key << sourcePath << '|' << (long long)info.st_size << '|' << (long long)info.st_mtime;
+    std::string text = key.str();
+
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < text.size(); i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ULL;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+
+    pthread_mutex_lock(&m_lock);
+    path = m_directory + "/" + name + PCM_CACHE_SUFFIX;
+    pthread_mutex_unlock(&m_lock);
+    return true;
+}
+
+bool PcmCache::lookup(const char* sourcePath, MappedFile& file, PcmFormat& format,
+                      const unsigned char*& pcm, size_t& size) {
+    std::string path;
+    if (!isEnabled() || !entryPath(sourcePath, path))
+        return false;
+
+    bool hit = false;
+    if (file.open(path.c_str()) && file.size() >= sizeof(PcmCacheHeader)) {
+        PcmCacheHeader header;
+        memcpy(&header, file.data(), sizeof(header));
+
+        if (memcmp(header.magic, PCM_CACHE_MAGIC, 4) == 0 && header.version == PCM_CACHE_VERSION
+                && header.dataSize == file.size() - sizeof(header)) {
+            format.format = header.format;
+            format.channels = header.channels;
+            format.rate = header.rate;
+            pcm = file.data() + sizeof(header);
+            size = header.dataSize;
+            hit = true;
+
+            // Touch the entry so eviction sees it as recently used.
+            utime(path.c_str(), NULL);
+        }
+    }
+
+    if (!hit)
+        file.close();
+
+    pthread_mutex_lock(&m_lock);
+    if (hit)
+        m_hits++;
+    else
+        m_misses++;
+    pthread_mutex_unlock(&m_lock);
+
+    return hit;
+}
+
+void PcmCache::store(const char* sourcePath, const PcmFormat& format, const char* pcm, size_t size) {
+    std::string path;
+    if (!isEnabled() || !entryPath(sourcePath, path))
+        return;
+
+    PcmCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PCM_CACHE_MAGIC, 4);
+    header.version = PCM_CACHE_VERSION;
+    header.format = format.format;
+    header.channels = format.channels;
+    header.rate = format.rate;
+    header.dataSize = size;
+
+    // Write under a private name and rename, so readers never see a partial
+    // entry and concurrent writers of the same asset don't interleave.
+    std::ostringstream temporary;
+    temporary << path << "." << getpid() << "." << (unsigned long)pthread_self() << ".tmp";
+
+    FILE* file = fopen(temporary.str().c_str(), "wb");
+    if (!file) {
+        qDebug() << "Could not create PCM cache entry " << temporary.str().c_str();
+        return;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+            && fwrite(pcm, 1, size, file) == size;
+    written = fclose(file) == 0 && written;
+
+    if (!written || rename(temporary.str().c_str(), path.c_str()) != 0) {
+        qDebug() << "Could not write PCM cache entry " << path.c_str();
+        unlink(temporary.str().c_str());
+        return;
+    }
+
+    pthread_mutex_lock(&m_lock);
+    m_writes++;
+    pthread_mutex_unlock(&m_lock);
+
+    evict();
+}
+
+void PcmCache::evict() {
+    pthread_mutex_lock(&m_lock);
+
+    std::vector<PcmCacheEntry> entries;
+    off_t total = 0;
+
+    DIR* directory = opendir(m_directory.c_str());
+    if (directory) {
+        struct dirent* item;
+        size_t suffixLength = strlen(PCM_CACHE_SUFFIX);
+        while ((item = readdir(directory)) != NULL) {
+            size_t length = strlen(item->d_name);
+            if (length <= suffixLength || strcmp(item->d_name + length - suffixLength, PCM_CACHE_SUFFIX) != 0)
+                continue;
+
+            PcmCacheEntry entry;
+            entry.path = m_directory + "/" + item->d_name;
+
+            struct stat info;
+            if (stat(entry.path.c_str(), &info) != 0)
+                continue;
+
+            entry.lastUsed = info.st_mtime;
+            entry.size = info.st_size;
+            total += entry.size;
+            entries.push_back(entry);
+        }
+        closedir(directory);
+    }
+
+    // Oldest first.
+    std::sort(entries.begin(), entries.end());
+    for (size_t i = 0; i < entries.size() && total > (off_t)m_limit; i++) {
+        if (unlink(entries[i].path.c_str()) == 0) {
+            total -= entries[i].size;
+            m_evictions++;
+        }
+    }
+
+    pthread_mutex_unlock(&m_lock);
+}
+
+std::string PcmCache::stats() {
+    pthread_mutex_lock(&m_lock);
+    std::ostringstream result;
+    result << "hits " << m_hits << ", misses " << m_misses << ", writes " << m_writes
+           << ", evictions " << m_evictions << ", limit " << m_limit << " bytes";
+    pthread_mutex_unlock(&m_lock);
+    return result.str();
+}
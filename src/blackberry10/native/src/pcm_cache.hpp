@@ -0,0 +1,75 @@
+/*
+* Copyright (c) 2013 BlackBerry Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+
+#ifndef PcmCache_HPP_
+#define PcmCache_HPP_
+
+#include <string>
+#include <pthread.h>
+#include <AL/al.h>
+#include "mapped_file.hpp"
+
+// Format of a decoded PCM block as handed to alBufferData.
+struct PcmFormat {
+    ALenum format;
+    int channels;
+    int rate;
+};
+
+// Opt-in on-disk cache of decoded PCM, so compressed assets only go through
+// the decoder on the first launch. Entries are keyed by the source file's
+// path, size and modification time, and the cache is trimmed back to its
+// size limit by dropping the least recently used entries. Safe to use from
+// several loader threads at once.
+class PcmCache {
+
+public:
+    PcmCache();
+    ~PcmCache();
+
+    // Enable the cache in the given directory; a limit of 0 disables it.
+    bool configure(const std::string& directory, size_t limit);
+    bool isEnabled();
+
+    // Map the cached PCM for a source file. On a hit, pcm and size point
+    // into the mapping held by file.
+    bool lookup(const char* sourcePath, MappedFile& file, PcmFormat& format,
+                const unsigned char*& pcm, size_t& size);
+    // Write freshly decoded PCM for a source file, then trim the cache.
+    void store(const char* sourcePath, const PcmFormat& format, const char* pcm, size_t size);
+
+    std::string stats();
+
+private:
+    PcmCache(const PcmCache&);
+    PcmCache& operator=(const PcmCache&);
+
+    // Entry file name for the current version of a source file.
+    bool entryPath(const char* sourcePath, std::string& path);
+    // Remove least recently used entries until the cache fits its limit.
+    void evict();
+
+    pthread_mutex_t m_lock;
+    std::string m_directory;
+    size_t m_limit;
+    unsigned int m_hits;
+    unsigned int m_misses;
+    unsigned int m_evictions;
+    unsigned int m_writes;
+};
+
+#endif /* PcmCache_HPP_ */
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2013 BlackBerry Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "resampler.hpp"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Sum of a[i] * b[i]; count is a multiple of 4.
+static float dotProduct(const float* a, const float* b, int count)
+{
+#if defined(__ARM_NEON__)
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    for (int i = 0; i < count; i += 4)
+        sum = vmlaq_f32(sum, vld1q_f32(a + i), vld1q_f32(b + i));
+    float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    return vget_lane_f32(vpadd_f32(pair, pair), 0);
+#elif defined(__SSE2__)
+    __m128 sum = _mm_setzero_ps();
+    for (int i = 0; i < count; i += 4)
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+    float sum = 0.0f;
+    for (int i = 0; i < count; i++)
+        sum += a[i] * b[i];
+    return sum;
+#endif
+}
+
+// Zeroth order modified Bessel function, for the Kaiser window.
+static double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if (term < sum * 1e-12)
+            break;
+    }
+    return sum;
+}
+
+static long greatestCommonDivisor(long a, long b)
+{
+    while (b) {
+        long rest = a % b;
+        a = b;
+        b = rest;
+    }
+    return a;
+}
+
+Resampler::Resampler() :
+        m_up(1), m_down(1), m_taps(0), m_phases(0) {
+}
+
+bool Resampler::configure(int fromRate, int toRate, ResampleQuality quality) {
+    if (fromRate <= 0 || toRate <= 0 || quality == RESAMPLE_OFF)
+        return false;
+
+    long divisor = greatestCommonDivisor(fromRate, toRate);
+    m_up = toRate / divisor;
+    m_down = fromRate / divisor;
+    m_phases = m_up < RESAMPLER_MAX_PHASES ? m_up : RESAMPLER_MAX_PHASES;
+
+    // Longer filters pass more of the band and reject images better.
+    int baseTaps = 8;
+    double passband = 0.80;
+    double beta = 5.0;
+    if (quality == RESAMPLE_MEDIUM) {
+        baseTaps = 16;
+        passband = 0.90;
+        beta = 7.0;
+    }
+    else if (quality == RESAMPLE_BEST) {
+        baseTaps = 32;
+        passband = 0.95;
+        beta = 9.0;
+    }
+
+    // Going down in rate, the cutoff follows the output's Nyquist limit and
+    // the filter stretches to match.
+    double ratio = (double)toRate / fromRate;
+    double cutoff = 0.5 * passband * (ratio < 1.0 ? ratio : 1.0);
+    m_taps = (int)ceil(baseTaps / (ratio < 1.0 ? ratio : 1.0));
+    m_taps = (m_taps + 3) & ~3;
+
+    // Phase p interpolates at p / m_phases past an input frame; each phase
+    // is normalized so a constant signal passes at unity gain.
+    int half = m_taps / 2;
+    double window = besselI0(beta);
+    m_filters.resize(m_phases * m_taps);
+    for (int p = 0; p < m_phases; p++) {
+        float* filter = &m_filters[p * m_taps];
+        double sum = 0.0;
+        for (int j = 0; j < m_taps; j++) {
+            double t = half - 1 - j + (double)p / m_phases;
+            double x = 2.0 * cutoff * t;
+            double sinc = fabs(x) < 1e-9 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+            double edge = t / half;
+            double kaiser = fabs(edge) >= 1.0 ? 0.0 : besselI0(beta * sqrt(1.0 - edge * edge)) / window;
+            filter[j] = (float)(sinc * kaiser);
+            sum += filter[j];
+        }
+        for (int j = 0; j < m_taps; j++)
+            filter[j] = (float)(filter[j] / sum);
+    }
+    return true;
+}
+
+long Resampler::outputFrames(long frames) const {
+    return (long)(((long long)frames * m_up + m_down - 1) / m_down);
+}
+
+long Resampler::mapFrame(long frame) const {
+    return (long)(((long long)frame * m_up + m_down / 2) / m_down);
+}
+
+void Resampler::process(const short* in, long frames, int channels, short* out) const {
+    long produced = outputFrames(frames);
+    int half = m_taps / 2;
+
+    // One channel at a time, widened to float with silence on either side
+    // so the filter never reads past the ends.
+    std::vector<float> padded(frames + m_taps + 1, 0.0f);
+    for (int ch = 0; ch < channels; ch++) {
+        for (long i = 0; i < frames; i++)
+            padded[half + i] = in[i * channels + ch];
+
+        for (long n = 0; n < produced; n++) {
+            long long position = (long long)n * m_down;
+            long frame = (long)(position / m_up);
+            long remainder = (long)(position % m_up);
+            int phase = remainder;
+            if (m_phases != m_up) {
+                phase = (int)(((long long)remainder * m_phases + m_up / 2) / m_up);
+                if (phase == m_phases) {
+                    frame++;
+                    phase = 0;
+                }
+            }
+
+            float sample = dotProduct(&padded[frame + 1], &m_filters[phase * m_taps], m_taps);
+            sample += sample >= 0.0f ? 0.5f : -0.5f;
+            if (sample > 32767.0f)
+                sample = 32767.0f;
+            else if (sample < -32768.0f)
+                sample = -32768.0f;
+            out[n * channels + ch] = (short)sample;
+        }
+    }
+}
+
+const char* Resampler::kernelName() {
+#if defined(__ARM_NEON__)
+    return "neon";
+#elif defined(__SSE2__)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+const char* Resampler::qualityName(ResampleQuality quality) {
+    switch (quality) {
+    case RESAMPLE_FAST:
+        return "fast";
+    case RESAMPLE_MEDIUM:
+        return "medium";
+    case RESAMPLE_BEST:
+        return "best";
+    default:
+        return "off";
+    }
+}
+
+bool Resampler::parseQuality(const char* name, ResampleQuality& quality) {
+    static const ResampleQuality all[] = { RESAMPLE_OFF, RESAMPLE_FAST, RESAMPLE_MEDIUM, RESAMPLE_BEST };
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(name, qualityName(all[i])) == 0) {
+            quality = all[i];
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,66 @@
+/*
+* Copyright (c) 2013 BlackBerry Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+
+#ifndef Resampler_HPP_
+#define Resampler_HPP_
+
+#include <vector>
+
+// Most filter phases kept for one ratio. Ratios whose reduced fraction has a
+// larger numerator round each output position to the nearest phase.
+#define RESAMPLER_MAX_PHASES 1024
+
+// Load-time sample rate conversion, from cheapest to cleanest.
+enum ResampleQuality {
+    RESAMPLE_OFF,
+    RESAMPLE_FAST,          // 8 taps per phase
+    RESAMPLE_MEDIUM,        // 16 taps per phase
+    RESAMPLE_BEST           // 32 taps per phase
+};
+
+// Polyphase windowed-sinc converter between two fixed rates. Assets go
+// through it once as they load, so they reach OpenAL or the software mixer
+// at the output rate and nothing is resampled per voice while mixing.
+class Resampler {
+
+public:
+    Resampler();
+
+    // Design the filter bank for fromRate to toRate.
+    bool configure(int fromRate, int toRate, ResampleQuality quality);
+
+    // Frames produced for frames of input, and where an input frame lands.
+    long outputFrames(long frames) const;
+    long mapFrame(long frame) const;
+
+    // Convert interleaved 16 bit PCM; out must hold outputFrames(frames).
+    void process(const short* in, long frames, int channels, short* out) const;
+
+    int taps() const { return m_taps; }
+    static const char* kernelName();
+    static const char* qualityName(ResampleQuality quality);
+    static bool parseQuality(const char* name, ResampleQuality& quality);
+
+private:
+    long m_up;              // the ratio toRate / fromRate, reduced
+    long m_down;
+    int m_taps;
+    int m_phases;
+    std::vector<float> m_filters;
+};
+
+#endif /* Resampler_HPP_ */
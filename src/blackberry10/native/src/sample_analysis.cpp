@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2013 BlackBerry Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "sample_analysis.hpp"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static inline bool audible(short sample, short threshold)
+{
+    return sample > threshold || sample < -threshold;
+}
+
+// Whether any of the eight samples at p is above threshold.
+static inline bool anyAudible(const short* p, short threshold)
+{
+#if defined(__ARM_NEON__)
+    int16x8_t samples = vld1q_s16(p);
+    uint16x8_t loud = vorrq_u16(vcgtq_s16(samples, vdupq_n_s16(threshold)),
+                                vcltq_s16(samples, vdupq_n_s16(-threshold)));
+    uint32x2_t folded = vreinterpret_u32_u16(vorr_u16(vget_low_u16(loud), vget_high_u16(loud)));
+    return (vget_lane_u32(folded, 0) | vget_lane_u32(folded, 1)) != 0;
+#elif defined(__SSE2__)
+    __m128i samples = _mm_loadu_si128((const __m128i*)p);
+    __m128i loud = _mm_or_si128(_mm_cmpgt_epi16(samples, _mm_set1_epi16(threshold)),
+                                _mm_cmplt_epi16(samples, _mm_set1_epi16(-threshold)));
+    return _mm_movemask_epi8(loud) != 0;
+#else
+    for (int i = 0; i < 8; i++) {
+        if (audible(p[i], threshold))
+            return true;
+    }
+    return false;
+#endif
+}
+
+// Skip whole vectors of silence, then find the exact sample within the
+// first one that is not.
+long SampleAnalysis::leadingSilence(const short* samples, long count, short threshold) {
+    long i = 0;
+    while (i + 8 <= count && !anyAudible(samples + i, threshold))
+        i += 8;
+    while (i < count && !audible(samples[i], threshold))
+        i++;
+    return i;
+}
+
+long SampleAnalysis::trailingSilence(const short* samples, long count, short threshold) {
+    long end = count;
+    while (end >= 8 && !anyAudible(samples + end - 8, threshold))
+        end -= 8;
+    while (end > 0 && !audible(samples[end - 1], threshold))
+        end--;
+    return count - end;
+}
+
+// Largest and smallest sample and the sum of squares over count samples.
+static void reduceLevels(const short* samples, long count, int& max, int& min, unsigned long long& sumSquares)
+{
+    long i = 0;
+#if defined(__ARM_NEON__)
+    int16x8_t high = vdupq_n_s16(max);
+    int16x8_t low = vdupq_n_s16(min);
+    int64x2_t sum = vdupq_n_s64(0);
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t v = vld1q_s16(samples + i);
+        high = vmaxq_s16(high, v);
+        low = vminq_s16(low, v);
+        sum = vpadalq_s32(sum, vmull_s16(vget_low_s16(v), vget_low_s16(v)));
+        sum = vpadalq_s32(sum, vmull_s16(vget_high_s16(v), vget_high_s16(v)));
+    }
+    short lanes[8];
+    vst1q_s16(lanes, high);
+    for (int j = 0; j < 8; j++)
+        max = lanes[j] > max ? lanes[j] : max;
+    vst1q_s16(lanes, low);
+    for (int j = 0; j < 8; j++)
+        min = lanes[j] < min ? lanes[j] : min;
+    sumSquares += vgetq_lane_s64(sum, 0) + vgetq_lane_s64(sum, 1);
+#elif defined(__SSE2__)
+    __m128i high = _mm_set1_epi16(max);
+    __m128i low = _mm_set1_epi16(min);
+    __m128i sum = _mm_setzero_si128();
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(samples + i));
+        high = _mm_max_epi16(high, v);
+        low = _mm_min_epi16(low, v);
+        // Pair sums reach 2^31 only for two full scale negative samples,
+        // so they are widened as unsigned.
+        __m128i pairs = _mm_madd_epi16(v, v);
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(pairs, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(pairs, zero));
+    }
+    short lanes[8];
+    _mm_storeu_si128((__m128i*)lanes, high);
+    for (int j = 0; j < 8; j++)
+        max = lanes[j] > max ? lanes[j] : max;
+    _mm_storeu_si128((__m128i*)lanes, low);
+    for (int j = 0; j < 8; j++)
+        min = lanes[j] < min ? lanes[j] : min;
+    unsigned long long sums[2];
+    _mm_storeu_si128((__m128i*)sums, sum);
+    sumSquares += sums[0] + sums[1];
+#endif
+    for (; i < count; i++) {
+        int sample = samples[i];
+        max = sample > max ? sample : max;
+        min = sample < min ? sample : min;
+        sumSquares += (unsigned long long)(sample * sample);
+    }
+}
+
+short SampleAnalysis::thresholdFromDb(double db) {
+    double level = 32768.0 * pow(10.0, db / 20.0);
+    return (short)(level < 0 ? 0 : level > 32767 ? 32767 : level);
+}
+
+const char* SampleAnalysis::kernelName() {
+#if defined(__ARM_NEON__)
+    return "neon";
+#elif defined(__SSE2__)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+// The two K-weighting stages of ITU-R BS.1770, a high shelf and a high
+// pass, designed for rate as libebur128 does.
+LoudnessMeter::LoudnessMeter(int rate, int channels) :
+        m_channels(channels), m_subBlockFrames(rate / 10), m_max(0), m_min(0),
+        m_sumSquares(0), m_frames(0), m_energy(0), m_subBlockEnergy(0), m_subBlockFill(0) {
+    double k = tan(M_PI * 1681.974450955533 / rate);
+    double q = 0.7071752369554196;
+    double vh = pow(10.0, 3.999843853973347 / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    m_shelf[0] = (vh + vb * k / q + k * k) / a0;
+    m_shelf[1] = 2.0 * (k * k - vh) / a0;
+    m_shelf[2] = (vh - vb * k / q + k * k) / a0;
+    m_shelf[3] = 2.0 * (k * k - 1.0) / a0;
+    m_shelf[4] = (1.0 - k / q + k * k) / a0;
+
+    k = tan(M_PI * 38.13547087602444 / rate);
+    q = 0.5003270373238773;
+    a0 = 1.0 + k / q + k * k;
+    m_highPass[0] = 1.0;
+    m_highPass[1] = -2.0;
+    m_highPass[2] = 1.0;
+    m_highPass[3] = 2.0 * (k * k - 1.0) / a0;
+    m_highPass[4] = (1.0 - k / q + k * k) / a0;
+
+    memset(m_state, 0, sizeof(m_state));
+    if (m_subBlockFrames <= 0)
+        m_subBlockFrames = 1;
+    // Anything but mono or stereo at a real rate is not measured.
+    if (rate <= 0 || channels > 2)
+        m_channels = 0;
+}
+
+void LoudnessMeter::add(const short* samples, long frames) {
+    if (frames <= 0 || m_channels <= 0)
+        return;
+    reduceLevels(samples, frames * m_channels, m_max, m_min, m_sumSquares);
+    m_frames += frames;
+
+    // Transposed direct form II. The tiny offset keeps the filter state out
+    // of denormals through silence; the high pass removes it again.
+    const double* s = m_shelf;
+    const double* h = m_highPass;
+    for (long i = 0; i < frames; i++) {
+        double energy = 0;
+        for (int c = 0; c < m_channels; c++) {
+            double* z = m_state[c];
+            double x = samples[i * m_channels + c] * (1.0 / 32768.0) + 1e-15;
+            double y = s[0] * x + z[0];
+            z[0] = s[1] * x - s[3] * y + z[1];
+            z[1] = s[2] * x - s[4] * y;
+            x = y;
+            y = h[0] * x + z[2];
+            z[2] = h[1] * x - h[3] * y + z[3];
+            z[3] = h[2] * x - h[4] * y;
+            energy += y * y;
+        }
+        m_energy += energy;
+        m_subBlockEnergy += energy;
+        if (++m_subBlockFill == m_subBlockFrames) {
+            m_subBlocks.push_back(m_subBlockEnergy / m_subBlockFrames);
+            m_subBlockEnergy = 0;
+            m_subBlockFill = 0;
+        }
+    }
+}
+
+static double toDb(double power)
+{
+    return power > 0 ? 10.0 * log10(power) : -HUGE_VAL;
+}
+
+Loudness LoudnessMeter::result() const {
+    Loudness loudness;
+    loudness.measured = m_frames > 0;
+    int peak = m_max > -m_min ? m_max : -m_min;
+    loudness.peak = toDb((double)peak * peak / (32768.0 * 32768.0));
+    loudness.rms = m_frames ? toDb(m_sumSquares / (32768.0 * 32768.0) / (m_frames * m_channels)) : -HUGE_VAL;
+
+    // Gating blocks of 400 ms overlap by 75%, so each is four sub-blocks.
+    std::vector<double> blocks;
+    for (size_t i = 0; i + 4 <= m_subBlocks.size(); i++)
+        blocks.push_back((m_subBlocks[i] + m_subBlocks[i + 1] + m_subBlocks[i + 2] + m_subBlocks[i + 3]) / 4);
+    if (blocks.empty() && m_frames)
+        blocks.push_back(m_energy / m_frames);
+
+    // Absolute gate at -70 LUFS, then a relative gate 10 LU under the
+    // loudness of what passed it.
+    double gate = pow(10.0, (-70.0 + 0.691) / 10.0);
+    for (int pass = 0; pass < 2; pass++) {
+        double sum = 0;
+        int count = 0;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            if (blocks[i] > gate) {
+                sum += blocks[i];
+                count++;
+            }
+        }
+        if (!count) {
+            loudness.integrated = -HUGE_VAL;
+            break;
+        }
+        loudness.integrated = -0.691 + toDb(sum / count);
+        if (sum / count / 10.0 > gate)
+            gate = sum / count / 10.0;
+    }
+    return loudness;
+}
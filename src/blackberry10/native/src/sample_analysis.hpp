@@ -0,0 +1,82 @@
+/*
+* Copyright (c) 2013 BlackBerry Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+
+#ifndef SampleAnalysis_HPP_
+#define SampleAnalysis_HPP_
+
+#include <vector>
+
+// Decoders hand the loudness meter this many frames at a time, while they
+// are still in cache.
+#define SAMPLE_ANALYSIS_BLOCK_FRAMES 4096
+
+// Level of a decoded asset. Silence measures -HUGE_VAL throughout.
+struct Loudness {
+    bool measured;
+    double peak;            // dBFS of the largest sample
+    double rms;             // dBFS over every sample of every channel
+    double integrated;      // LUFS, K-weighted and gated as in ITU-R BS.1770
+};
+
+// Scans over decoded 16 bit PCM, run once as an asset loads.
+class SampleAnalysis {
+
+public:
+    // Samples at the start or end of count interleaved samples whose
+    // magnitude is at most threshold; count if every sample is that quiet.
+    static long leadingSilence(const short* samples, long count, short threshold);
+    static long trailingSilence(const short* samples, long count, short threshold);
+
+    // Sample magnitude for a level in dB below full scale.
+    static short thresholdFromDb(double db);
+
+    static const char* kernelName();
+};
+
+// Measures Loudness as an asset decodes, a block at a time, so nothing
+// reads the decoded buffer a second time. Peak and RMS are vector
+// reductions; the K-weighting filters are a scalar recurrence. Assets
+// shorter than one 400 ms gating block are measured as a single block.
+class LoudnessMeter {
+
+public:
+    LoudnessMeter(int rate, int channels);
+
+    // Feed the next frames of interleaved 16 bit PCM. Only mono and stereo
+    // are measured; other layouts leave the result unmeasured.
+    void add(const short* samples, long frames);
+    Loudness result() const;
+
+private:
+    int m_channels;
+    long m_subBlockFrames;  // 100 ms; gating blocks are four of these
+    double m_shelf[5];      // b0, b1, b2, a1, a2 of each K-weighting stage
+    double m_highPass[5];
+    double m_state[2][4];   // per channel, two per stage
+
+    int m_max;
+    int m_min;
+    unsigned long long m_sumSquares;
+    long long m_frames;
+
+    double m_energy;        // K-weighted, summed over channels
+    double m_subBlockEnergy;
+    long m_subBlockFill;
+    std::vector<double> m_subBlocks;
+};
+
+#endif /* SampleAnalysis_HPP_ */
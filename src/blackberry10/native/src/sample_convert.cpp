@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2013 BlackBerry Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sample_convert.hpp"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Packed 24 bit samples are widened through a block this size.
+#define SAMPLE_CONVERT_BLOCK 256
+
+static inline unsigned int nextRandom(unsigned int x)
+{
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+// Difference of two uniform 16 bit values: triangular over +-65535, one LSB
+// of 16 bit output at 32 bit scale.
+static inline int triangular(unsigned int x)
+{
+    return (int)(x & 0xffff) - (int)(x >> 16);
+}
+
+// Round value plus dither to 16 bits. Halving first keeps the sum in range.
+static inline short reduceInt32(int value, int tpdf)
+{
+    int reduced = ((value >> 1) + (tpdf >> 1) + 0x4000) >> 15;
+    return (short)(reduced < -32768 ? -32768 : reduced > 32767 ? 32767 : reduced);
+}
+
+// Scale, dither and round half up. NaN clamps to the bottom of the range,
+// as the vector kernels' compares do.
+static inline short reduceFloat(float value, int tpdf)
+{
+    float scaled = value * 32768.0f + tpdf * (1.0f / 65536.0f);
+    scaled = scaled > -32768.0f ? scaled : -32768.0f;
+    scaled = scaled < 32767.0f ? scaled : 32767.0f;
+    return (short)((int)(scaled + 32768.5f) - 32768);
+}
+
+void SampleConverter::seed(DitherState& dither) {
+    for (int i = 0; i < 4; i++)
+        dither.lanes[i] = 0x9e3779b9u * (i + 1);
+}
+
+void SampleConverter::fromInt24(const unsigned char* in, long count, short* out, DitherState& dither) {
+    // Place each sample in the top three bytes so the sign comes along.
+    int widened[SAMPLE_CONVERT_BLOCK];
+    for (long done = 0; done < count; done += SAMPLE_CONVERT_BLOCK) {
+        long block = count - done < SAMPLE_CONVERT_BLOCK ? count - done : SAMPLE_CONVERT_BLOCK;
+        const unsigned char* p = in + done * 3;
+        for (long i = 0; i < block; i++, p += 3)
+            widened[i] = (int)((p[0] << 8) | (p[1] << 16) | ((unsigned int)p[2] << 24));
+        fromInt32(widened, block, out + done, dither);
+    }
+}
+
+void SampleConverter::fromInt32(const int* in, long count, short* out, DitherState& dither) {
+    long i = 0;
+#if defined(__ARM_NEON__)
+    uint32x4_t state = vld1q_u32(dither.lanes);
+    const int32x4_t round = vdupq_n_s32(0x4000);
+    for (; i + 4 <= count; i += 4) {
+        state = veorq_u32(state, vshlq_n_u32(state, 13));
+        state = veorq_u32(state, vshrq_n_u32(state, 17));
+        state = veorq_u32(state, vshlq_n_u32(state, 5));
+        int32x4_t tpdf = vsubq_s32(vreinterpretq_s32_u32(vandq_u32(state, vdupq_n_u32(0xffff))),
+                                   vreinterpretq_s32_u32(vshrq_n_u32(state, 16)));
+        int32x4_t value = vaddq_s32(vshrq_n_s32(vld1q_s32(in + i), 1), vshrq_n_s32(tpdf, 1));
+        vst1_s16(out + i, vqmovn_s32(vshrq_n_s32(vaddq_s32(value, round), 15)));
+    }
+    vst1q_u32(dither.lanes, state);
+#elif defined(__SSE2__)
+    __m128i state = _mm_loadu_si128((const __m128i*)dither.lanes);
+    const __m128i mask = _mm_set1_epi32(0xffff);
+    const __m128i round = _mm_set1_epi32(0x4000);
+    for (; i + 4 <= count; i += 4) {
+        state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+        state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+        state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+        __m128i tpdf = _mm_sub_epi32(_mm_and_si128(state, mask), _mm_srli_epi32(state, 16));
+        __m128i value = _mm_add_epi32(_mm_srai_epi32(_mm_loadu_si128((const __m128i*)(in + i)), 1),
+                                      _mm_srai_epi32(tpdf, 1));
+        value = _mm_srai_epi32(_mm_add_epi32(value, round), 15);
+        _mm_storel_epi64((__m128i*)(out + i), _mm_packs_epi32(value, value));
+    }
+    _mm_storeu_si128((__m128i*)dither.lanes, state);
+#endif
+    for (; i < count; i++) {
+        unsigned int& lane = dither.lanes[i & 3];
+        lane = nextRandom(lane);
+        out[i] = reduceInt32(in[i], triangular(lane));
+    }
+}
+
+void SampleConverter::fromFloat32(const float* in, long count, short* out, DitherState& dither) {
+    long i = 0;
+#if defined(__ARM_NEON__)
+    uint32x4_t state = vld1q_u32(dither.lanes);
+    const float32x4_t low = vdupq_n_f32(-32768.0f);
+    const float32x4_t high = vdupq_n_f32(32767.0f);
+    for (; i + 4 <= count; i += 4) {
+        state = veorq_u32(state, vshlq_n_u32(state, 13));
+        state = veorq_u32(state, vshrq_n_u32(state, 17));
+        state = veorq_u32(state, vshlq_n_u32(state, 5));
+        int32x4_t tpdf = vsubq_s32(vreinterpretq_s32_u32(vandq_u32(state, vdupq_n_u32(0xffff))),
+                                   vreinterpretq_s32_u32(vshrq_n_u32(state, 16)));
+        float32x4_t scaled = vaddq_f32(vmulq_f32(vld1q_f32(in + i), vdupq_n_f32(32768.0f)),
+                                       vmulq_f32(vcvtq_f32_s32(tpdf), vdupq_n_f32(1.0f / 65536.0f)));
+        scaled = vbslq_f32(vcgtq_f32(scaled, low), scaled, low);
+        scaled = vbslq_f32(vcltq_f32(scaled, high), scaled, high);
+        int32x4_t value = vcvtq_s32_f32(vaddq_f32(scaled, vdupq_n_f32(32768.5f)));
+        vst1_s16(out + i, vmovn_s32(vsubq_s32(value, vdupq_n_s32(32768))));
+    }
+    vst1q_u32(dither.lanes, state);
+#elif defined(__SSE2__)
+    __m128i state = _mm_loadu_si128((const __m128i*)dither.lanes);
+    const __m128i mask = _mm_set1_epi32(0xffff);
+    const __m128 low = _mm_set1_ps(-32768.0f);
+    const __m128 high = _mm_set1_ps(32767.0f);
+    for (; i + 4 <= count; i += 4) {
+        state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+        state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+        state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+        __m128i tpdf = _mm_sub_epi32(_mm_and_si128(state, mask), _mm_srli_epi32(state, 16));
+        __m128 scaled = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + i), _mm_set1_ps(32768.0f)),
+                                   _mm_mul_ps(_mm_cvtepi32_ps(tpdf), _mm_set1_ps(1.0f / 65536.0f)));
+        // maxps and minps return the constant when the sample is NaN.
+        scaled = _mm_min_ps(_mm_max_ps(scaled, low), high);
+        __m128i value = _mm_cvttps_epi32(_mm_add_ps(scaled, _mm_set1_ps(32768.5f)));
+        value = _mm_sub_epi32(value, _mm_set1_epi32(32768));
+        _mm_storel_epi64((__m128i*)(out + i), _mm_packs_epi32(value, value));
+    }
+    _mm_storeu_si128((__m128i*)dither.lanes, state);
+#endif
+    for (; i < count; i++) {
+        unsigned int& lane = dither.lanes[i & 3];
+        lane = nextRandom(lane);
+        out[i] = reduceFloat(in[i], triangular(lane));
+    }
+}
+
+const char* SampleConverter::kernelName() {
+#if defined(__ARM_NEON__)
+    return "neon";
+#elif defined(__SSE2__)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,50 @@
+/*
+* Copyright (c) 2013 BlackBerry Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+
+#ifndef SampleConvert_HPP_
+#define SampleConvert_HPP_
+
+// Wave format tags beyond integer PCM and IMA ADPCM.
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+// Triangular dither source, one xorshift generator per vector lane. The
+// scalar path steps the lanes in the same order, so every kernel produces
+// identical output.
+struct DitherState {
+    unsigned int lanes[4];
+};
+
+// Reduces wide or floating point wave samples to the engine's 16 bit PCM,
+// with one LSB of triangular dither so quiet passages fade into noise
+// rather than truncation distortion.
+class SampleConverter {
+
+public:
+    static void seed(DitherState& dither);
+
+    // Convert count interleaved samples of each wave layout to 16 bit.
+    // Packed 24 bit samples are read in place from the mapping.
+    static void fromInt24(const unsigned char* in, long count, short* out, DitherState& dither);
+    static void fromInt32(const int* in, long count, short* out, DitherState& dither);
+    static void fromFloat32(const float* in, long count, short* out, DitherState& dither);
+
+    static const char* kernelName();
+};
+
+#endif /* SampleConvert_HPP_ */
@@ -0,0 +1,592 @@
+/*
+ * Copyright (c) 2013 BlackBerry Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <qdebug.h>
+#include <string.h>
+#include <time.h>
+#include "software_mixer.hpp"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Add 16 bit mono samples, scaled by gain, to both channels of a float
+// stereo accumulator.
+static void mixMono(float* out, const short* in, int frames, float gain)
+{
+    int i = 0;
+#if defined(__ARM_NEON__)
+    for (; i + 4 <= frames; i += 4) {
+        float32x4_t samples = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vld1_s16(in + i))), gain);
+        float32x4x2_t stereo = vzipq_f32(samples, samples);
+        vst1q_f32(out + 2 * i, vaddq_f32(vld1q_f32(out + 2 * i), stereo.val[0]));
+        vst1q_f32(out + 2 * i + 4, vaddq_f32(vld1q_f32(out + 2 * i + 4), stereo.val[1]));
+    }
+#elif defined(__SSE2__)
+    __m128 scale = _mm_set1_ps(gain);
+    for (; i + 4 <= frames; i += 4) {
+        __m128i wide = _mm_loadl_epi64((const __m128i*)(in + i));
+        wide = _mm_srai_epi32(_mm_unpacklo_epi16(wide, wide), 16);
+        __m128 samples = _mm_mul_ps(_mm_cvtepi32_ps(wide), scale);
+        _mm_storeu_ps(out + 2 * i, _mm_add_ps(_mm_loadu_ps(out + 2 * i), _mm_unpacklo_ps(samples, samples)));
+        _mm_storeu_ps(out + 2 * i + 4, _mm_add_ps(_mm_loadu_ps(out + 2 * i + 4), _mm_unpackhi_ps(samples, samples)));
+    }
+#endif
+    for (; i < frames; i++) {
+        float sample = in[i] * gain;
+        out[2 * i] += sample;
+        out[2 * i + 1] += sample;
+    }
+}
+
+// Add interleaved 16 bit stereo samples, scaled by gain, to the accumulator.
+static void mixStereo(float* out, const short* in, int frames, float gain)
+{
+    int samples = frames * 2;
+    int i = 0;
+#if defined(__ARM_NEON__)
+    for (; i + 4 <= samples; i += 4) {
+        float32x4_t scaled = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vld1_s16(in + i))), gain);
+        vst1q_f32(out + i, vaddq_f32(vld1q_f32(out + i), scaled));
+    }
+#elif defined(__SSE2__)
+    __m128 scale = _mm_set1_ps(gain);
+    for (; i + 4 <= samples; i += 4) {
+        __m128i wide = _mm_loadl_epi64((const __m128i*)(in + i));
+        wide = _mm_srai_epi32(_mm_unpacklo_epi16(wide, wide), 16);
+        __m128 scaled = _mm_mul_ps(_mm_cvtepi32_ps(wide), scale);
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), scaled));
+    }
+#endif
+    for (; i < samples; i++)
+        out[i] += in[i] * gain;
+}
+
+// Convert the accumulator to 16 bit samples, saturating at full scale.
+static void floatToShort(short* out, const float* in, int samples)
+{
+    int i = 0;
+#if defined(__ARM_NEON__)
+    for (; i + 4 <= samples; i += 4)
+        vst1_s16(out + i, vqmovn_s32(vcvtq_s32_f32(vld1q_f32(in + i))));
+#elif defined(__SSE2__)
+    for (; i + 8 <= samples; i += 8) {
+        __m128i low = _mm_cvttps_epi32(_mm_loadu_ps(in + i));
+        __m128i high = _mm_cvttps_epi32(_mm_loadu_ps(in + i + 4));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(low, high));
+    }
+#endif
+    for (; i < samples; i++) {
+        float sample = in[i];
+        if (sample > 32767.0f)
+            sample = 32767.0f;
+        else if (sample < -32768.0f)
+            sample = -32768.0f;
+        out[i] = (short)sample;
+    }
+}
+
+// Clips at another rate than the mixer are resampled linearly on the fly;
+// the vector kernels only cover clips at the mixer's own rate.
+static void mixResampled(float* out, const short* in, int channels, int clipFrames,
+                         double& position, double step, int frames, float gain)
+{
+    for (int i = 0; i < frames; i++) {
+        int index = (int)position;
+        float fraction = (float)(position - index);
+        int next = index + 1 < clipFrames ? index + 1 : index;
+
+        if (channels == 1) {
+            float sample = (in[index] + (in[next] - in[index]) * fraction) * gain;
+            out[2 * i] += sample;
+            out[2 * i + 1] += sample;
+        } else {
+            out[2 * i] += (in[2 * index] + (in[2 * next] - in[2 * index]) * fraction) * gain;
+            out[2 * i + 1] += (in[2 * index + 1] + (in[2 * next + 1] - in[2 * index + 1]) * fraction) * gain;
+        }
+        position += step;
+    }
+}
+
+MixerClip::MixerClip() :
+        m_samples(0), m_blockAlign(0), m_adpcmStorage(false), m_frames(0), m_channels(0), m_rate(0), m_loopStart(0), m_loopEnd(0) {
+}
+
+MixerClip::~MixerClip() {
+    delete[] m_samples;
+}
+
+bool MixerClip::assign(const void* pcm, size_t size, int channels, int bits, int rate) {
+    if ((channels != 1 && channels != 2) || (bits != 8 && bits != 16) || rate <= 0)
+        return false;
+
+    int frames = size / (channels * bits / 8);
+    if (frames <= 0)
+        return false;
+
+    release();
+    m_samples = new short[frames * channels];
+    m_frames = frames;
+    m_channels = channels;
+    m_rate = rate;
+
+    if (bits == 16) {
+        memcpy(m_samples, pcm, frames * channels * sizeof(short));
+    } else {
+        // 8 bit PCM is unsigned.
+        const unsigned char* bytes = static_cast<const unsigned char*>(pcm);
+        for (int i = 0; i < frames * channels; i++)
+            m_samples[i] = (short)((bytes[i] - 128) << 8);
+    }
+
+    // The PCM only lives long enough to be encoded.
+    if (m_adpcmStorage) {
+        m_adpcm.resize(ImaAdpcm::encodedSize(frames, channels));
+        ImaAdpcm::encode(m_samples, frames, channels, &m_adpcm[0]);
+        m_blockAlign = IMA_ADPCM_CHANNEL_BLOCK * channels;
+        delete[] m_samples;
+        m_samples = 0;
+    }
+    return true;
+}
+
+bool MixerClip::assignAdpcm(const void* data, size_t size, int frames, int channels, int blockAlign, int rate) {
+    if (!ImaAdpcm::validBlock(blockAlign, channels) || rate <= 0)
+        return false;
+
+    if (frames > ImaAdpcm::frames(size, blockAlign, channels) || frames <= 0)
+        return false;
+
+    release();
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    m_adpcm.assign(bytes, bytes + size);
+    m_blockAlign = blockAlign;
+    m_frames = frames;
+    m_channels = channels;
+    m_rate = rate;
+    return true;
+}
+
+void MixerClip::expand(int first, int count, short* out, AdpcmCursor& cursor) const {
+    ImaAdpcm::decode(&m_adpcm[0], m_blockAlign, m_channels, first, count, out, cursor);
+}
+
+size_t MixerClip::bytes() const {
+    if (compressed())
+        return m_adpcm.size();
+    return (size_t)m_frames * m_channels * sizeof(short);
+}
+
+void MixerClip::release() {
+    delete[] m_samples;
+    m_samples = 0;
+    std::vector<unsigned char>().swap(m_adpcm);
+    m_frames = 0;
+}
+
+void MixerClip::setLoop(int start, int end) {
+    bool valid = start >= 0 && start < end && end <= m_frames;
+    m_loopStart = valid ? start : 0;
+    m_loopEnd = valid ? end : 0;
+}
+
+SoftwareMixer::SoftwareMixer() :
+        m_rate(44100), m_source(0), m_order(0), m_steals(0), m_silentBlocks(0),
+        m_threadStarted(false), m_streaming(false), m_quit(false) {
+    memset(m_buffers, 0, sizeof(m_buffers));
+    m_active.reserve(SOFTWARE_MIXER_MAX_VOICES);
+    for (int i = SOFTWARE_MIXER_MAX_VOICES - 1; i >= 0; i--)
+        m_free.push_back(i);
+
+    m_mix = new float[SOFTWARE_MIXER_BLOCK_FRAMES * 2];
+    m_block = new short[SOFTWARE_MIXER_BLOCK_FRAMES * 2];
+    m_expanded = new short[SOFTWARE_MIXER_EXPANDED_FRAMES * 2];
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_wake, NULL);
+}
+
+SoftwareMixer::~SoftwareMixer() {
+    if (m_threadStarted) {
+        pthread_mutex_lock(&m_lock);
+        m_quit = true;
+        pthread_cond_signal(&m_wake);
+        pthread_mutex_unlock(&m_lock);
+        pthread_join(m_thread, NULL);
+    }
+
+    if (m_source) {
+        alSourceStop(m_source);
+        alSourcei(m_source, AL_BUFFER, 0);
+        alDeleteSources(1, &m_source);
+        alDeleteBuffers(SOFTWARE_MIXER_BUFFER_COUNT, m_buffers);
+    }
+
+    delete[] m_mix;
+    delete[] m_block;
+    delete[] m_expanded;
+    pthread_cond_destroy(&m_wake);
+    pthread_mutex_destroy(&m_lock);
+}
+
+bool SoftwareMixer::open(int rate) {
+    m_rate = rate;
+
+    alGenBuffers(SOFTWARE_MIXER_BUFFER_COUNT, m_buffers);
+    alGenSources(1, &m_source);
+
+    ALenum error = alGetError();
+    if (error != AL_NO_ERROR) {
+        qDebug() << "Failed to create the software mixer's source: " << error;
+        return false;
+    }
+
+    if (pthread_create(&m_thread, NULL, feedThread, this)) {
+        qDebug() << "Error creating software mixer thread";
+        return false;
+    }
+    m_threadStarted = true;
+    return true;
+}
+
+bool SoftwareMixer::play(int owner, const MixerClip* clip, float gain, bool looping,
+                         int maxVoices, int startFrame, bool& stolen) {
+    pthread_mutex_lock(&m_lock);
+    stolen = false;
+
+    // Recycle the owner's oldest voice at its cap, else the oldest of all
+    // when the mixer is full.
+    int steal = -1;
+    bool ownFull = maxVoices > 0 && ownerVoices(owner) >= maxVoices;
+    if (ownFull || m_free.empty()) {
+        for (size_t i = 0; i < m_active.size(); i++) {
+            const MixerVoice& voice = m_voices[m_active[i]];
+            if ((!ownFull || voice.owner == owner)
+                    && (steal < 0 || voice.order < m_voices[m_active[steal]].order))
+                steal = i;
+        }
+        if (steal < 0) {
+            pthread_mutex_unlock(&m_lock);
+            return false;
+        }
+        removeVoice(steal);
+        stolen = true;
+        m_steals++;
+    }
+
+    int index = m_free.back();
+    m_free.pop_back();
+
+    MixerVoice& voice = m_voices[index];
+    voice.clip = clip;
+    voice.owner = owner;
+    voice.gain = gain;
+    voice.step = (double)clip->rate() / m_rate;
+    voice.position = startFrame > 0 && startFrame < clip->frames() ? startFrame : 0;
+    voice.cursor.frame = -1;
+    voice.order = m_order++;
+    voice.looping = looping;
+    m_active.push_back(index);
+
+    if (!m_streaming)
+        startStreaming();
+
+    pthread_mutex_unlock(&m_lock);
+    return true;
+}
+
+bool SoftwareMixer::loopNewest(int owner) {
+    pthread_mutex_lock(&m_lock);
+    int newest = -1;
+    for (size_t i = 0; i < m_active.size(); i++) {
+        const MixerVoice& voice = m_voices[m_active[i]];
+        if (voice.owner == owner && (newest < 0 || voice.order > m_voices[newest].order))
+            newest = m_active[i];
+    }
+    if (newest >= 0)
+        m_voices[newest].looping = true;
+    pthread_mutex_unlock(&m_lock);
+    return newest >= 0;
+}
+
+void SoftwareMixer::stopOwner(int owner) {
+    pthread_mutex_lock(&m_lock);
+    for (size_t i = m_active.size(); i-- > 0;) {
+        if (m_voices[m_active[i]].owner == owner)
+            removeVoice(i);
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+void SoftwareMixer::setOwnerGain(int owner, float gain) {
+    pthread_mutex_lock(&m_lock);
+    for (size_t i = 0; i < m_active.size(); i++) {
+        if (m_voices[m_active[i]].owner == owner)
+            m_voices[m_active[i]].gain = gain;
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+void SoftwareMixer::stopClip(const MixerClip* clip) {
+    pthread_mutex_lock(&m_lock);
+    for (size_t i = m_active.size(); i-- > 0;) {
+        if (m_voices[m_active[i]].clip == clip)
+            removeVoice(i);
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+int SoftwareMixer::clipVoices(const MixerClip* clip) {
+    pthread_mutex_lock(&m_lock);
+    int count = 0;
+    for (size_t i = 0; i < m_active.size(); i++) {
+        if (m_voices[m_active[i]].clip == clip)
+            count++;
+    }
+    pthread_mutex_unlock(&m_lock);
+    return count;
+}
+
+bool SoftwareMixer::isActive() {
+    pthread_mutex_lock(&m_lock);
+    bool active = m_streaming;
+    pthread_mutex_unlock(&m_lock);
+    return active;
+}
+
+int SoftwareMixer::activeVoices() {
+    pthread_mutex_lock(&m_lock);
+    int count = m_active.size();
+    pthread_mutex_unlock(&m_lock);
+    return count;
+}
+
+unsigned int SoftwareMixer::steals() {
+    pthread_mutex_lock(&m_lock);
+    unsigned int count = m_steals;
+    pthread_mutex_unlock(&m_lock);
+    return count;
+}
+
+void SoftwareMixer::render(short* out, int frames) {
+    pthread_mutex_lock(&m_lock);
+    renderLocked(out, frames);
+    pthread_mutex_unlock(&m_lock);
+}
+
+void SoftwareMixer::service() {
+    pthread_mutex_lock(&m_lock);
+    if (m_streaming)
+        refill();
+    pthread_mutex_unlock(&m_lock);
+}
+
+const char* SoftwareMixer::kernelName() {
+#if defined(__ARM_NEON__)
+    return "neon";
+#elif defined(__SSE2__)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+void SoftwareMixer::renderLocked(short* out, int frames) {
+    while (frames > 0) {
+        int block = frames < SOFTWARE_MIXER_BLOCK_FRAMES ? frames : SOFTWARE_MIXER_BLOCK_FRAMES;
+        memset(m_mix, 0, block * 2 * sizeof(float));
+
+        for (size_t i = m_active.size(); i-- > 0;) {
+            MixerVoice& voice = m_voices[m_active[i]];
+            const MixerClip* clip = voice.clip;
+            float* mix = m_mix;
+            int remaining = block;
+            bool finished = false;
+
+            while (remaining > 0) {
+                // A looping voice turns back at the loop end, unless it was
+                // already past it when it started looping.
+                int end = clip->frames();
+                int restart = clip->loopStart();
+                if (voice.looping && clip->loopEnd() && voice.position < clip->loopEnd())
+                    end = clip->loopEnd();
+
+                int position = (int)voice.position;
+                if (voice.step == 1.0) {
+                    int count = end - position;
+                    if (count > remaining)
+                        count = remaining;
+
+                    // Compressed clips are expanded a run at a time and
+                    // mixed by the same kernels.
+                    const short* samples = clip->samples() + position * clip->channels();
+                    if (clip->compressed()) {
+                        clip->expand(position, count, m_expanded, voice.cursor);
+                        samples = m_expanded;
+                    }
+                    if (clip->channels() == 1)
+                        mixMono(mix, samples, count, voice.gain);
+                    else
+                        mixStereo(mix, samples, count, voice.gain);
+
+                    voice.position += count;
+                    mix += count * 2;
+                    remaining -= count;
+                } else {
+                    int count = (int)((end - voice.position) / voice.step);
+                    if (count <= 0)
+                        count = 1;
+                    if (count > remaining)
+                        count = remaining;
+
+                    if (clip->compressed()) {
+                        // Expand the frames this run reads, as many as fit.
+                        int fit = (int)((SOFTWARE_MIXER_EXPANDED_FRAMES - 2) / voice.step);
+                        if (count > fit)
+                            count = fit > 0 ? fit : 1;
+                        int last = (int)(voice.position + count * voice.step) + 2;
+                        if (last > clip->frames())
+                            last = clip->frames();
+                        clip->expand(position, last - position, m_expanded, voice.cursor);
+
+                        double local = voice.position - position;
+                        mixResampled(mix, m_expanded, clip->channels(), last - position,
+                                     local, voice.step, count, voice.gain);
+                        voice.position = position + local;
+                    } else {
+                        mixResampled(mix, clip->samples(), clip->channels(), clip->frames(),
+                                     voice.position, voice.step, count, voice.gain);
+                    }
+                    mix += count * 2;
+                    remaining -= count;
+                }
+
+                if (voice.position >= end) {
+                    if (!voice.looping) {
+                        finished = true;
+                        break;
+                    }
+                    voice.position -= end - restart;
+                }
+            }
+
+            if (finished)
+                removeVoice(i);
+        }
+
+        floatToShort(out, m_mix, block * 2);
+        out += block * 2;
+        frames -= block;
+    }
+}
+
+void SoftwareMixer::startStreaming() {
+    if (!m_source)
+        return;
+
+    // Queue the whole ring at once; the first block already holds the
+    // voice that was just started.
+    alSourceStop(m_source);
+    alSourcei(m_source, AL_BUFFER, 0);
+    for (int i = 0; i < SOFTWARE_MIXER_BUFFER_COUNT; i++) {
+        renderLocked(m_block, SOFTWARE_MIXER_BLOCK_FRAMES);
+        alBufferData(m_buffers[i], AL_FORMAT_STEREO16, m_block,
+                     SOFTWARE_MIXER_BLOCK_FRAMES * 2 * sizeof(short), m_rate);
+    }
+    alSourceQueueBuffers(m_source, SOFTWARE_MIXER_BUFFER_COUNT, m_buffers);
+    alSourcePlay(m_source);
+
+    m_streaming = true;
+    m_silentBlocks = 0;
+    pthread_cond_signal(&m_wake);
+}
+
+void SoftwareMixer::removeVoice(int active) {
+    m_free.push_back(m_active[active]);
+    m_active[active] = m_active.back();
+    m_active.pop_back();
+}
+
+int SoftwareMixer::ownerVoices(int owner) const {
+    int count = 0;
+    for (size_t i = 0; i < m_active.size(); i++) {
+        if (m_voices[m_active[i]].owner == owner)
+            count++;
+    }
+    return count;
+}
+
+void SoftwareMixer::refill() {
+    // Mix into every buffer the source has finished with.
+    ALint processed = 0;
+    alGetSourcei(m_source, AL_BUFFERS_PROCESSED, &processed);
+    while (processed-- > 0) {
+        ALuint buffer;
+        alSourceUnqueueBuffers(m_source, 1, &buffer);
+        m_silentBlocks = m_active.empty() ? m_silentBlocks + 1 : 0;
+        renderLocked(m_block, SOFTWARE_MIXER_BLOCK_FRAMES);
+        alBufferData(buffer, AL_FORMAT_STEREO16, m_block,
+                     SOFTWARE_MIXER_BLOCK_FRAMES * 2 * sizeof(short), m_rate);
+        alSourceQueueBuffers(m_source, 1, &buffer);
+    }
+
+    // Once the last voice has been heard out, stop streaming silence.
+    if (m_silentBlocks > SOFTWARE_MIXER_BUFFER_COUNT) {
+        alSourceStop(m_source);
+        alSourcei(m_source, AL_BUFFER, 0);
+        m_streaming = false;
+        return;
+    }
+
+    // Restart after an underrun.
+    ALint state;
+    alGetSourcei(m_source, AL_SOURCE_STATE, &state);
+    if (state != AL_PLAYING)
+        alSourcePlay(m_source);
+}
+
+void* SoftwareMixer::feedThread(void* mixer) {
+    static_cast<SoftwareMixer*>(mixer)->run();
+    return NULL;
+}
+
+void SoftwareMixer::run() {
+    pthread_mutex_lock(&m_lock);
+
+    while (!m_quit) {
+        if (!m_streaming) {
+            pthread_cond_wait(&m_wake, &m_lock);
+            continue;
+        }
+
+        refill();
+        if (!m_streaming)
+            continue;
+
+        // Check back twice per block, or sooner if a play wakes us.
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += SOFTWARE_MIXER_BLOCK_FRAMES * 1000000000LL / m_rate / 2;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&m_wake, &m_lock, &deadline);
+    }
+
+    pthread_mutex_unlock(&m_lock);
+}
@@ -0,0 +1,183 @@
+/*
+* Copyright (c) 2013 BlackBerry Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+
+#ifndef SoftwareMixer_HPP_
+#define SoftwareMixer_HPP_
+
+#include <stddef.h>
+#include <vector>
+#include <pthread.h>
+#include <AL/al.h>
+#include "ima_adpcm.hpp"
+
+// Most voices the software mixer plays at once.
+#define SOFTWARE_MIXER_MAX_VOICES 512
+// Frames mixed into each streaming buffer, and how many are queued.
+#define SOFTWARE_MIXER_BLOCK_FRAMES 256
+#define SOFTWARE_MIXER_BUFFER_COUNT 4
+// Output rate used when the device does not report its own.
+#define SOFTWARE_MIXER_DEFAULT_RATE 44100
+// Frames of an ADPCM clip a voice expands at a time.
+#define SOFTWARE_MIXER_EXPANDED_FRAMES 1024
+
+// Samples kept in engine memory for the software mixer, as 16 bit PCM or,
+// with ADPCM storage, as 4 bit IMA ADPCM that voices expand as they play.
+class MixerClip {
+
+public:
+    MixerClip();
+    ~MixerClip();
+
+    // Copy 8 or 16 bit interleaved PCM, widening 8 bit samples, and encode
+    // it if the clip stores ADPCM.
+    bool assign(const void* pcm, size_t size, int channels, int bits, int rate);
+    // Keep frames of IMA ADPCM blocks from a wave file as they are.
+    bool assignAdpcm(const void* data, size_t size, int frames, int channels, int blockAlign, int rate);
+    // Free the samples, keeping the format and loop for the next assign.
+    void release();
+
+    // Whether assign encodes to ADPCM, and whether the samples are ADPCM.
+    void setAdpcmStorage(bool enabled) { m_adpcmStorage = enabled; }
+    bool adpcmStorage() const { return m_adpcmStorage; }
+    bool compressed() const { return !m_adpcm.empty(); }
+    // Decode count frames from first of a compressed clip.
+    void expand(int first, int count, short* out, AdpcmCursor& cursor) const;
+    // Bytes of sample data held.
+    size_t bytes() const;
+
+    // 16 bit samples; null for a compressed clip.
+    const short* samples() const { return m_samples; }
+    int frames() const { return m_frames; }
+    int channels() const { return m_channels; }
+    int rate() const { return m_rate; }
+    double duration() const { return m_rate ? (double)m_frames / m_rate : 0; }
+
+    // Frames a looping voice repeats after playing up to end once; the whole
+    // clip when end is 0.
+    void setLoop(int start, int end);
+    int loopStart() const { return m_loopStart; }
+    int loopEnd() const { return m_loopEnd; }
+
+private:
+    MixerClip(const MixerClip&);
+    MixerClip& operator=(const MixerClip&);
+
+    short* m_samples;
+    std::vector<unsigned char> m_adpcm;
+    int m_blockAlign;
+    bool m_adpcmStorage;
+    int m_frames;
+    int m_channels;
+    int m_rate;
+    int m_loopStart;
+    int m_loopEnd;
+};
+
+// Mixes any number of voices in C++ into float blocks and feeds them to a
+// single streaming source, so polyphony is bounded by CPU rather than by
+// the device's source count. Voices belong to an owner (an asset slot),
+// which can cap how many it holds; when the mixer is full the oldest voice
+// is stolen. The source only streams while something is playing.
+class SoftwareMixer {
+
+public:
+    SoftwareMixer();
+    ~SoftwareMixer();
+
+    // Create the streaming source and its feeding thread. A mixer that is
+    // never opened can still render, silently, at the rate set here; the
+    // benchmark relies on that.
+    bool open(int rate);
+    void setRate(int rate) { m_rate = rate; }
+    int rate() const { return m_rate; }
+
+    // Start a clip, skipping startFrame frames. Returns false if no voice
+    // could be had; stolen reports whether one was cut short.
+    bool play(int owner, const MixerClip* clip, float gain, bool looping,
+              int maxVoices, int startFrame, bool& stolen);
+    // Keep the owner's newest voice looping; false if none is playing.
+    bool loopNewest(int owner);
+    void stopOwner(int owner);
+    void setOwnerGain(int owner, float gain);
+    // Stop every voice reading a clip about to be deleted.
+    void stopClip(const MixerClip* clip);
+    // Voices currently reading a clip.
+    int clipVoices(const MixerClip* clip);
+
+    bool isActive();
+    int activeVoices();
+    unsigned int steals();
+
+    // Mix the next frames into interleaved stereo 16 bit samples.
+    void render(short* out, int frames);
+    // Refill the buffers the source has played now instead of waiting for
+    // the feeding thread, for a device that mixes faster than real time.
+    void service();
+
+    // Name of the kernels compiled in: "neon", "sse2" or "scalar".
+    static const char* kernelName();
+
+private:
+    SoftwareMixer(const SoftwareMixer&);
+    SoftwareMixer& operator=(const SoftwareMixer&);
+
+    struct MixerVoice {
+        const MixerClip* clip;
+        int owner;
+        float gain;
+        double position;        // frames into the clip
+        double step;            // clip frames per output frame
+        AdpcmCursor cursor;     // decoder state for a compressed clip
+        unsigned int order;     // start order, for stealing the oldest
+        bool looping;
+    };
+
+    static void* feedThread(void* mixer);
+    void run();
+
+    // All expect m_lock to be held.
+    void renderLocked(short* out, int frames);
+    void startStreaming();
+    void refill();
+    void removeVoice(int active);
+    int ownerVoices(int owner) const;
+
+    int m_rate;
+    ALuint m_source;
+    ALuint m_buffers[SOFTWARE_MIXER_BUFFER_COUNT];
+
+    MixerVoice m_voices[SOFTWARE_MIXER_MAX_VOICES];
+    // Indices of playing voices, and of free ones.
+    std::vector<int> m_active;
+    std::vector<int> m_free;
+    unsigned int m_order;
+    unsigned int m_steals;
+
+    float* m_mix;
+    short* m_block;
+    short* m_expanded;          // a voice's frames of a compressed clip
+    int m_silentBlocks;
+
+    pthread_t m_thread;
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_wake;
+    bool m_threadStarted;
+    bool m_streaming;
+    bool m_quit;
+};
+
+#endif /* SoftwareMixer_HPP_ */
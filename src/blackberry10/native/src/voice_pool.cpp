@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2013 BlackBerry Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include <functional>
+#include "voice_pool.hpp"
+
+static int clampPriority(int priority)
+{
+    if (priority < 0)
+        return 0;
+    if (priority >= VOICE_PRIORITY_LEVELS)
+        return VOICE_PRIORITY_LEVELS - 1;
+    return priority;
+}
+
+VoicePool::VoicePool() :
+        m_capacity(0), m_busy(0), m_leases(0), m_steals(0), m_ownSteals(0), m_denied(0) {
+    for (int i = 0; i < VOICE_PRIORITY_LEVELS; i++) {
+        m_levels[i].head = m_levels[i].tail = -1;
+        m_levels[i].count = 0;
+    }
+}
+
+void VoicePool::addVoice(ALuint source) {
+    Voice voice = { source, -1, -1, 0, 0, 0, false, false, -1, -1, -1, -1 };
+    m_voices.push_back(voice);
+    m_free.push_back(m_voices.size() - 1);
+}
+
+bool VoicePool::hasIdleVoice(double now) {
+    reclaim(now);
+    return !m_free.empty();
+}
+
+bool VoicePool::isSilent(double now) {
+    reclaim(now);
+    return m_busy == 0;
+}
+
+VoiceLease VoicePool::acquire(int owner, int priority, int maxVoices, double duration, double now) {
+    VoiceLease lease = { -1, false, false, false };
+    priority = clampPriority(priority);
+    reclaim(now);
+
+    List& own = ownerList(owner);
+    int index = -1;
+
+    if (maxVoices > 0 && own.count >= maxVoices) {
+        // The asset is at its own limit; recycle its oldest voice, as a
+        // fixed set of per-asset sources would.
+        index = own.head;
+        for (int i = own.head; i >= 0; i = m_voices[i].ownerNext) {
+            if (!m_voices[i].looping) {
+                index = i;
+                break;
+            }
+        }
+        m_ownSteals++;
+    } else if (!m_free.empty()) {
+        index = m_free.back();
+        m_free.pop_back();
+    } else {
+        // Take the oldest voice at the lowest priority we may preempt.
+        for (int level = 0; level <= priority && index < 0; level++)
+            index = m_levels[level].head;
+
+        // Only loops are left; take the oldest at or below our priority.
+        if (index < 0) {
+            for (int i = 0; i < (int)m_voices.size(); i++) {
+                const Voice& voice = m_voices[i];
+                if (voice.busy && voice.priority <= priority
+                        && (index < 0 || voice.priority < m_voices[index].priority
+                            || (voice.priority == m_voices[index].priority && voice.startTime < m_voices[index].startTime)))
+                    index = i;
+            }
+        }
+
+        if (index < 0) {
+            m_denied++;
+            return lease;
+        }
+    }
+
+    Voice& voice = m_voices[index];
+    if (voice.busy) {
+        lease.stolen = true;
+        lease.unloop = voice.looping;
+        m_steals++;
+    }
+
+    lease.voice = index;
+    lease.rebind = voice.attached != owner;
+    start(index, owner, priority, duration, now);
+    m_leases++;
+    return lease;
+}
+
+void VoicePool::start(int index, int owner, int priority, double duration, double now) {
+    Voice& voice = m_voices[index];
+    if (voice.busy) {
+        unlink(index);
+    } else {
+        for (size_t i = 0; i < m_free.size(); i++) {
+            if (m_free[i] == index) {
+                m_free.erase(m_free.begin() + i);
+                break;
+            }
+        }
+        m_busy++;
+    }
+
+    voice.owner = owner;
+    voice.attached = owner;
+    voice.priority = clampPriority(priority);
+    voice.busy = true;
+    voice.looping = false;
+    voice.startTime = now;
+    voice.endTime = now + duration;
+    link(index);
+    m_endings.push(Ending(voice.endTime, index));
+}
+
+bool VoicePool::isPlaying(int index, double now) const {
+    const Voice& voice = m_voices[index];
+    return voice.busy && (voice.looping || voice.endTime > now);
+}
+
+void VoicePool::setLooping(int index, bool looping) {
+    Voice& voice = m_voices[index];
+    if (!voice.busy || voice.looping == looping)
+        return;
+
+    // Loops never end on their own and are kept out of the steal queues.
+    unlink(index);
+    voice.looping = looping;
+    link(index);
+}
+
+void VoicePool::release(int index) {
+    Voice& voice = m_voices[index];
+    if (!voice.busy)
+        return;
+
+    unlink(index);
+    voice.busy = false;
+    voice.looping = false;
+    voice.owner = -1;
+    m_free.push_back(index);
+    m_busy--;
+}
+
+void VoicePool::detachOwner(int owner, std::vector<ALuint>& sources) {
+    for (size_t i = 0; i < m_voices.size(); i++) {
+        if (m_voices[i].attached == owner) {
+            m_voices[i].attached = -1;
+            sources.push_back(m_voices[i].source);
+        }
+    }
+}
+
+void VoicePool::attachedSources(int owner, std::vector<ALuint>& sources) const {
+    for (size_t i = 0; i < m_voices.size(); i++) {
+        if (m_voices[i].attached == owner)
+            sources.push_back(m_voices[i].source);
+    }
+}
+
+int VoicePool::newestVoice(int owner) const {
+    if (owner < 0 || owner >= (int)m_owners.size())
+        return -1;
+    return m_owners[owner].tail;
+}
+
+int VoicePool::activeVoices(int owner) const {
+    if (owner < 0 || owner >= (int)m_owners.size())
+        return 0;
+    return m_owners[owner].count;
+}
+
+void VoicePool::reclaim(double now) {
+    while (!m_endings.empty() && m_endings.top().first <= now) {
+        Ending ending = m_endings.top();
+        m_endings.pop();
+
+        // Skip entries left behind by voices restarted or stopped since.
+        const Voice& voice = m_voices[ending.second];
+        if (voice.busy && !voice.looping && voice.endTime == ending.first)
+            release(ending.second);
+    }
+}
+
+VoicePool::List& VoicePool::ownerList(int owner) {
+    if (owner >= (int)m_owners.size()) {
+        List empty = { -1, -1, 0 };
+        m_owners.resize(owner + 1, empty);
+    }
+    return m_owners[owner];
+}
+
+void VoicePool::link(int index) {
+    Voice& voice = m_voices[index];
+
+    List& own = ownerList(voice.owner);
+    voice.ownerPrev = own.tail;
+    voice.ownerNext = -1;
+    if (own.tail >= 0)
+        m_voices[own.tail].ownerNext = index;
+    else
+        own.head = index;
+    own.tail = index;
+    own.count++;
+
+    if (voice.looping)
+        return;
+
+    List& level = m_levels[voice.priority];
+    voice.queuePrev = level.tail;
+    voice.queueNext = -1;
+    if (level.tail >= 0)
+        m_voices[level.tail].queueNext = index;
+    else
+        level.head = index;
+    level.tail = index;
+    level.count++;
+}
+
+void VoicePool::unlink(int index) {
+    Voice& voice = m_voices[index];
+
+    List& own = ownerList(voice.owner);
+    if (voice.ownerPrev >= 0)
+        m_voices[voice.ownerPrev].ownerNext = voice.ownerNext;
+    else
+        own.head = voice.ownerNext;
+    if (voice.ownerNext >= 0)
+        m_voices[voice.ownerNext].ownerPrev = voice.ownerPrev;
+    else
+        own.tail = voice.ownerPrev;
+    own.count--;
+    voice.ownerPrev = voice.ownerNext = -1;
+
+    if (voice.looping)
+        return;
+
+    List& level = m_levels[voice.priority];
+    if (voice.queuePrev >= 0)
+        m_voices[voice.queuePrev].queueNext = voice.queueNext;
+    else
+        level.head = voice.queueNext;
+    if (voice.queueNext >= 0)
+        m_voices[voice.queueNext].queuePrev = voice.queuePrev;
+    else
+        level.tail = voice.queuePrev;
+    level.count--;
+    voice.queuePrev = voice.queueNext = -1;
+}
@@ -0,0 +1,129 @@
+/*
+* Copyright (c) 2013 BlackBerry Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+
+#ifndef VoicePool_HPP_
+#define VoicePool_HPP_
+
+#include <queue>
+#include <utility>
+#include <vector>
+#include <AL/al.h>
+
+// Priorities are clamped to this many levels; higher levels win steals.
+#define VOICE_PRIORITY_LEVELS 16
+
+// Engine side state of one OpenAL source in the pool.
+struct Voice {
+    ALuint source;
+    int owner;              // asset slot playing on it, or -1
+    int attached;           // asset slot whose buffer is bound, or -1
+    int priority;
+    double startTime;       // when it was last started, in seconds
+    double endTime;         // when it is expected to fall silent
+    bool busy;
+    bool looping;
+
+    // Links in the owner's voices and in the steal queue of the voice's
+    // priority level, both in start order, or -1.
+    int ownerPrev;
+    int ownerNext;
+    int queuePrev;
+    int queueNext;
+};
+
+// Result of asking the pool for a voice.
+struct VoiceLease {
+    int voice;              // index of the voice, or -1 if none could be had
+    bool stolen;            // the voice was cut off mid-sound
+    bool rebind;            // the source still holds another asset's buffer
+    bool unloop;            // the source was looping and must stop
+};
+
+// Engine-wide pool of OpenAL sources handed out to any asset on demand.
+// Voices are reclaimed once their expected end time has passed. When none
+// are idle the pool steals: first the oldest voice of an asset already at
+// its own voice limit, then the oldest voice at the lowest priority not
+// above the requester's. Looping voices are only stolen as a last resort.
+// The pool never calls OpenAL itself; callers grow it and drive the sources.
+class VoicePool {
+
+public:
+    VoicePool();
+
+    // Most sources the device will give us.
+    void setCapacity(int capacity) { m_capacity = capacity; }
+    int capacity() const { return m_capacity; }
+    int count() const { return m_voices.size(); }
+    const Voice& voice(int index) const { return m_voices[index]; }
+
+    void addVoice(ALuint source);
+    // Reclaim finished voices and report whether one is idle.
+    bool hasIdleVoice(double now);
+    // Reclaim finished voices and report whether none are left playing.
+    bool isSilent(double now);
+
+    VoiceLease acquire(int owner, int priority, int maxVoices, double duration, double now);
+    // Mark a specific idle or owned voice as started at now.
+    void start(int index, int owner, int priority, double duration, double now);
+    bool isPlaying(int index, double now) const;
+    // Keep a voice playing until it is released.
+    void setLooping(int index, bool looping);
+    void release(int index);
+    // Forget that an owner's buffer is bound, collecting the sources.
+    void detachOwner(int owner, std::vector<ALuint>& sources);
+    // Collect the sources that have an owner's buffer bound.
+    void attachedSources(int owner, std::vector<ALuint>& sources) const;
+    // Voice a loop of owner should use: its most recently started one.
+    int newestVoice(int owner) const;
+    int activeVoices(int owner) const;
+
+    unsigned int leases() const { return m_leases; }
+    unsigned int steals() const { return m_steals; }
+    unsigned int ownSteals() const { return m_ownSteals; }
+    unsigned int denied() const { return m_denied; }
+    int busyVoices() const { return m_busy; }
+
+private:
+    struct List {
+        int head;
+        int tail;
+        int count;
+    };
+
+    void reclaim(double now);
+    List& ownerList(int owner);
+    void link(int index);
+    void unlink(int index);
+
+    std::vector<Voice> m_voices;
+    std::vector<int> m_free;
+    std::vector<List> m_owners;
+    List m_levels[VOICE_PRIORITY_LEVELS];
+
+    // Voices by expected end time; stale entries are skipped on reclaim.
+    typedef std::pair<double, int> Ending;
+    std::priority_queue<Ending, std::vector<Ending>, std::greater<Ending> > m_endings;
+
+    int m_capacity;
+    int m_busy;
+    unsigned int m_leases;
+    unsigned int m_steals;
+    unsigned int m_ownSteals;
+    unsigned int m_denied;
+};
+
+#endif /* VoicePool_HPP_ */
@@ -27,11 +27,17 @@ module.exports  = {
         return cordova.exec(success, fail, "LowLatencyAudio", "preloadFX", [id, assetPath]);
     },
 
-    preloadAudio: function(id, assetPath, volume, voices, success, fail) {
+    preloadAudio: function(id, assetPath, volume, voices, priority, success, fail) {
+        // priority is optional, ahead of the callbacks.
+        if (typeof priority === "function") {
+            fail = success;
+            success = priority;
+            priority = 0;
+        }
         if (voices === undefined) voices = 1;
         if (volume === undefined) volume = 1.0;
 
-        return cordova.exec(success, fail, "LowLatencyAudio", "preloadAudio", [id, assetPath, volume, voices]);
+        return cordova.exec(success, fail, "LowLatencyAudio", "preloadAudio", [id, assetPath, volume, voices, priority || 0]);
     },
 
     play: function(id, success, fail) {
@@ -48,5 +54,142 @@ module.exports  = {
 
     unload: function(id, success, fail) {
         return cordova.exec(success, fail, "LowLatencyAudio", "unload", [id]);
+    },
+
+    getLoadStats: function(id, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "getLoadStats", [id]);
+    },
+
+    preloadStream: function(id, assetPath, volume, success, fail) {
+        if (volume === undefined) volume = 1.0;
+
+        return cordova.exec(success, fail, "LowLatencyAudio", "preloadStream", [id, assetPath, volume]);
+    },
+
+    preloadFXAsync: function(id, assetPath, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "preloadFXAsync", [id, assetPath]);
+    },
+
+    preloadAudioAsync: function(id, assetPath, volume, voices, priority, success, fail) {
+        if (typeof priority === "function") {
+            fail = success;
+            success = priority;
+            priority = 0;
+        }
+        if (voices === undefined) voices = 1;
+        if (volume === undefined) volume = 1.0;
+
+        return cordova.exec(success, fail, "LowLatencyAudio", "preloadAudioAsync", [id, assetPath, volume, voices, priority || 0]);
+    },
+
+    preloadManifest: function(manifest, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "preloadManifest", [manifest]);
+    },
+
+    setPcmCache: function(limit, directory, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "setPcmCache", [limit, directory || ""]);
+    },
+
+    getPcmCacheStats: function(success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "getPcmCacheStats", []);
+    },
+
+    benchmark: function(name, parameters, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "benchmark", [name, parameters || ""]);
+    },
+
+    getVoiceStats: function(success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "getVoiceStats", []);
+    },
+
+    getIdleStats: function(success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "getIdleStats", []);
+    },
+
+    getDeviceStats: function(success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "getDeviceStats", []);
+    },
+
+    shutdown: function(success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "shutdown", []);
+    },
+
+    getCommandStats: function(success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "getCommandStats", []);
+    },
+
+    batch: function(operations, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "batch", [operations]);
+    },
+
+    now: function(success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "now", []);
+    },
+
+    playAt: function(id, time, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "playAt", [id, time]);
+    },
+
+    stopAt: function(id, time, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "stopAt", [id, time]);
+    },
+
+    getScheduleStats: function(success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "getScheduleStats", []);
+    },
+
+    setEngineMode: function(mode, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "setEngineMode", [mode]);
+    },
+
+    setOfflineMode: function(rate, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "setOfflineMode", [rate]);
+    },
+
+    renderOffline: function(seconds, path, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "renderOffline", [seconds, path]);
+    },
+
+    preloadSprite: function(id, assetPath, volume, voices, regionsPath, success, fail) {
+        if (voices === undefined) voices = 1;
+        if (volume === undefined) volume = 1.0;
+
+        return cordova.exec(success, fail, "LowLatencyAudio", "preloadSprite", [id, assetPath, volume, voices, regionsPath || ""]);
+    },
+
+    setResampling: function(quality, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "setResampling", [quality]);
+    },
+
+    setMemoryBudget: function(bytes, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "setMemoryBudget", [bytes]);
+    },
+
+    pin: function(id, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "pin", [id]);
+    },
+
+    unpin: function(id, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "unpin", [id]);
+    },
+
+    getMemoryStats: function(success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "getMemoryStats", []);
+    },
+
+    setSampleStorage: function(storage, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "setSampleStorage", [storage]);
+    },
+
+    setSilenceTrim: function(threshold, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "setSilenceTrim", [threshold]);
+    },
+
+    setLoudnessTarget: function(target, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "setLoudnessTarget", [target]);
+    },
+
+    getLoudness: function(id, success, fail) {
+        return cordova.exec(success, fail, "LowLatencyAudio", "getLoudness", [id]);
     }
 };
\ No newline at end of file